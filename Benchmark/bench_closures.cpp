@@ -0,0 +1,58 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "decompiler.h"
+
+namespace
+{
+	// a chunk of global functions, each large enough to be handed to a worker,
+	//  with a closure using upvalues nested inside
+	std::string generateSource(int numFunctions)
+	{
+		std::ostringstream src;
+		for (int i = 0; i < numFunctions; ++i)
+		{
+			src << "function f" << i << "(a, b, t)\n";
+			src << "\tlocal c = a + " << i << "\n";
+			for (int j = 0; j < 40; ++j)
+			{
+				src << "\tif a < b and t.x" << j << " then c = c * 2 + t[a] elseif not b then t.y = a .. \"s" << j << "\" end\n";
+				src << "\twhile c > " << j << " do c = c - b end\n";
+			}
+			src << "\tt.g = function(x) return x + %a + %c end\n";
+			src << "\treturn c\n";
+			src << "end\n";
+		}
+		return src.str();
+	}
+
+	bool run(const std::string &path, unsigned int jobs, int iterations, const std::string &variant)
+	{
+		Decompiler decompiler;
+		decompiler.setJobs(jobs);
+		return timeDecompile(decompiler, path, iterations, "closures", variant);
+	}
+}
+
+// decompiles one file with many nested functions, serially and on the closure pool
+int benchClosures(int argc, const char* argv[])
+{
+	int numFunctions = argc > 0 ? std::atoi(argv[0]) : 400;
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 5;
+	const std::string path = "bench_closures.luac";
+
+	if (!compileChunk(generateSource(numFunctions), path))
+	{
+		std::cerr << "could not compile the benchmark chunk\n";
+		return 1;
+	}
+
+	const std::string size = std::to_string(numFunctions);
+	bool ok = run(path, 1, iterations, "serial_" + size)
+		&& run(path, 0, iterations, "parallel_" + size);
+
+	std::remove(path.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "decompiler.h"
+
+namespace
+{
+	// one function made of chains of nested ifs. every level holds a call
+	//  before and after its block, so each block ends on its own line and
+	//  the condition headers land in front of a growing body
+	std::string generateSource(int numConditions, int depth)
+	{
+		std::ostringstream src;
+		src << "function f(a, b)\n";
+		for (int done = 0; done < numConditions; done += depth)
+		{
+			int levels = (numConditions - done < depth) ? numConditions - done : depth;
+			for (int i = 0; i < levels; ++i)
+				src << "print(a, " << i << ")\nif a then\n";
+			src << "print(b)\n";
+			for (int i = 0; i < levels; ++i)
+				src << "end\nprint(b, " << i << ")\n";
+		}
+		src << "end\n";
+		return src.str();
+	}
+}
+
+// decompiles a single function with thousands of nested conditionals
+int benchConditions(int argc, const char* argv[])
+{
+	int numConditions = argc > 0 ? std::atoi(argv[0]) : 10000;
+	int depth = argc > 1 ? std::atoi(argv[1]) : 1000;
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 5;
+	const std::string path = "bench_conditions.luac";
+
+	if (depth <= 0 || !compileChunk(generateSource(numConditions, depth), path))
+	{
+		std::cerr << "could not compile the benchmark chunk\n";
+		return 1;
+	}
+
+	Decompiler decompiler;
+	bool ok = timeDecompile(decompiler, path, iterations, "conditions", "nested_" + std::to_string(depth));
+
+	std::remove(path.c_str());
+	return ok ? 0 : 1;
+}
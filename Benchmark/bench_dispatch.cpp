@@ -0,0 +1,55 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "decompiler.h"
+
+namespace
+{
+	// one long function of short statements cycling through most opcodes,
+	//  comparisons, arithmetic, table access and calls. the conditions are
+	//  single jumps so the time goes into the instructions, not the structure
+	std::string generateSource(int numStatements)
+	{
+		static const char* const statements[] =
+		{
+			"if a < b then c = a + b * 2 end\n",
+			"if a ~= c then t.x = a - b / c end\n",
+			"if b >= 10 then t[a] = -b end\n",
+			"if not a then print(a, b, c) end\n",
+			"if a == b then c = a ^ 2 .. \"s\" end\n",
+			"if c > a then b = t.y + t[c] end\n",
+			"if a <= 0 then a = a + 1 end\n",
+			"if t then t:m(a, 1.5) end\n",
+		};
+		const int numKinds = sizeof(statements) / sizeof(statements[0]);
+
+		std::ostringstream src;
+		src << "function f(a, b, c, t)\n";
+		for (int i = 0; i < numStatements; ++i)
+			src << statements[i % numKinds];
+		src << "end\n";
+		return src.str();
+	}
+}
+
+// decompiles a single function with a large stream of instructions
+int benchDispatch(int argc, const char* argv[])
+{
+	int numStatements = argc > 0 ? std::atoi(argv[0]) : 100000;
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 5;
+	const std::string path = "bench_dispatch.luac";
+
+	if (!compileChunk(generateSource(numStatements), path))
+	{
+		std::cerr << "could not compile the benchmark chunk\n";
+		return 1;
+	}
+
+	Decompiler decompiler;
+	bool ok = timeDecompile(decompiler, path, iterations, "dispatch", "statements_" + std::to_string(numStatements));
+
+	std::remove(path.c_str());
+	return ok ? 0 : 1;
+}
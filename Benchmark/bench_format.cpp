@@ -0,0 +1,93 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "decompiler.h"
+
+namespace
+{
+	// statements, tables and blocks, everything the layout has to handle
+	std::string generateSource(int numFunctions)
+	{
+		std::ostringstream src;
+		for (int f = 0; f < numFunctions; ++f)
+		{
+			src << "function f" << f << "(a, b)\n";
+			src << "local t = { 1, 2, \"x\", " << f << "; k = a, [2] = b, s = \"str\" }\n";
+			src << "for i = 1, 10 do print(i, t[i]) end\n";
+			src << "for k, v in t do print(k, v) end\n";
+			src << "if a == b then print(\"eq\", a) end\n";
+			src << "g" << f << " = { { 1, 2 }, { a, b } }\n";
+			src << "return a * b + " << f << "\nend\n";
+		}
+		return src.str();
+	}
+
+	double timeDecompile(const std::vector<std::string> &paths, bool reformat, int iterations)
+	{
+		Decompiler decompiler;
+		decompiler.setReformat(reformat);
+
+		Stopwatch watch;
+		for (int i = 0; i < iterations; ++i)
+		{
+			for (const std::string &path : paths)
+				decompiler.decompileChunk(path);
+		}
+		return watch.seconds();
+	}
+}
+
+// decompiles with the output laid out while writing and with the lexer pass,
+//  either a generated chunk or every file of a directory
+int benchFormat(int argc, const char* argv[])
+{
+	using namespace std::experimental;
+
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+	const std::string generatedPath = "bench_format.luac";
+	std::vector<std::string> paths;
+	size_t bytes = 0;
+
+	if (argc > 0)
+	{
+		for (filesystem::recursive_directory_iterator dir(argv[0]), end; dir != end; ++dir)
+		{
+			if (filesystem::is_regular_file(dir->path()))
+			{
+				paths.push_back(dir->path().string());
+				bytes += fileSize(paths.back());
+			}
+		}
+	}
+	else
+	{
+		if (!compileChunk(generateSource(200), generatedPath))
+		{
+			std::cerr << "could not compile the benchmark chunk\n";
+			return 1;
+		}
+		paths.push_back(generatedPath);
+		bytes = fileSize(generatedPath);
+	}
+
+	if (paths.empty())
+	{
+		std::cerr << "no files to decompile\n";
+		return 1;
+	}
+
+	double layout = timeDecompile(paths, false, iterations);
+	double reformat = timeDecompile(paths, true, iterations);
+	printResult("format", "layout", bytes, iterations, layout);
+	printResult("format", "reformat", bytes, iterations, reformat);
+
+	std::cerr << "per file: layout " << layout * 1e6 / (paths.size() * iterations)
+		<< " us, reformat " << reformat * 1e6 / (paths.size() * iterations) << " us\n";
+
+	std::remove(generatedPath.c_str());
+	return 0;
+}
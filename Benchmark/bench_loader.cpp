@@ -0,0 +1,122 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+extern "C"
+{
+#include "luac.h"
+}
+#undef L
+
+namespace
+{
+	// many functions full of arithmetic on number and string constants,
+	//  so code, knum and kstr make up most of the chunk
+	std::string generateSource(int numFunctions, int numStatements)
+	{
+		std::ostringstream src;
+		for (int f = 0; f < numFunctions; ++f)
+		{
+			src << "function f" << f << "(a, b)\n";
+			src << "local t = {}\n";
+			for (int i = 0; i < numStatements; ++i)
+			{
+				src << "t[" << i << "] = a * " << f << "." << i << "25 + b / " << i << ".5 - "
+					<< (f * numStatements + i) << ".75\n";
+				src << "t.s" << i << " = \"str_" << f << "_" << i << "\"\n";
+			}
+			src << "return t\nend\n";
+		}
+		return src.str();
+	}
+
+	double timeLoads(Proto* (*load)(Loader*, const char*), const std::string &path, int iterations)
+	{
+		Loader* loader = newloader();
+
+		// warm the page cache and the loader's string table
+		load(loader, path.c_str());
+
+		Stopwatch watch;
+		for (int i = 0; i < iterations; ++i)
+		{
+			if (load(loader, path.c_str()) == NULL)
+			{
+				std::cerr << "failed to load " << path << '\n';
+				break;
+			}
+		}
+		double seconds = watch.seconds();
+
+		freeloader(loader);
+		return seconds;
+	}
+
+	// the whole chunk held in memory against indexing it and loading a
+	//  single function, the way a viewer opening one function would
+	double timeIndexed(const std::string &image, bool wholeChunk, int iterations)
+	{
+		Loader* loader = newloader();
+		std::vector<FuncSpan> spans(64);
+
+		Stopwatch watch;
+		for (int i = 0; i < iterations; ++i)
+		{
+			Proto* tf;
+			if (wholeChunk)
+				tf = loadprotobuffer(loader, image.data(), image.size(), "bench");
+			else
+			{
+				int numSpans = indexproto(image.data(), image.size(), spans.data(), static_cast<int>(spans.size()));
+				if (numSpans > static_cast<int>(spans.size()))
+				{
+					spans.resize(numSpans);
+					numSpans = indexproto(image.data(), image.size(), spans.data(), numSpans);
+				}
+				tf = numSpans > 0 ? loadprotospan(loader, image.data(), image.size(), &spans[numSpans / 2], "bench") : NULL;
+			}
+			if (tf == NULL)
+			{
+				std::cerr << "failed to load the chunk\n";
+				break;
+			}
+		}
+		double seconds = watch.seconds();
+
+		freeloader(loader);
+		return seconds;
+	}
+}
+
+// compares the memory mapped in-place loader against the FILE/ZIO stream loader,
+//  and loading a whole chunk against indexing it and loading one function
+int benchLoader(int argc, const char* argv[])
+{
+	int numFunctions = argc > 0 ? std::atoi(argv[0]) : 100;
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+	const std::string path = "bench_loader.luac";
+
+	if (!compileChunk(generateSource(numFunctions, 500), path))
+	{
+		std::cerr << "could not compile the benchmark chunk\n";
+		return 1;
+	}
+
+	size_t bytes = fileSize(path);
+	printResult("loader", "stream", bytes, iterations, timeLoads(loadprotostream, path, iterations));
+	printResult("loader", "mapped", bytes, iterations, timeLoads(loadproto, path, iterations));
+
+	std::ifstream file(path, std::ios::binary);
+	std::ostringstream image;
+	image << file.rdbuf();
+	file.close();
+	printResult("loader", "buffer", bytes, iterations, timeIndexed(image.str(), true, iterations));
+	printResult("loader", "indexed", bytes, iterations, timeIndexed(image.str(), false, iterations));
+
+	std::remove(path.c_str());
+	return 0;
+}
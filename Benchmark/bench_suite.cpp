@@ -0,0 +1,105 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "decompiler.h"
+#include "generator.h"
+
+extern "C"
+{
+#include "luac.h"
+}
+#undef L
+
+namespace
+{
+	double timeLoads(const std::string &path, int iterations)
+	{
+		Loader* loader = newloader();
+		loadproto(loader, path.c_str());
+
+		Stopwatch watch;
+		for (int i = 0; i < iterations; ++i)
+			loadproto(loader, path.c_str());
+		double seconds = watch.seconds();
+
+		freeloader(loader);
+		return seconds;
+	}
+
+	// the phases as timed by the decompiler itself, summed over the iterations
+	bool timePhases(const std::string &path, bool reformat, bool verify, int iterations, FileStats &total)
+	{
+		Decompiler decompiler;
+		decompiler.setReformat(reformat);
+		decompiler.setVerify(verify);
+		decompiler.setStats(true);
+		if (!checkDecompile(decompiler, path))
+			return false;
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			decompiler.decompileChunk(path);
+			const FileStats &stats = decompiler.chunkStats();
+			for (int phase = 0; phase < FileStats::NUM_PHASES; ++phase)
+				total.wallSeconds[phase] += stats.wallSeconds[phase];
+		}
+		return true;
+	}
+
+	bool runShape(SourceShape shape, int size, int iterations)
+	{
+		const std::string path = "bench_suite.luac";
+		const std::string variant = std::string(shapeName(shape)) + "_" + std::to_string(size);
+
+		if (!compileChunk(generateShape(shape, size), path))
+		{
+			std::cerr << "could not compile " << variant << '\n';
+			return false;
+		}
+		size_t bytes = fileSize(path);
+
+		FileStats layout;
+		FileStats reformat;
+		FileStats verify;
+		if (!timePhases(path, false, false, iterations, layout) || !timePhases(path, true, false, iterations, reformat)
+			|| !timePhases(path, false, true, iterations, verify))
+		{
+			std::cerr << "not timing " << variant << ", it does not decompile cleanly\n";
+			std::remove(path.c_str());
+			return false;
+		}
+
+		printResult("suite", variant + "_load", bytes, iterations, timeLoads(path, iterations));
+		printResult("suite", variant + "_decompile", bytes, iterations, layout.wallSeconds[FileStats::DECOMPILE]);
+		printResult("suite", variant + "_write", bytes, iterations, layout.wallSeconds[FileStats::WRITE]);
+		printResult("suite", variant + "_format", bytes, iterations, reformat.wallSeconds[FileStats::FORMAT]);
+		printResult("suite", variant + "_verify", bytes, iterations, verify.wallSeconds[FileStats::VERIFY]);
+
+		std::remove(path.c_str());
+		return true;
+	}
+}
+
+// every generated shape at three sizes, with loading, decompiling, writing
+//  the source, the lexer based formatter and verifying timed apart.
+// write is the layout done while writing, format the --reformat pass
+//  and verify compiling the source back for --verify
+int benchSuite(int argc, const char* argv[])
+{
+	int scale = argc > 0 ? std::atoi(argv[0]) : 1000;
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 3;
+	if (scale <= 0)
+	{
+		std::cerr << "the scale has to be positive\n";
+		return 1;
+	}
+
+	bool ok = true;
+	for (int shape = 0; shape < NUM_SHAPES; ++shape)
+	{
+		for (int size = scale; size <= 16 * scale; size *= 4)
+			ok = runShape(static_cast<SourceShape>(shape), size, iterations) && ok;
+	}
+	return ok ? 0 : 1;
+}
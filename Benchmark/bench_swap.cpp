@@ -0,0 +1,174 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+extern "C"
+{
+#include "luac.h"
+}
+#undef L
+
+namespace
+{
+	// writes a chunk in the opposite byte order, mirroring luac/dump.c
+	class SwappedDumper
+	{
+	public:
+		explicit SwappedDumper(FILE* file)
+			: m_file(file)
+		{}
+
+		void dumpChunk(const Proto* tf)
+		{
+			std::fputc(ID_CHUNK, m_file);
+			std::fputs(SIGNATURE, m_file);
+			std::fputc(VERSION, m_file);
+			std::fputc(!luaU_endianess(), m_file);
+			std::fputc(sizeof(int), m_file);
+			std::fputc(sizeof(size_t), m_file);
+			std::fputc(sizeof(Instruction), m_file);
+			std::fputc(SIZE_INSTRUCTION, m_file);
+			std::fputc(SIZE_OP, m_file);
+			std::fputc(SIZE_B, m_file);
+			std::fputc(sizeof(Number), m_file);
+			dumpValue((Number)TEST_NUMBER);
+			dumpFunction(tf);
+		}
+
+	private:
+		template <typename T>
+		void dumpValue(T value)
+		{
+			char* bytes = reinterpret_cast<char*>(&value);
+			std::reverse(bytes, bytes + sizeof(value));
+			std::fwrite(bytes, sizeof(value), 1, m_file);
+		}
+
+		template <typename T>
+		void dumpVector(const T* values, int n)
+		{
+			for (int i = 0; i < n; ++i)
+				dumpValue(values[i]);
+		}
+
+		void dumpString(const TString* s)
+		{
+			if (s == NULL)
+			{
+				dumpValue((size_t)0);
+				return;
+			}
+
+			dumpValue((size_t)(s->len + 1));
+			std::fwrite(s->str, s->len + 1, 1, m_file);
+		}
+
+		void dumpFunction(const Proto* tf)
+		{
+			dumpString(tf->source);
+			dumpValue((int)tf->lineDefined);
+			dumpValue((int)tf->numparams);
+			std::fputc(tf->is_vararg, m_file);
+			dumpValue((int)tf->maxstacksize);
+
+			dumpValue(tf->nlocvars);
+			for (int i = 0; i < tf->nlocvars; ++i)
+			{
+				dumpString(tf->locvars[i].varname);
+				dumpValue(tf->locvars[i].startpc);
+				dumpValue(tf->locvars[i].endpc);
+			}
+
+			dumpValue(tf->nlineinfo);
+			dumpVector(tf->lineinfo, tf->nlineinfo);
+
+			dumpValue(tf->nkstr);
+			for (int i = 0; i < tf->nkstr; ++i)
+				dumpString(tf->kstr[i]);
+			dumpValue(tf->nknum);
+			dumpVector(tf->knum, tf->nknum);
+			dumpValue(tf->nkproto);
+			for (int i = 0; i < tf->nkproto; ++i)
+				dumpFunction(tf->kproto[i]);
+
+			dumpValue(tf->ncode);
+			dumpVector(tf->code, tf->ncode);
+		}
+
+		FILE* m_file;
+	};
+
+	// mostly code and number constants, the parts that need swapping in bulk
+	std::string generateSource(int numFunctions, int numStatements)
+	{
+		std::ostringstream src;
+		for (int f = 0; f < numFunctions; ++f)
+		{
+			src << "function f" << f << "(a, b)\n";
+			src << "local x = 0\n";
+			for (int i = 0; i < numStatements; ++i)
+				src << "x = x * " << f << "." << i << "5 + a / " << i << ".25 - b\n";
+			src << "return x\nend\n";
+		}
+		return src.str();
+	}
+
+	double timeLoads(Proto* (*load)(Loader*, const char*), const std::string &path, int iterations)
+	{
+		Loader* loader = newloader();
+		load(loader, path.c_str());
+
+		Stopwatch watch;
+		for (int i = 0; i < iterations; ++i)
+		{
+			if (load(loader, path.c_str()) == NULL)
+			{
+				std::cerr << "failed to load " << path << '\n';
+				break;
+			}
+		}
+		double seconds = watch.seconds();
+
+		freeloader(loader);
+		return seconds;
+	}
+}
+
+// loads the same chunk written in native and in swapped byte order
+int benchSwap(int argc, const char* argv[])
+{
+	int numFunctions = argc > 0 ? std::atoi(argv[0]) : 100;
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+	const std::string nativePath = "bench_swap_native.luac";
+	const std::string swappedPath = "bench_swap_swapped.luac";
+
+	if (!compileChunk(generateSource(numFunctions, 1000), nativePath))
+	{
+		std::cerr << "could not compile the benchmark chunk\n";
+		return 1;
+	}
+
+	Loader* loader = newloader();
+	FILE* file = std::fopen(swappedPath.c_str(), "wb");
+	Proto* tf = loadproto(loader, nativePath.c_str());
+	if (file == NULL || tf == NULL)
+	{
+		std::cerr << "could not write the swapped chunk\n";
+		return 1;
+	}
+	SwappedDumper(file).dumpChunk(tf);
+	std::fclose(file);
+	freeloader(loader);
+
+	size_t bytes = fileSize(nativePath);
+	printResult("swap", "native_stream", bytes, iterations, timeLoads(loadprotostream, nativePath, iterations));
+	printResult("swap", "swapped_stream", bytes, iterations, timeLoads(loadprotostream, swappedPath, iterations));
+	printResult("swap", "swapped_mapped", bytes, iterations, timeLoads(loadproto, swappedPath, iterations));
+
+	std::remove(nativePath.c_str());
+	std::remove(swappedPath.c_str());
+	return 0;
+}
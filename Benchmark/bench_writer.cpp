@@ -0,0 +1,82 @@
+#include "benchmark.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "outputwriter.h"
+
+namespace
+{
+	const char* const outputRoot = "bench_writer_out";
+
+	// files spread over a few directories, like a decompiled tree
+	std::string outputPath(int index)
+	{
+		return std::string(outputRoot) + "/dir" + std::to_string(index % 16) + "/file" + std::to_string(index) + ".lua";
+	}
+
+	// what saveFile used to do for every file
+	void writeStreams(int numFiles, const std::string &contents)
+	{
+		using namespace std::experimental;
+
+		for (int i = 0; i < numFiles; ++i)
+		{
+			filesystem::path path(outputPath(i));
+			if (!filesystem::exists(path.parent_path()))
+				filesystem::create_directories(path.parent_path());
+
+			std::ofstream file;
+			file.open(path.string(), std::ios::trunc);
+			file << contents;
+		}
+	}
+
+	void writeBuffers(int numFiles, const std::string &contents, bool threaded)
+	{
+		OutputWriter writer(threaded);
+		for (int i = 0; i < numFiles; ++i)
+			writer.write(outputPath(i), contents);
+		writer.flush();
+	}
+}
+
+// writes many small files through the old streams and the output writer
+int benchWriter(int argc, const char* argv[])
+{
+	using namespace std::experimental;
+
+	int numFiles = argc > 0 ? std::atoi(argv[0]) : 2000;
+	int fileSize = argc > 1 ? std::atoi(argv[1]) : 16 * 1024;
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 3;
+
+	std::string contents;
+	while (static_cast<int>(contents.size()) < fileSize)
+		contents += "\tif a < b then c = a + b * 2 end\n";
+	contents.resize(fileSize);
+
+	const size_t bytes = static_cast<size_t>(numFiles) * contents.size();
+	const std::string size = std::to_string(numFiles) + "x" + std::to_string(fileSize);
+
+	for (int variant = 0; variant < 3; ++variant)
+	{
+		double seconds = 0;
+		for (int i = 0; i < iterations; ++i)
+		{
+			filesystem::remove_all(outputRoot);
+
+			Stopwatch watch;
+			if (variant == 0)
+				writeStreams(numFiles, contents);
+			else
+				writeBuffers(numFiles, contents, variant == 2);
+			seconds += watch.seconds();
+		}
+
+		static const char* const names[] = { "ofstream_", "buffered_", "threaded_" };
+		printResult("writer", names[variant] + size, bytes, iterations, seconds);
+	}
+
+	filesystem::remove_all(outputRoot);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <iostream>
+
+extern "C"
+{
+#include "lparser.h"
+#include "lstate.h"
+#include "lzio.h"
+#include "luac.h"
+}
+#undef L
+// after the lua headers, it includes some of them without C linkage
+#include "decompiler.h"
+
+Stopwatch::Stopwatch()
+	: m_start(std::chrono::steady_clock::now())
+{}
+
+void Stopwatch::restart()
+{
+	m_start = std::chrono::steady_clock::now();
+}
+
+double Stopwatch::seconds() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+bool compileChunk(const std::string &source, const std::string &path)
+{
+	// a fresh state per chunk, the compiler's strings and protos are simply dropped
+	lua_State* state = lua_open(0);
+	if (state == NULL)
+		return false;
+
+	ZIO z;
+	zmopen(&z, source.data(), source.size(), "=(benchmark)");
+	Proto* tf = luaY_parser(state, &z);
+	if (tf == NULL)
+		return false;
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	luaU_dumpchunk(tf, file);
+	std::fclose(file);
+	return true;
+}
+
+size_t fileSize(const std::string &path)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return 0;
+
+	std::fseek(file, 0, SEEK_END);
+	long size = std::ftell(file);
+	std::fclose(file);
+	return size < 0 ? 0 : size;
+}
+
+bool checkDecompile(Decompiler &decompiler, const std::string &path)
+{
+	if (!decompiler.decompileChunk(path).empty() && decompiler.chunkSucceeded())
+		return true;
+
+	std::cerr << "failed to decompile " << path << '\n' << decompiler.chunkMessages();
+	return false;
+}
+
+bool timeDecompile(Decompiler &decompiler, const std::string &path, int iterations,
+	const std::string &benchmark, const std::string &variant)
+{
+	if (!checkDecompile(decompiler, path))
+		return false;
+
+	Stopwatch watch;
+	for (int i = 0; i < iterations; ++i)
+		decompiler.decompileChunk(path);
+	double seconds = watch.seconds();
+
+	printResult(benchmark, variant, fileSize(path), iterations, seconds);
+	return true;
+}
+
+void printResultHeader()
+{
+	std::cout << "benchmark,variant,bytes,iterations,seconds,mb_per_s\n";
+}
+
+void printResult(const std::string &benchmark, const std::string &variant,
+	size_t bytes, int iterations, double seconds)
+{
+	double megabytes = (double)bytes * iterations / (1024.0 * 1024.0);
+	std::cout << benchmark << ',' << variant << ',' << bytes << ',' << iterations << ','
+		<< seconds << ',' << (seconds > 0 ? megabytes / seconds : 0.0) << '\n';
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <chrono>
+#include <string>
+
+// helpers shared by the benchmarks
+// results are printed as csv rows, so runs can be compared across versions
+
+class Stopwatch
+{
+public:
+	Stopwatch();
+
+	void restart();
+	double seconds() const;
+
+private:
+	std::chrono::steady_clock::time_point m_start;
+};
+
+// compile lua source in-process with LuaLib's parser and
+//  write the binary chunk to path, returns false on failure
+bool compileChunk(const std::string &source, const std::string &path);
+
+size_t fileSize(const std::string &path);
+
+class Decompiler;
+
+// decompiles path once, false if that gave no source or the decompiler
+//  reported errors, a failed verify included. timing a chunk the
+//  decompiler gets wrong would only time how fast it gives up
+bool checkDecompile(Decompiler &decompiler, const std::string &path);
+
+// checkDecompile, then times decompiling path iterations times and
+//  prints the result row
+bool timeDecompile(Decompiler &decompiler, const std::string &path, int iterations,
+	const std::string &benchmark, const std::string &variant);
+
+void printResultHeader();
+
+// bytes is the amount of input processed by a single iteration
+void printResult(const std::string &benchmark, const std::string &variant,
+	size_t bytes, int iterations, double seconds);
@@ -0,0 +1,159 @@
+#include "generator.h"
+#include <sstream>
+
+extern "C"
+{
+#include "llimits.h"
+}
+
+namespace
+{
+	const char* const shapeNames[NUM_SHAPES] = { "nesting", "tables", "concat", "closures" };
+
+	// the parser gives up on deeper blocks, longer expressions or larger constructors
+	const int MAX_DEPTH = 32;
+	const int CHAIN_LENGTH = 100;
+	// the decompiler only rebuilds constructors whose list part is stored by
+	//  a single SETLIST, a longer list is flushed in groups counted in A
+	const int MAX_LIST_ITEMS = LFIELDS_PER_FLUSH;
+	const int MAX_FIELDS = 4 * MAX_LIST_ITEMS;
+	const int STATEMENTS_PER_FUNCTION = 500;
+
+	void generateNesting(std::ostringstream &src, int numBlocks)
+	{
+		int numFunctions = 0;
+		for (int done = 0; done < numBlocks; ++numFunctions)
+		{
+			src << "function n" << numFunctions << "(a, b, t)\n";
+			for (int statements = 0; statements < STATEMENTS_PER_FUNCTION && done < numBlocks; )
+			{
+				int depth = numBlocks - done < MAX_DEPTH ? numBlocks - done : MAX_DEPTH;
+				for (int i = 0; i < depth; ++i)
+				{
+					switch (i % 4)
+					{
+					case 0: src << "if a < " << i << " then\n"; break;
+					case 1: src << "while t[" << i << "] do\n"; break;
+					case 2: src << "for i" << i << " = 1, b do\n"; break;
+					case 3: src << "repeat\n"; break;
+					}
+				}
+				src << "print(a, b)\n";
+				for (int i = depth - 1; i >= 0; --i)
+				{
+					if (i % 4 == 3)
+						src << "until a == " << i << "\n";
+					else
+						src << "end\n";
+				}
+				done += depth;
+				statements += 2 * depth + 1;
+			}
+			src << "end\n";
+		}
+	}
+
+	void generateTable(std::ostringstream &src, int index, int numFields)
+	{
+		src << "t" << index << " = {\n";
+		int numItems = numFields / 2 < MAX_LIST_ITEMS ? numFields / 2 : MAX_LIST_ITEMS;
+		for (int i = 0; i < numItems; ++i)
+		{
+			if (i % 8 == 7)
+				src << "{ " << i << ", \"s" << i << "\", { x = " << i << " } },\n";
+			else if (i % 2 == 0)
+				src << i << ",\n";
+			else
+				src << "\"s" << i << "\",\n";
+		}
+		src << ";\n";
+		for (int i = numItems; i < numFields; ++i)
+		{
+			if (i % 3 == 0)
+				src << "k" << i << " = " << i << ",\n";
+			else if (i % 3 == 1)
+				src << "[\"key" << i << "\"] = { " << i << "; k = \"v\" },\n";
+			else
+				src << "[" << i << "] = g" << i << ",\n";
+		}
+		src << "}\n";
+	}
+
+	void generateTables(std::ostringstream &src, int numFields)
+	{
+		for (int index = 0; numFields > 0; ++index)
+		{
+			int fields = numFields < MAX_FIELDS ? numFields : MAX_FIELDS;
+			generateTable(src, index, fields);
+			numFields -= fields;
+		}
+	}
+
+	void generateConcat(std::ostringstream &src, int numOperands)
+	{
+		int numFunctions = 0;
+		for (int done = 0; done < numOperands; ++numFunctions)
+		{
+			src << "function c" << numFunctions << "(a, b)\n";
+			for (int statements = 0; statements < STATEMENTS_PER_FUNCTION / 10 && done < numOperands; ++statements)
+			{
+				int length = numOperands - done < CHAIN_LENGTH ? numOperands - done : CHAIN_LENGTH;
+				src << "s" << statements << " = a";
+				for (int i = 1; i < length; ++i)
+				{
+					if (i % 2 == 0)
+						src << " .. b";
+					else
+						src << " .. \"x" << i << "\"";
+				}
+				src << "\n";
+				done += length;
+			}
+			src << "end\n";
+		}
+	}
+
+	// a closure kept in a local is not recovered yet, they go into a table
+	void generateClosures(std::ostringstream &src, int numClosures)
+	{
+		for (int i = 0; i < numClosures; i += 2)
+		{
+			src << "function f" << i << "(a, b, t)\n";
+			src << "t.g = function(x) return x * %a + %b end\n";
+			src << "return function(y) return %t.g(y) .. %a end\n";
+			src << "end\n";
+		}
+	}
+}
+
+const char* shapeName(SourceShape shape)
+{
+	return shapeNames[shape];
+}
+
+std::string generateShape(SourceShape shape, int size)
+{
+	std::ostringstream src;
+	switch (shape)
+	{
+	case NESTING:
+		generateNesting(src, size);
+		break;
+
+	case TABLES:
+		generateTables(src, size);
+		break;
+
+	case CONCAT:
+		generateConcat(src, size);
+		break;
+
+	case CLOSURES:
+		generateClosures(src, size);
+		break;
+
+	case NUM_SHAPES:
+		break;
+	}
+	return src.str();
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+// synthetic lua 4.0 sources stressing one part of the decompiler each,
+//  compiled in-process with compileChunk.
+// size is the number of blocks, table fields, concat operands or closures
+enum SourceShape
+{
+	NESTING,	// ifs, loops and repeats nested 32 deep
+	TABLES,		// many constructors with lists, maps and nested tables
+	CONCAT,		// chains of 100 operands, as long as the compiler's stack allows
+	CLOSURES,	// functions returning closures over upvalues
+	NUM_SHAPES
+};
+
+const char* shapeName(SourceShape shape);
+
+std::string generateShape(SourceShape shape, int size);
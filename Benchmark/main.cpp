@@ -0,0 +1,57 @@
+#include "benchmark.h"
+#include <cstring>
+#include <iostream>
+
+int benchClosures(int argc, const char* argv[]);
+int benchConditions(int argc, const char* argv[]);
+int benchDispatch(int argc, const char* argv[]);
+int benchFormat(int argc, const char* argv[]);
+int benchLoader(int argc, const char* argv[]);
+int benchSuite(int argc, const char* argv[]);
+int benchSwap(int argc, const char* argv[]);
+int benchWriter(int argc, const char* argv[]);
+
+namespace
+{
+	struct Benchmark
+	{
+		const char* name;
+		const char* args;
+		int (*run)(int argc, const char* argv[]);
+	};
+
+	const Benchmark benchmarks[] =
+	{
+		{ "loader", "[functions] [iterations]", benchLoader },
+		{ "conditions", "[conditions] [depth] [iterations]", benchConditions },
+		{ "format", "[directory] [iterations]", benchFormat },
+		{ "dispatch", "[statements] [iterations]", benchDispatch },
+		{ "swap", "[functions] [iterations]", benchSwap },
+		{ "closures", "[functions] [iterations]", benchClosures },
+		{ "writer", "[files] [size] [iterations]", benchWriter },
+		{ "suite", "[scale] [iterations]", benchSuite },
+	};
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: Benchmark name [args]\n";
+		for (const Benchmark &bench : benchmarks)
+			std::cout << "  " << bench.name << ' ' << bench.args << '\n';
+		return 1;
+	}
+
+	for (const Benchmark &bench : benchmarks)
+	{
+		if (std::strcmp(argv[1], bench.name) == 0)
+		{
+			printResultHeader();
+			return bench.run(argc - 2, argv + 2);
+		}
+	}
+
+	std::cerr << "Unknown benchmark " << argv[1] << '\n';
+	return 1;
+}
@@ -0,0 +1,82 @@
+#include "luadecompiler.h"
+#include <memory>
+#include <sstream>
+#include "decompiler.h"
+
+namespace
+{
+	Decompiler& threadDecompiler()
+	{
+		thread_local std::unique_ptr<Decompiler> decompiler(new Decompiler());
+		return *decompiler;
+	}
+
+	std::vector<std::string> splitLines(const std::string &messages)
+	{
+		std::vector<std::string> lines;
+		std::istringstream stream(messages);
+		std::string line;
+		while (std::getline(stream, line))
+		{
+			if (!line.empty())
+				lines.push_back(line);
+		}
+		return lines;
+	}
+
+	void configure(Decompiler &decompiler, const DecompileOptions &options)
+	{
+		decompiler.setReformat(options.reformat);
+		decompiler.setVerify(options.verify);
+		decompiler.setStats(options.timings);
+		decompiler.setJobs(options.jobs);
+	}
+
+	DecompileResult takeResult(Decompiler &decompiler, std::string text)
+	{
+		DecompileResult result;
+		result.text = std::move(text);
+		result.success = decompiler.chunkSucceeded();
+		result.diagnostics = splitLines(decompiler.chunkMessages());
+
+		const FileStats &stats = decompiler.chunkStats();
+		result.timings.load = stats.wallSeconds[FileStats::LOAD];
+		result.timings.decompile = stats.wallSeconds[FileStats::DECOMPILE];
+		result.timings.write = stats.wallSeconds[FileStats::WRITE];
+		result.timings.format = stats.wallSeconds[FileStats::FORMAT];
+		result.timings.verify = stats.wallSeconds[FileStats::VERIFY];
+		return result;
+	}
+}
+
+DecompileOptions::DecompileOptions()
+	: chunkName("chunk"), reformat(false), verify(false), timings(false), jobs(1)
+{}
+
+DecompileResult decompile(const uint8_t* data, size_t len, const DecompileOptions &options)
+{
+	Decompiler &decompiler = threadDecompiler();
+	configure(decompiler, options);
+	return takeResult(decompiler, decompiler.decompileBuffer(reinterpret_cast<const char*>(data), len, options.chunkName));
+}
+
+std::vector<FunctionInfo> listFunctions(const uint8_t* data, size_t len)
+{
+	std::vector<FunctionInfo> functions;
+	for (const FuncSpan &span : Decompiler::indexChunk(reinterpret_cast<const char*>(data), len))
+		functions.push_back({ span.offset, span.size, span.parent, span.lineDefined });
+	return functions;
+}
+
+DecompileResult decompileFunction(const uint8_t* data, size_t len, const FunctionInfo &function, const DecompileOptions &options)
+{
+	Decompiler &decompiler = threadDecompiler();
+	configure(decompiler, options);
+
+	FuncSpan span;
+	span.offset = function.offset;
+	span.size = function.size;
+	span.parent = function.parent;
+	span.lineDefined = function.lineDefined;
+	return takeResult(decompiler, decompiler.decompileSpan(reinterpret_cast<const char*>(data), len, span, options.chunkName));
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// decompiling compiled lua 4.0 chunks held in memory, for programs
+//  linking DecompilerLib instead of running the command line tool.
+// nothing is read from or written to disk
+
+struct DecompileOptions
+{
+	DecompileOptions();
+
+	// used in the messages in place of a file name
+	std::string chunkName;
+	// format with the lexer based formatter, like --reformat
+	bool reformat;
+	// compile the source back and compare it with the chunk, like --verify
+	bool verify;
+	// time the phases
+	bool timings;
+	// threads for the nested functions, 1 decompiles them on the
+	//  calling thread and 0 uses one per core
+	unsigned int jobs;
+};
+
+// seconds spent in each phase, all zero unless timings were asked for
+struct DecompileTimings
+{
+	double load;
+	double decompile;
+	double write;
+	double format;
+	double verify;
+};
+
+struct DecompileResult
+{
+	// false if the data is not a compiled lua file, is truncated or damaged,
+	//  or it had errors. the text may still hold what could be decompiled
+	bool success;
+	std::string text;
+	// one line per message, the way the command line tool prints them
+	std::vector<std::string> diagnostics;
+	DecompileTimings timings;
+};
+
+// where a function is stored in a chunk, the functions nested in it are stored inside it
+struct FunctionInfo
+{
+	size_t offset;
+	size_t size;
+	// index of the enclosing function, -1 for the main function
+	int parent;
+	int lineDefined;
+};
+
+// decompiles the chunk in data, which only has to stay valid during the call.
+// every thread calling this keeps a decompiler of its own, so calls on
+//  different threads run side by side and later calls reuse its memory
+DecompileResult decompile(const uint8_t* data, size_t len, const DecompileOptions &options = DecompileOptions());
+
+// the functions of the chunk in data, main first and every function before
+//  the ones nested in it. only their sizes are read, the chunk is not loaded.
+// empty if data is not a compiled lua file or is damaged
+std::vector<FunctionInfo> listFunctions(const uint8_t* data, size_t len);
+
+// decompile for one of the functions listFunctions found and the ones nested
+//  in it, the rest of the chunk is not loaded. the upvalues of a nested
+//  function are named upvalue1, upvalue2 and so on, verify is ignored for it
+DecompileResult decompileFunction(const uint8_t* data, size_t len, const FunctionInfo &function,
+	const DecompileOptions &options = DecompileOptions());
@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <cstdint>
+#include <cstring>
+
+Arena::Arena(size_t blockSize)
+	: m_currentBlock(0), m_ptr(nullptr), m_end(nullptr), m_blockSize(blockSize), m_bytesAllocated(0), m_allocations(0)
+{}
+
+Arena::~Arena()
+{
+	for (Block& block : m_blocks)
+		delete[] block.data;
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+	uintptr_t ptr = reinterpret_cast<uintptr_t>(m_ptr);
+	size_t padding = (align - ptr % align) % align;
+
+	if (m_ptr == nullptr || size + padding > static_cast<size_t>(m_end - m_ptr))
+	{
+		nextBlock(size + align);
+		ptr = reinterpret_cast<uintptr_t>(m_ptr);
+		padding = (align - ptr % align) % align;
+	}
+
+	char* result = m_ptr + padding;
+	m_ptr = result + size;
+	m_bytesAllocated += size + padding;
+	++m_allocations;
+	return result;
+}
+
+const char* Arena::copyString(const char* str, size_t len)
+{
+	char* result = static_cast<char*>(allocate(len + 1, 1));
+	std::memcpy(result, str, len);
+	result[len] = '\0';
+	return result;
+}
+
+void Arena::reset()
+{
+	m_currentBlock = 0;
+	m_bytesAllocated = 0;
+	m_allocations = 0;
+	if (m_blocks.empty())
+	{
+		m_ptr = m_end = nullptr;
+	}
+	else
+	{
+		m_ptr = m_blocks[0].data;
+		m_end = m_ptr + m_blocks[0].size;
+	}
+}
+
+size_t Arena::bytesAllocated() const
+{
+	return m_bytesAllocated;
+}
+
+size_t Arena::allocations() const
+{
+	return m_allocations;
+}
+
+void Arena::nextBlock(size_t minSize)
+{
+	// reuse blocks left over from before the last reset
+	if (m_ptr != nullptr)
+		++m_currentBlock;
+
+	while (m_currentBlock < m_blocks.size() && m_blocks[m_currentBlock].size < minSize)
+		++m_currentBlock;
+
+	if (m_currentBlock == m_blocks.size())
+	{
+		Block block;
+		block.size = (minSize > m_blockSize) ? minSize : m_blockSize;
+		block.data = new char[block.size];
+		m_blocks.push_back(block);
+	}
+
+	m_ptr = m_blocks[m_currentBlock].data;
+	m_end = m_ptr + m_blocks[m_currentBlock].size;
+}
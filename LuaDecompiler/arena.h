@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// bump allocator for objects that all die at the same time
+// objects are never destroyed one by one, so only trivially
+//  destructible types are allowed. reset() rewinds the arena and
+//  keeps its blocks around for the next round
+class Arena
+{
+public:
+	explicit Arena(size_t blockSize = 64 * 1024);
+	~Arena();
+
+	// prevent copying
+	Arena(Arena const&) = delete;
+	void operator=(Arena const&) = delete;
+
+	void* allocate(size_t size, size_t align);
+
+	template <typename T>
+	T* make()
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+		return new (allocate(sizeof(T), alignof(T))) T();
+	}
+
+	template <typename T>
+	T* makeArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+		if (count == 0)
+			return nullptr;
+		return new (allocate(sizeof(T) * count, alignof(T))) T[count]();
+	}
+
+	// null terminated copy of str
+	const char* copyString(const char* str, size_t len);
+
+	void reset();
+
+	size_t bytesAllocated() const;
+	// since the last reset
+	size_t allocations() const;
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t size;
+	};
+
+	void nextBlock(size_t minSize);
+
+	std::vector<Block> m_blocks;
+	size_t m_currentBlock;
+	char* m_ptr;
+	char* m_end;
+	size_t m_blockSize;
+	size_t m_bytesAllocated;
+	size_t m_allocations;
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// bounded queue for many producers and consumers behind a mutex.
+// unlike BoundedQueue the waiting threads sleep on a condition variable
+//  and are woken by the push or pop they wait for, so it suits consumers
+//  that sit idle most of the time and want an item as soon as it comes
+template <typename T>
+class BlockingQueue
+{
+public:
+	explicit BlockingQueue(size_t capacity)
+		: m_capacity(capacity != 0 ? capacity : 1), m_closed(false)
+	{
+	}
+
+	// prevent copying
+	BlockingQueue(BlockingQueue const&) = delete;
+	void operator=(BlockingQueue const&) = delete;
+
+	// waits for room, false if the queue was closed meanwhile
+	bool push(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity || m_closed; });
+		if (m_closed)
+			return false;
+		m_items.push_back(std::move(value));
+		lock.unlock();
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// waits for a value, returns false once the queue is closed and drained
+	bool pop(T &value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+		if (m_items.empty())
+			return false;
+		value = std::move(m_items.front());
+		m_items.pop_front();
+		lock.unlock();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// no more pushes, the consumers stop once the rest is popped
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+private:
+	const size_t m_capacity;
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+	std::deque<T> m_items;
+	bool m_closed;
+};
@@ -0,0 +1,207 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// how full a queue was over its lifetime, to see which stage holds the others back
+struct QueueStats
+{
+	size_t capacity;
+	size_t maxDepth;
+	// sum of the depths seen by every push, divided by pushes for the average
+	size_t depthSum;
+	size_t pushes;
+	// times a push found the queue full or a pop found it empty
+	size_t fullWaits;
+	size_t emptyWaits;
+};
+
+// bounded lock-free queue for many producers and consumers.
+// every cell carries a sequence number telling whether it is free for
+//  the push of a given round or holds the value for the pop of it, so
+//  pushes and pops only contend on their own position counter.
+// push waits while the queue is full, which holds back the stage
+//  feeding it and keeps the number of items in flight bounded
+template <typename T>
+class BoundedQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit BoundedQueue(size_t capacity)
+		: m_mask(roundUp(capacity) - 1), m_cells(new Cell[m_mask + 1]),
+		m_pushPos(0), m_popPos(0), m_closed(false),
+		m_maxDepth(0), m_depthSum(0), m_pushes(0), m_fullWaits(0), m_emptyWaits(0)
+	{
+		for (size_t i = 0; i <= m_mask; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// prevent copying
+	BoundedQueue(BoundedQueue const&) = delete;
+	void operator=(BoundedQueue const&) = delete;
+
+	bool tryPush(T &value)
+	{
+		size_t pos = m_pushPos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = m_cells[pos & m_mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - pos);
+			if (diff == 0)
+			{
+				if (m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = std::move(value);
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					countPush();
+					return true;
+				}
+			}
+			// the cell still holds the value of the previous round
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_pushPos.load(std::memory_order_relaxed);
+		}
+	}
+
+	bool tryPop(T &value)
+	{
+		size_t pos = m_popPos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = m_cells[pos & m_mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+			if (diff == 0)
+			{
+				if (m_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = std::move(cell.value);
+					cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			// nothing pushed into the cell yet
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_popPos.load(std::memory_order_relaxed);
+		}
+	}
+
+	// waits for a free cell
+	void push(T value)
+	{
+		if (tryPush(value))
+			return;
+
+		m_fullWaits.fetch_add(1, std::memory_order_relaxed);
+		for (int spins = 0; !tryPush(value); )
+			backoff(spins);
+	}
+
+	// waits for a value, returns false once the queue is closed and drained
+	bool pop(T &value)
+	{
+		if (tryPop(value))
+			return true;
+
+		m_emptyWaits.fetch_add(1, std::memory_order_relaxed);
+		for (int spins = 0; ; )
+		{
+			// a push may land between the failed pop and reading the flag
+			bool closed = m_closed.load(std::memory_order_acquire);
+			if (tryPop(value))
+				return true;
+			if (closed)
+				return false;
+			backoff(spins);
+		}
+	}
+
+	// no more pushes, the consumers stop once the rest is popped
+	void close()
+	{
+		m_closed.store(true, std::memory_order_release);
+	}
+
+	size_t capacity() const
+	{
+		return m_mask + 1;
+	}
+
+	// only a snapshot while other threads are working on the queue
+	size_t depth() const
+	{
+		size_t pushPos = m_pushPos.load(std::memory_order_relaxed);
+		size_t popPos = m_popPos.load(std::memory_order_relaxed);
+		return pushPos > popPos ? pushPos - popPos : 0;
+	}
+
+	QueueStats stats() const
+	{
+		QueueStats stats;
+		stats.capacity = capacity();
+		stats.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+		stats.depthSum = m_depthSum.load(std::memory_order_relaxed);
+		stats.pushes = m_pushes.load(std::memory_order_relaxed);
+		stats.fullWaits = m_fullWaits.load(std::memory_order_relaxed);
+		stats.emptyWaits = m_emptyWaits.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	static size_t roundUp(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		return size;
+	}
+
+	// spin briefly, then give the core away, the stages are
+	//  waiting for whole files so the latency does not matter much
+	static void backoff(int &spins)
+	{
+		if (spins < 64)
+		{
+			++spins;
+			std::this_thread::yield();
+		}
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+
+	void countPush()
+	{
+		size_t current = depth();
+		size_t seen = m_maxDepth.load(std::memory_order_relaxed);
+		while (current > seen && !m_maxDepth.compare_exchange_weak(seen, current, std::memory_order_relaxed))
+			;
+		m_depthSum.fetch_add(current, std::memory_order_relaxed);
+		m_pushes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const size_t m_mask;
+	std::unique_ptr<Cell[]> m_cells;
+
+	std::atomic<size_t> m_pushPos;
+	std::atomic<size_t> m_popPos;
+	std::atomic<bool> m_closed;
+
+	std::atomic<size_t> m_maxDepth;
+	std::atomic<size_t> m_depthSum;
+	std::atomic<size_t> m_pushes;
+	std::atomic<size_t> m_fullWaits;
+	std::atomic<size_t> m_emptyWaits;
+};
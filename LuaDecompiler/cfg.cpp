@@ -0,0 +1,328 @@
+#include "cfg.h"
+#include "lopcodes.h"
+
+void ControlFlowGraph::build(const Instruction* code, int numCode)
+{
+	findBlocks(code, numCode);
+	linkBlocks(code, numCode);
+
+	int exit = numBlocks();
+	computeDominators(0, m_succStart, m_succs, m_predStart, m_preds, m_dom);
+	// post-dominators are the dominators of the reversed graph, rooted at the exit
+	computeDominators(exit, m_predStart, m_preds, m_succStart, m_succs, m_postDom);
+
+	for (int i = 0; i < exit; ++i)
+	{
+		m_blocks[i].idom = m_dom.parent[i];
+		m_blocks[i].ipdom = m_postDom.parent[i];
+	}
+}
+
+int ControlFlowGraph::numBlocks() const
+{
+	return static_cast<int>(m_blocks.size());
+}
+
+const ControlFlowGraph::Block& ControlFlowGraph::block(int index) const
+{
+	return m_blocks[index];
+}
+
+int ControlFlowGraph::blockAt(int pc) const
+{
+	return m_blockAt[pc];
+}
+
+bool ControlFlowGraph::isReachable(int index) const
+{
+	return m_dom.enter[index] != -1;
+}
+
+bool ControlFlowGraph::dominates(int a, int b) const
+{
+	return m_dom.enter[a] != -1 && m_dom.enter[b] != -1
+		&& m_dom.enter[a] <= m_dom.enter[b] && m_dom.leave[b] <= m_dom.leave[a];
+}
+
+bool ControlFlowGraph::postDominates(int a, int b) const
+{
+	return m_postDom.enter[a] != -1 && m_postDom.enter[b] != -1
+		&& m_postDom.enter[a] <= m_postDom.enter[b] && m_postDom.leave[b] <= m_postDom.leave[a];
+}
+
+int ControlFlowGraph::jumpTarget(const Instruction* code, int numCode, int pc)
+{
+	Instruction instr = code[pc];
+	OpCode op = GET_OPCODE(instr);
+	int target = -1;
+
+	if (ISJUMP(op) || op == OP_FORPREP || op == OP_FORLOOP || op == OP_LFORPREP || op == OP_LFORLOOP)
+		target = pc + 1 + GETARG_S(instr);
+	else if (op == OP_PUSHNILJMP)
+		target = pc + 2;
+
+	// broken chunks may jump anywhere
+	if (target < 0 || target >= numCode)
+		return -1;
+	return target;
+}
+
+void ControlFlowGraph::findBlocks(const Instruction* code, int numCode)
+{
+	// a leader starts a block
+	std::vector<char> leader(numCode + 1, 0);
+	leader[0] = 1;
+
+	for (int pc = 0; pc < numCode; ++pc)
+	{
+		OpCode op = GET_OPCODE(code[pc]);
+		int target = jumpTarget(code, numCode, pc);
+		if (target >= 0)
+			leader[target] = 1;
+
+		if (target >= 0 || op == OP_JMP || op == OP_RETURN || op == OP_TAILCALL || op == OP_END)
+			leader[pc + 1] = 1;
+	}
+
+	m_blocks.clear();
+	m_blockAt.resize(numCode);
+	for (int pc = 0; pc < numCode; ++pc)
+	{
+		if (leader[pc])
+		{
+			Block block;
+			block.start = pc;
+			block.end = pc;
+			block.numSuccs = 0;
+			block.idom = -1;
+			block.ipdom = -1;
+			m_blocks.push_back(block);
+		}
+		m_blockAt[pc] = static_cast<int>(m_blocks.size()) - 1;
+		m_blocks.back().end = pc + 1;
+	}
+}
+
+void ControlFlowGraph::linkBlocks(const Instruction* code, int numCode)
+{
+	int exit = numBlocks();
+
+	for (Block &block : m_blocks)
+	{
+		int last = block.end - 1;
+		OpCode op = GET_OPCODE(code[last]);
+		int target = jumpTarget(code, numCode, last);
+		int next = (last + 1 < numCode) ? m_blockAt[last + 1] : exit;
+
+		block.numSuccs = 0;
+		if (op == OP_RETURN || op == OP_TAILCALL || op == OP_END)
+		{
+			block.succs[block.numSuccs++] = exit;
+		}
+		else if (op == OP_JMP || op == OP_PUSHNILJMP)
+		{
+			block.succs[block.numSuccs++] = (target >= 0) ? m_blockAt[target] : exit;
+		}
+		else
+		{
+			block.succs[block.numSuccs++] = next;
+			if (target >= 0 && m_blockAt[target] != next)
+				block.succs[block.numSuccs++] = m_blockAt[target];
+		}
+	}
+
+	buildLists();
+
+	// endless loops never reach the exit, the code behind them could not be
+	//  reached and nothing in them would have post-dominators.
+	//  their backward jumps are taken to fall through as if the loop could end
+	std::vector<char> reached(exit + 1, 0);
+	std::vector<int> stack(1, exit);
+	reached[exit] = 1;
+	while (!stack.empty())
+	{
+		int node = stack.back();
+		stack.pop_back();
+		for (int p = m_predStart[node]; p < m_predStart[node + 1]; ++p)
+		{
+			if (!reached[m_preds[p]])
+			{
+				reached[m_preds[p]] = 1;
+				stack.push_back(m_preds[p]);
+			}
+		}
+	}
+
+	bool linked = false;
+	for (int i = 0; i < exit; ++i)
+	{
+		Block &block = m_blocks[i];
+		if (!reached[i] && block.numSuccs == 1 && block.succs[0] <= i && GET_OPCODE(code[block.end - 1]) == OP_JMP)
+		{
+			block.succs[block.numSuccs++] = (block.end < numCode) ? m_blockAt[block.end] : exit;
+			linked = true;
+		}
+	}
+	if (linked)
+		buildLists();
+}
+
+void ControlFlowGraph::buildLists()
+{
+	int exit = numBlocks();
+
+	// adjacency lists, the exit is the last node and has no successors
+	m_succStart.assign(exit + 2, 0);
+	m_predStart.assign(exit + 2, 0);
+	for (int i = 0; i < exit; ++i)
+	{
+		m_succStart[i + 1] = m_blocks[i].numSuccs;
+		for (int s = 0; s < m_blocks[i].numSuccs; ++s)
+			++m_predStart[m_blocks[i].succs[s] + 1];
+	}
+	for (int i = 0; i <= exit; ++i)
+	{
+		m_succStart[i + 1] += m_succStart[i];
+		m_predStart[i + 1] += m_predStart[i];
+	}
+
+	m_succs.resize(m_succStart[exit + 1]);
+	m_preds.resize(m_predStart[exit + 1]);
+	std::vector<int> fill(m_predStart.begin(), m_predStart.end() - 1);
+	for (int i = 0; i < exit; ++i)
+	{
+		for (int s = 0; s < m_blocks[i].numSuccs; ++s)
+		{
+			m_succs[m_succStart[i] + s] = m_blocks[i].succs[s];
+			m_preds[fill[m_blocks[i].succs[s]]++] = i;
+		}
+	}
+}
+
+void ControlFlowGraph::computeDominators(int root, const std::vector<int> &succStart, const std::vector<int> &succs,
+	const std::vector<int> &predStart, const std::vector<int> &preds, Tree &tree)
+{
+	int numNodes = static_cast<int>(succStart.size()) - 1;
+
+	// postorder of the nodes reachable from the root
+	m_order.clear();
+	m_orderIndex.assign(numNodes, -1);
+	std::vector<char> visited(numNodes, 0);
+	std::vector<std::pair<int, int>> stack;
+	stack.push_back(std::make_pair(root, succStart[root]));
+	visited[root] = 1;
+	while (!stack.empty())
+	{
+		std::pair<int, int> &top = stack.back();
+		if (top.second < succStart[top.first + 1])
+		{
+			int next = succs[top.second++];
+			if (!visited[next])
+			{
+				visited[next] = 1;
+				stack.push_back(std::make_pair(next, succStart[next]));
+			}
+		}
+		else
+		{
+			m_orderIndex[top.first] = static_cast<int>(m_order.size());
+			m_order.push_back(top.first);
+			stack.pop_back();
+		}
+	}
+
+	std::vector<int> &parent = tree.parent;
+	parent.assign(numNodes, -1);
+	parent[root] = root;
+
+	// the root comes last in postorder, so the walk up
+	//  always moves the node with the lower number
+	auto intersect = [&](int a, int b)
+	{
+		while (a != b)
+		{
+			while (m_orderIndex[a] < m_orderIndex[b])
+				a = parent[a];
+			while (m_orderIndex[b] < m_orderIndex[a])
+				b = parent[b];
+		}
+		return a;
+	};
+
+	// structured code settles after two rounds
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int k = static_cast<int>(m_order.size()) - 1; k >= 0; --k)
+		{
+			int node = m_order[k];
+			if (node == root)
+				continue;
+
+			int idom = -1;
+			for (int p = predStart[node]; p < predStart[node + 1]; ++p)
+			{
+				int pred = preds[p];
+				if (parent[pred] == -1)
+					continue;
+				idom = (idom == -1) ? pred : intersect(pred, idom);
+			}
+
+			if (parent[node] != idom)
+			{
+				parent[node] = idom;
+				changed = true;
+			}
+		}
+	}
+
+	parent[root] = -1;
+	numberTree(root, tree);
+}
+
+void ControlFlowGraph::numberTree(int root, Tree &tree)
+{
+	int numNodes = static_cast<int>(tree.parent.size());
+
+	// children of every node, same layout as the adjacency lists
+	std::vector<int> childStart(numNodes + 1, 0);
+	for (int i = 0; i < numNodes; ++i)
+	{
+		if (tree.parent[i] != -1)
+			++childStart[tree.parent[i] + 1];
+	}
+	for (int i = 0; i < numNodes; ++i)
+		childStart[i + 1] += childStart[i];
+
+	std::vector<int> children(childStart[numNodes]);
+	std::vector<int> fill(childStart.begin(), childStart.end() - 1);
+	for (int i = 0; i < numNodes; ++i)
+	{
+		if (tree.parent[i] != -1)
+			children[fill[tree.parent[i]]++] = i;
+	}
+
+	tree.enter.assign(numNodes, -1);
+	tree.leave.assign(numNodes, -1);
+
+	int counter = 0;
+	std::vector<std::pair<int, int>> stack;
+	stack.push_back(std::make_pair(root, childStart[root]));
+	tree.enter[root] = counter++;
+	while (!stack.empty())
+	{
+		std::pair<int, int> &top = stack.back();
+		if (top.second < childStart[top.first + 1])
+		{
+			int child = children[top.second++];
+			tree.enter[child] = counter++;
+			stack.push_back(std::make_pair(child, childStart[child]));
+		}
+		else
+		{
+			tree.leave[top.first] = counter++;
+			stack.pop_back();
+		}
+	}
+}
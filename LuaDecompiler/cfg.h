@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include "llimits.h"
+
+// basic blocks of a single function along with its dominator and
+//  post-dominator trees.
+// blocks end after every instruction that jumps and start at every
+//  jump target. FORPREP/FORLOOP, LFORPREP/LFORLOOP and PUSHNILJMP jump too
+class ControlFlowGraph
+{
+public:
+	struct Block
+	{
+		// instructions [start, end)
+		int start;
+		int end;
+		// the backward jump of an endless loop also falls through
+		int succs[2];
+		int numSuccs;
+		// -1 for the entry and blocks that are never reached,
+		//  numBlocks() stands for the exit of the function
+		int idom;
+		int ipdom;
+	};
+
+	void build(const Instruction* code, int numCode);
+
+	int numBlocks() const;
+	const Block& block(int index) const;
+	int blockAt(int pc) const;
+
+	// the entry reaches the block
+	bool isReachable(int index) const;
+	// a dominates b, every path from the entry to b goes through a
+	bool dominates(int a, int b) const;
+	// a post-dominates b, every path from b to the exit goes through a
+	bool postDominates(int a, int b) const;
+
+	// destination of the instruction at pc, -1 if it does not jump
+	static int jumpTarget(const Instruction* code, int numCode, int pc);
+
+private:
+	struct Tree
+	{
+		std::vector<int> parent;
+		// preorder interval of every node, children are nested inside
+		std::vector<int> enter;
+		std::vector<int> leave;
+	};
+
+	void findBlocks(const Instruction* code, int numCode);
+	void linkBlocks(const Instruction* code, int numCode);
+	void buildLists();
+	// cooper, harvey and kennedy, walks the nodes in reverse postorder
+	//  until the immediate dominators settle.
+	// the graph is given as adjacency lists, numNodes - 1 is the exit
+	void computeDominators(int root, const std::vector<int> &succStart, const std::vector<int> &succs,
+		const std::vector<int> &predStart, const std::vector<int> &preds, Tree &tree);
+	static void numberTree(int root, Tree &tree);
+
+	std::vector<Block> m_blocks;
+	std::vector<int> m_blockAt;
+
+	// successors and predecessors of every block plus the exit,
+	//  node n owns [start[n], start[n + 1])
+	std::vector<int> m_succStart;
+	std::vector<int> m_succs;
+	std::vector<int> m_predStart;
+	std::vector<int> m_preds;
+
+	// scratch space reused for both trees
+	std::vector<int> m_order;
+	std::vector<int> m_orderIndex;
+
+	Tree m_dom;
+	Tree m_postDom;
+};
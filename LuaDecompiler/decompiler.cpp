@@ -1,21 +1,157 @@
 #include "decompiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <stack>
+#include <sstream>
+#include <map>
+#include <thread>
+#include "blockingqueue.h"
+#include "boundedqueue.h"
+#include "functionmemo.h"
 #include "lex.yy.h"
+#include "outputwriter.h"
+#include "resultcache.h"
+#include "socketserver.h"
+#include "threadpool.h"
+#include "verifier.h"
+#include "watcher.h"
+#include "ziparchive.h"
 #include "luac\luac.h"
 
-// function that loads binary lua scripts
-extern "C" Proto* loadproto(const char* filename);
+namespace
+{
+	// operators of conditions, the nodes are recognized by these pointers
+	const char EQ[] = " == ";
+	const char NE[] = " ~= ";
+	const char LT[] = " < ";
+	const char LE[] = " <= ";
+	const char GT[] = " > ";
+	const char GE[] = " >= ";
+	const char AND[] = " and ";
+	const char OR[] = " or ";
+	const char NOT[] = "not ";
+
+	// tested by JMPNE to JMPGE, in the order of lopcodes.h
+	const char* const compareOperators[] = { NE, EQ, LT, LE, GT, GE };
+
+	// closures with less code are decompiled in place, a task would cost more
+	const int MIN_CLOSURE_TASK = 256;
+
+	const uint64_t DEFAULT_CACHE_BYTES = 1024ULL * 1024 * 1024;
+	// the memo lives for the run in memory, once full it only serves what it has
+	const uint64_t MEMO_BYTES = 256ULL * 1024 * 1024;
+
+	// a save is taken once the folder was quiet for this long
+	const int WATCH_QUIET_MS = 10;
+
+	// the first byte of a --serve request tells what follows it
+	const char REQUEST_PATH = 'p';
+	const char REQUEST_CHUNK = 'c';
+	// and the first byte of the answer how it went
+	const char ANSWER_DECOMPILED = 0;
+	const char ANSWER_FAILED = 1;
+	const char ANSWER_BAD_REQUEST = 2;
+	// a client sending more is dropped
+	const size_t MAX_REQUEST_BYTES = 256 * 1024 * 1024;
+
+	// outcomes of a jump that leave the condition
+	Expr trueValue = { Expr::ATOM, false, false, false, { "1", 1 } };
+	Expr falseValue = { Expr::ATOM, false, false, false, { "nil", 3 } };
+	Expr openParen = { Expr::ATOM, false, false, false, { "( ", 2 } };
+	Expr closeParen = { Expr::ATOM, false, false, false, { " )", 2 } };
+
+	// the whole file, so the decompiler workers never wait on the disk
+	bool readFile(const std::string &path, std::string &contents)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		contents = buffer.str();
+		return true;
+	}
+
+	void printQueueStats(const char* name, const QueueStats &stats)
+	{
+		double average = stats.pushes != 0 ? static_cast<double>(stats.depthSum) / stats.pushes : 0.0;
+		std::fprintf(stderr, "  %-10s queue: capacity %zu, max depth %zu, average depth %.2f, full %zu times, empty %zu times\n",
+			name, stats.capacity, stats.maxDepth, average, stats.fullWaits, stats.emptyWaits);
+	}
+
+	// where the source of a file below the root folder goes, the root's output folder
+	//  is named after it and the path of the file below it is kept
+	std::string outputPathFor(const std::experimental::filesystem::path &rootOutputPath, const std::string &inputPath)
+	{
+		return (rootOutputPath / inputPath.substr(rootOutputPath.string().length() - 2)).string();
+	}
+
+	// entries are written below the output folder, a name must not lead out of it
+	bool isSafeEntryName(const std::string &name)
+	{
+		if (name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos)
+			return false;
+
+		size_t start = 0;
+		while (start <= name.size())
+		{
+			size_t end = name.find_first_of("/\\", start);
+			if (end == std::string::npos)
+				end = name.size();
+			if (name.compare(start, end - start, "..") == 0)
+				return false;
+			start = end + 1;
+		}
+		return true;
+	}
+
+	// a function takes as many upvalues as the highest one it pushes
+	int countUpvalues(const Proto* tf)
+	{
+		int numUpvalues = 0;
+		for (int pc = 0; pc < tf->ncode; ++pc)
+		{
+			Instruction instr = tf->code[pc];
+			if (GET_OPCODE(instr) == OP_PUSHUPVALUE)
+				numUpvalues = std::max(numUpvalues, static_cast<int>(GETARG_U(instr)) + 1);
+		}
+		return numUpvalues;
+	}
+
+	bool isBinary(const Expr* expr, const char* op)
+	{
+		return expr->kind == Expr::BINARY && !expr->paren && expr->text.str == op;
+	}
+
+	// operands that would bind looser than a comparison or arithmetic
+	bool isLogical(const Expr* expr)
+	{
+		if (expr->kind != Expr::BINARY || expr->paren)
+			return false;
+		const char* op = expr->text.str;
+		return op == AND || op == OR || op == EQ || op == NE || op == LT || op == LE || op == GT || op == GE;
+	}
+}
 
 // TODO: test settable and getindexed extensively
 
 Decompiler::Decompiler()
-	: m_format(Formatter::getInstance()), m_success(true)
+	: m_loader(newloader()), m_success(true), m_jobs(1), m_reformat(false),
+	m_cacheMaxBytes(DEFAULT_CACHE_BYTES), m_stats(false),
+	m_chunkSucceeded(false), m_filesAccepted(0), m_filesSkipped(0), m_closureOwner(nullptr), m_closureTasks(nullptr)
 {}
 
-std::string Decompiler::decompileFunction()
+Decompiler::~Decompiler()
+{
+	freeloader(m_loader);
+}
+
+Function* Decompiler::decompileFunction()
 {
 	FuncInfo &funcInfo = m_funcInfos.back();
 	const Instruction* code = funcInfo.tf->code;
@@ -24,634 +160,996 @@ std::string Decompiler::decompileFunction()
 	funcInfo.nForLoops = 0;
 	funcInfo.nForLoopLevel = 0;
 	funcInfo.nLocals = 0;
+	++m_report.stats.functions;
 
-	std::string funcStr;
+	Function* func = m_arena.make<Function>();
+	func->isMain = funcInfo.isMain;
 	funcInfo.codeStack.clear();
+	funcInfo.stmts.clear();
+	funcInfo.condJumps.clear();
+	funcInfo.valueJumps.clear();
+	funcInfo.structure.analyze(code, funcInfo.tf->ncode);
+	funcInfo.localNames.build(funcInfo.tf);
+	funcInfo.localAtoms.assign(funcInfo.tf->nlocvars, nullptr);
+	size_t nextOpen = 0;
 
 	if (!funcInfo.isMain)
 	{
-		funcStr = "function (";
 		// add arguments if we have any
+		func->numParams = funcInfo.tf->numparams;
+		func->params = m_arena.makeArray<Expr*>(func->numParams);
 		for (int i = 0; i < funcInfo.tf->numparams; ++i)
 		{
-			std::string argName = "arg" + std::to_string(i + 1);
+			Expr* argName = localName(i, 0);
+			if (argName == nullptr)
+				argName = newName("arg", i + 1);
 			funcInfo.locals.insert(std::make_pair(i, argName));
-			funcStr += funcInfo.locals.at(i);
+			func->params[i] = argName;
 
 			StackValue local;
 			local.type = ValueType::STRING_LOCAL;
-			local.str = argName;
+			local.expr = argName;
 			funcInfo.codeStack.push_back(local);
-			
-			// if this is not the last elem, put a delimiter
-			if (i != (funcInfo.tf->numparams - 1))
-				funcStr += ", ";
 		}
-		funcStr += ")\n";
-
 	}
 
 	for (;;)
 	{
 		int line = p - code + 1;
 		Instruction instr = *p;
-		std::string tempStr;
 
 		FuncInfo &currInfo = m_funcInfos.back();
 
-		if (!currInfo.context.empty() && currInfo.context.back().dest == line)
-		{
-			Context cont = currInfo.context.back();
-			// eval conditions
-			// this is currently a test
-			std::string condition;
+		int pc = line - 1;
+		const ControlStructure &structure = currInfo.structure;
 
-			condition = "testCOND";
+		for (int i = structure.numEnds(pc); i > 0; --i)
+			currInfo.stmts.push_back(newStmt(m_arena, Stmt::END));
 
-			std::string condPrologue, condEpilogue;
-			if (cont.type == Context::IF)
-			{
-				condPrologue = "if ";
-				condEpilogue = " then\n";
-			}
+		// loops without a condition in front
+		const std::vector<ControlStructure::Open> &opens = structure.opens();
+		for (; nextOpen < opens.size() && opens[nextOpen].pc == pc; ++nextOpen)
+		{
+			if (opens[nextOpen].repeat)
+				addStmt(newStmt(m_arena, Stmt::REPEAT));
 			else
-			{
-				condPrologue = "while ";
-				condEpilogue = " do\n";
-			}
+				addStmt(newStmt(m_arena, Stmt::WHILE, nullptr, newAtom(m_arena, "1")));
+		}
 
-			// assemble and insert cond
-			std::string finalCond = condPrologue + condition + condEpilogue;
-			funcStr.insert(cont.strIndex, finalCond);
-			funcStr += "end\n";
+		if (structure.isValueFinal(pc))
+			closeValue(pc);
 
-			currInfo.context.pop_back();
-		}
+		OpCode op = GET_OPCODE(instr);
+		const OpInfo &info = opInfos[op];
 
-		switch (GET_OPCODE(instr))
+		if (info.pops != OpInfo::VARIABLE && currInfo.codeStack.size() < static_cast<size_t>(info.pops))
 		{
-		case OP_END:
+			showErrorMessage(std::string("stack underflow at ") + info.name + " on line " + std::to_string(line) + ", skipping the rest of the function!", false);
 			break;
+		}
 
-		case OP_RETURN:
-			funcStr += opReturn(GETARG_U(instr));
+		Operands args;
+		args.pc = pc;
+		args.a = 0;
+		args.b = 0;
+		switch (info.format)
+		{
+		case OpInfo::U:
+			args.a = GETARG_U(instr);
 			break;
 
-		case OP_CALL:
-			funcStr += opCall(GETARG_A(instr), GETARG_B(instr), false);
+		case OpInfo::S:
+			args.a = GETARG_S(instr);
 			break;
 
-		case OP_TAILCALL:
-			funcStr += opTailCall(GETARG_A(instr), GETARG_B(instr));
+		case OpInfo::AB:
+			args.a = GETARG_A(instr);
+			args.b = GETARG_B(instr);
 			break;
 
-		case OP_PUSHNIL:
-			opPushNil(GETARG_U(instr));
+		case OpInfo::NONE:
 			break;
+		}
 
-		case OP_POP:
-			opPop(GETARG_U(instr));
-			break;
+		++m_report.stats.opcodes[op];
+		(this->*opHandlers[op])(args);
 
-		case OP_PUSHINT:
-			opPushInt(GETARG_S(instr));
+		if (instr == OP_END)
 			break;
+		p++;
+	}
 
-		case OP_PUSHSTRING:
-			opPushString(currInfo.tf->kstr[GETARG_U(instr)]->str);
-			break;
+	// the statements move into the arena, funcInfo is about to be dropped
+	std::vector<Stmt*> &stmts = m_funcInfos.back().stmts;
+	func->numStmts = static_cast<int>(stmts.size());
+	func->body = m_arena.makeArray<Stmt*>(func->numStmts);
+	std::copy(stmts.begin(), stmts.end(), func->body);
 
-		case OP_PUSHNUM:
-			opPushNum(std::to_string(currInfo.tf->knum[GETARG_U(instr)]));
-			break;
-
-		case OP_PUSHNEGNUM:
-			opPushNegNum(std::to_string(currInfo.tf->knum[GETARG_U(instr)]));
-			break;
+	return func;
+}
 
-		case OP_PUSHUPVALUE:
-			opPushUpvalue(GETARG_U(instr));
-			break;
+void Decompiler::addStmt(Stmt* stmt)
+{
+	// handlers return null when there is nothing to write
+	if (stmt == nullptr)
+		return;
+
+	// a break has to end its block, code behind it was left by `if 1 then`
+	std::vector<Stmt*> &stmts = m_funcInfos.back().stmts;
+	Stmt::Kind kind = stmt->kind;
+	if (!stmts.empty() && stmts.back()->kind == Stmt::BREAK
+		&& kind != Stmt::END && kind != Stmt::ELSE && kind != Stmt::ELSEIF && kind != Stmt::UNTIL)
+		stmts.back() = newStmt(m_arena, Stmt::EXPR, nullptr, newAtom(m_arena, "do break end"));
+	stmts.push_back(stmt);
+}
 
-		case OP_GETLOCAL:
-			opGetLocal(GETARG_U(instr));
-			break;
+Expr* Decompiler::newNumber(double num, bool negative)
+{
+	// same text as std::to_string, without the heap string
+	char buffer[512];
+	int len = std::snprintf(buffer + 1, sizeof(buffer) - 1, "%f", num);
+	if (len < 0)
+		len = 0;
+	else if (len > static_cast<int>(sizeof(buffer)) - 2)
+		len = sizeof(buffer) - 2;
 
-		case OP_GETGLOBAL:
-			opGetGlobal(GETARG_U(instr));
-			break;
+	// trim trailing zeros, if is a fp number
+	// don't have to check for .0 or 1.0, thx lua!
+	// it is guaranteed to have something beyond the . if fp
+	const char* dot = static_cast<const char*>(std::memchr(buffer + 1, '.', len));
+	if (dot != nullptr)
+	{
+		while (buffer + len > dot && buffer[len] == '0')
+			--len;
+	}
 
-		case OP_GETTABLE:
-			opGetTable();
-			break;
+	char* start = buffer + 1;
+	if (negative)
+	{
+		*--start = '-';
+		++len;
+	}
 
-		case OP_GETDOTTED:
-			opGetDotted(GETARG_U(instr));
-			break;
+	return newAtom(m_arena, m_arena.copyString(start, len), len);
+}
 
-		case OP_GETINDEXED:
-			opGetIndexed(GETARG_U(instr));
-			break;
+Expr* Decompiler::newName(const char* prefix, int num)
+{
+	char buffer[32];
+	int len = std::snprintf(buffer, sizeof(buffer), "%s%d", prefix, num);
+	return newAtom(m_arena, m_arena.copyString(buffer, len), len);
+}
 
-		case OP_PUSHSELF:
-			opPushSelf(GETARG_U(instr));
-			break;
+Expr* Decompiler::localName(int slot, int pc)
+{
+	FuncInfo &currInfo = m_funcInfos.back();
+	const char* name = currInfo.localNames.name(slot, pc);
+	if (name == nullptr)
+		return nullptr;
+
+	// the same local keeps the same atom
+	Expr* &atom = currInfo.localAtoms[currInfo.localNames.index(slot, pc)];
+	if (atom == nullptr)
+		atom = newAtom(m_arena, name);
+	return atom;
+}
 
-		case OP_CREATETABLE:
-			opCreateTable(GETARG_U(instr));
-			break;
+bool Decompiler::isHiddenLocal(int slot, int pc, const char* name) const
+{
+	const LocVar* var = m_funcInfos.back().localNames.local(slot, pc);
+	return var != nullptr && std::strcmp(var->varname->str, name) == 0;
+}
 
-		case OP_SETLOCAL:
-			funcStr += opSetLocal(GETARG_U(instr));
-			break;
+void Decompiler::updateLocal(int slot, int pc)
+{
+	// a slot is used again by the locals of later blocks
+	Expr* name = localName(slot, pc);
+	if (name != nullptr)
+		m_funcInfos.back().locals[slot] = name;
+}
 
-		case OP_SETGLOBAL:
-			funcStr += opSetGlobal(GETARG_U(instr));
-			break;
+Expr** Decompiler::popArgs(int numArgs)
+{
+	// the top of the stack ends up last
+	std::vector<StackValue> &codeStack = m_funcInfos.back().codeStack;
+	Expr** args = m_arena.makeArray<Expr*>(numArgs);
+	for (int i = numArgs - 1; i >= 0; --i)
+	{
+		args[i] = codeStack.back().expr;
+		codeStack.pop_back();
+	}
+	return args;
+}
 
-		case OP_SETTABLE:
-			funcStr += opSetTable(GETARG_A(instr), GETARG_B(instr));
-			break;
+void Decompiler::processPath(std::string pathStr)
+{
+	// update to c++17 soon, microsoft??
+	using namespace std::experimental;
+	
+	filesystem::path path(pathStr);
 
-		case OP_SETLIST:
-			opSetList(GETARG_A(instr), GETARG_B(instr));
-			break;
+	if (!filesystem::exists(path))
+	{
+		std::cerr << "Path " << pathStr << " does not exist!" << '\n';
+	}
 
-		case OP_SETMAP:
-			opSetMap(GETARG_U(instr));
-			break;
+	if (filesystem::is_regular_file(path) && ZipArchive::isArchive(path.string()))
+	{
+		filesystem::path rootOutputPath = path.parent_path();
+		rootOutputPath.append(path.stem().string() + "_d");
+		processArchive(path.string(), rootOutputPath.string());
+	}
+	else if (filesystem::is_regular_file(path))
+	{
+		OutputWriter writer(false);
+		printReport(processFile(path.string(), path.parent_path().string() + "\\" + path.stem().string() + "_d" + path.extension().string(), writer));
+		finishOutput(writer);
+	}
+	else
+	{
+		filesystem::path rootOutputPath = path.parent_path();
+		rootOutputPath.append(path.filename().string() + "_d");
 
-		case OP_ADD:
-			opAdd();
-			break;
+		filesystem::create_directory(rootOutputPath);
 
-		case OP_ADDI:
-			opAddI(GETARG_S(instr));
-			break;
+		if (m_jobs == 1)
+			processDirectory(path.string(), rootOutputPath.string());
+		else
+			processDirectoryParallel(path.string(), rootOutputPath.string(), nullptr);
+	}
 
-		case OP_SUB:
-			opSub();
-			break;
+}
 
-		case OP_MULT:
-			opMult();
-			break;
+void Decompiler::watchPath(std::string pathStr)
+{
+	using namespace std::experimental;
 
-		case OP_DIV:
-			opDiv();
-			break;
+	filesystem::path path(pathStr);
+	if (!filesystem::is_directory(path))
+	{
+		std::cerr << "Path " << pathStr << " is not a folder!" << '\n';
+		return;
+	}
 
-		case OP_POW:
-			opPow();
-			break;
+	// started before the first pass, files saved during it are decompiled again
+	DirectoryWatcher watcher(path.string());
+	if (!watcher.valid())
+	{
+		std::cerr << "Error: could not watch " << pathStr << "!\n";
+		return;
+	}
 
-		case OP_CONCAT:
-			opConcat(GETARG_U(instr));
-			break;
+	processPath(pathStr);
 
-		case OP_MINUS:
-			opMinus();
-			break;
+	filesystem::path rootOutputPath = path.parent_path();
+	rootOutputPath.append(path.filename().string() + "_d");
+	removeStale(path.string(), rootOutputPath.string());
+	std::cout << "Watching " << pathStr << " for changes\n" << std::flush;
 
-		case OP_NOT:
-			opNot();
-			break;
+	std::vector<DirectoryWatcher::Change> changes;
+	while (watcher.wait(changes, WATCH_QUIET_MS))
+	{
+		OutputWriter writer(false);
+		for (const DirectoryWatcher::Change &change : changes)
+		{
+			std::string outputPath = outputPathFor(rootOutputPath, change.path);
+			std::error_code error;
 
-		case OP_JMPNE:
+			if (change.removed)
 			{
-				//showErrorMessage("Unimplemented opcode JMPNE! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPNE;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
+				filesystem::remove_all(outputPath, error);
+				std::cout << "File " << filesystem::path(change.path).filename() << " removed!\n";
 			}
-			break;
-
-		case OP_JMPEQ:
+			else if (change.directory)
 			{
-				//showErrorMessage("Unimplemented opcode JMPEQ! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPEQ;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
+				filesystem::recursive_directory_iterator dir(change.path, error), end;
+				for (; !error && dir != end; dir.increment(error))
 				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
+					std::error_code typeError;
+					if (filesystem::is_regular_file(dir->path(), typeError))
+						syncFile(dir->path().string(), outputPathFor(rootOutputPath, dir->path().string()), writer);
 				}
-
+				removeStale(change.path, outputPath);
 			}
-			break;
+			else if (filesystem::is_regular_file(change.path, error))
+				syncFile(change.path, outputPath, writer);
+		}
+		finishOutput(writer);
+		std::cout << std::flush;
+	}
 
-		case OP_JMPLT:
-			{
-				//showErrorMessage("Unimplemented opcode JMPLT! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPLT;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+	std::cerr << "Error: lost the watch on " << pathStr << "!\n";
+}
 
-		case OP_JMPLE:
-			{
-				//showErrorMessage("Unimplemented opcode JMPLE! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPLE;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+void Decompiler::serve(const std::string &socketPath)
+{
+	SocketServer server(socketPath);
+	if (!server.valid())
+	{
+		std::cerr << "Error: could not listen on " << socketPath << "!\n";
+		return;
+	}
 
-		case OP_JMPGT:
-			{
-				//showErrorMessage("Unimplemented opcode JMPLE! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPGT;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+	// every worker keeps its decompiler and serves a client until it hangs up,
+	//  the clients beyond the workers wait in the queue. idle workers sleep
+	//  on it and take a new client at once
+	unsigned int numWorkers = m_jobs != 0 ? m_jobs : std::max(1u, std::thread::hardware_concurrency());
+	BlockingQueue<std::unique_ptr<FramedSocket>> clients(2 * numWorkers);
 
-		case OP_JMPGE:
+	std::vector<std::unique_ptr<Decompiler>> workers;
+	std::vector<std::thread> workerThreads;
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		workers.emplace_back(new Decompiler());
+		workers.back()->setReformat(m_reformat);
+		workers.back()->setVerify(m_verifier != nullptr);
+		workers.back()->m_cache = m_cache;
+		workers.back()->m_memo = m_memo;
+		Decompiler* worker = workers.back().get();
+		workerThreads.emplace_back([worker, &clients]()
+		{
+			std::unique_ptr<FramedSocket> client;
+			std::string request;
+			std::string answer;
+			while (clients.pop(client))
 			{
-				//showErrorMessage("Unimplemented opcode JMPLE! exiting!", true);
-				std::string arg1 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.args.push_back(arg1);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPGE;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
+				while (client->readFrame(request, MAX_REQUEST_BYTES))
 				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
+					worker->answerRequest(request, answer);
+					if (!client->writeFrame(answer))
+						break;
 				}
+				client.reset();
 			}
-			break;
+		});
+	}
 
-		case OP_JMPT:
-			{
-				//showErrorMessage("Unimplemented opcode JMPLE! exiting!", true);
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPT;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+	std::cout << "Serving on " << socketPath << '\n' << std::flush;
+	while (std::unique_ptr<FramedSocket> client = server.accept())
+		clients.push(std::move(client));
 
-		case OP_JMPF:
-			{
-				//showErrorMessage("Unimplemented opcode JMPLE! exiting!", true);
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPF;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+	std::cerr << "Error: stopped accepting clients on " << socketPath << "!\n";
+	clients.close();
+	for (std::thread &thread : workerThreads)
+		thread.join();
+}
 
-		case OP_JMPONT:
-			{
-				// IDK YET
-				//showErrorMessage("Unimplemented opcode JMPONT! exiting!", true);
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPONT;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+void Decompiler::answerRequest(std::string &request, std::string &answer)
+{
+	std::string sourceStr;
+	char status = ANSWER_BAD_REQUEST;
 
-		case OP_JMPONF:
-			{
-				// IDK YET
-				//showErrorMessage("Unimplemented opcode JMPONF! exiting!", true);
-				std::string arg0 = currInfo.codeStack.back().str;
-				currInfo.codeStack.pop_back();
-				int destLine = GETARG_S(instr) + line + 1;
-
-				CondElem elem;
-				elem.args.push_back(arg0);
-				elem.dest = destLine;
-				elem.lineNum = line;
-				elem.jmpType = OP_JMPONF;
-				elem.nextCond = CondElem::NONE;
-
-				if (currInfo.context.empty() || currInfo.context.back().dest > destLine)
-				{
-					Context cont;
-					cont.conds.push_back(elem);
-					cont.dest = destLine;
-					cont.type = Context::IF;
-					cont.strIndex = funcStr.size();
-					currInfo.context.push_back(cont);
-				}
-				else
-				{
-					currInfo.context.back().conds.push_back(elem);
-					currInfo.context.back().dest = elem.dest;
-				}
-			}
-			break;
+	// loading a missing file by name would end the server, the file is read first
+	if (!request.empty() && request[0] == REQUEST_PATH)
+	{
+		std::string path = request.substr(1);
+		if (readFile(path, request))
+		{
+			sourceStr = finishChunk(decompileImage(request, path));
+			status = m_chunkSucceeded ? ANSWER_DECOMPILED : ANSWER_FAILED;
+		}
+		else
+		{
+			std::ostringstream messages;
+			messages << "Error: file " << std::experimental::filesystem::path(path).filename() << " could not be read!\n";
+			m_chunkMessages = messages.str();
+			status = ANSWER_FAILED;
+		}
+	}
+	else if (request.size() >= 3 && request[0] == REQUEST_CHUNK)
+	{
+		size_t nameLength = static_cast<unsigned char>(request[1]) | static_cast<unsigned char>(request[2]) << 8;
+		if (3 + nameLength <= request.size())
+		{
+			std::string name = request.substr(3, nameLength);
+			// the chunk is what is left of the request
+			request.erase(0, 3 + nameLength);
+			sourceStr = finishChunk(decompileImage(request, name));
+			status = m_chunkSucceeded ? ANSWER_DECOMPILED : ANSWER_FAILED;
+		}
+	}
 
-		case OP_JMP:
-			opJmp(GETARG_S(instr));
-			break;
+	if (status == ANSWER_BAD_REQUEST)
+		m_chunkMessages = "Error: malformed request!\n";
+
+	// the status, the length of the source and the source, the messages take the rest
+	uint32_t sourceLength = static_cast<uint32_t>(sourceStr.size());
+	answer.clear();
+	answer.reserve(5 + sourceStr.size() + m_chunkMessages.size());
+	answer += status;
+	for (int i = 0; i < 4; ++i)
+		answer += static_cast<char>(sourceLength >> (8 * i));
+	answer += sourceStr;
+	answer += m_chunkMessages;
+}
 
-		case OP_PUSHNILJMP:
-			opPushNilJmp();
-			break;
+void Decompiler::syncFile(const std::string &inputPath, const std::string &outputPath, OutputWriter &writer)
+{
+	FileReport report = processFile(inputPath, outputPath, writer);
 
-		case OP_FORPREP:
-			funcStr += opForPrep();
-			break;
+	// the file is no compiled lua file anymore, its old source has to go
+	if (report.stats.bytesWritten == 0)
+	{
+		std::error_code error;
+		std::experimental::filesystem::remove(outputPath, error);
+	}
+	printReport(report);
+}
 
-		case OP_FORLOOP:
-			funcStr += opForLoop();
-			break;
+void Decompiler::removeStale(const std::string &inputPath, const std::string &outputPath)
+{
+	using namespace std::experimental;
 
-		case OP_LFORPREP:
-			funcStr += opLForPrep();
-			break;
+	// collected first, removing them would upset the iterator
+	std::vector<filesystem::path> stale;
+	std::error_code error;
+	filesystem::recursive_directory_iterator dir(outputPath, error), end;
+	for (; !error && dir != end; dir.increment(error))
+	{
+		std::error_code existsError;
+		if (!filesystem::exists(inputPath + dir->path().string().substr(outputPath.length()), existsError))
+		{
+			stale.push_back(dir->path());
+			dir.disable_recursion_pending();
+		}
+	}
 
-		case OP_LFORLOOP:
-			funcStr += opLForLoop();
-			break;
+	for (const filesystem::path &path : stale)
+		filesystem::remove_all(path, error);
+}
 
-		case OP_CLOSURE:
-			opClosure(GETARG_A(instr), GETARG_B(instr));
-			break;
+std::string Decompiler::decompileChunk(const std::string &inputPath)
+{
+	return finishChunk(decompileFile(inputPath.c_str()));
+}
 
-		}
+std::string Decompiler::decompileBuffer(const char* data, size_t size, const std::string &name)
+{
+	FileStats* stats = m_stats ? &m_report.stats : nullptr;
+	m_report.stats.path = name;
+	m_report.stats.bytesRead = size;
 
-		if (instr == OP_END)
-		{
-			if (!currInfo.isMain)
-				funcStr += "end\n";
+	// the sizes in a chunk have to add up to the data, which finds one cut
+	//  short before anything is loaded
+	if (ischunkheader(data, size) && indexproto(data, size, nullptr, 0) < 0)
+	{
+		showErrorMessage("the chunk is truncated or damaged, its sizes do not match the " + std::to_string(size) + " bytes of data", false);
+		return finishChunk(std::string());
+	}
 
-			break;
-		}
-		p++;
+	Proto* tf;
+	{
+		PhaseTimer timer(stats, FileStats::LOAD);
+		tf = loadprotobuffer(m_loader, data, size, name.c_str());
 	}
 
-	return funcStr;
+	return finishChunk(decompileLoaded(tf, name.c_str(), true));
 }
 
-void Decompiler::processPath(std::string pathStr)
+std::vector<FuncSpan> Decompiler::indexChunk(const char* data, size_t size)
 {
-	// update to c++17 soon, microsoft??
-	using namespace std::experimental;
-	
-	filesystem::path path(pathStr);
+	// a guess that fits most chunks, the scan is repeated for the others
+	std::vector<FuncSpan> spans(std::max<size_t>(64, size / 1024));
+	int numSpans = indexproto(data, size, spans.data(), static_cast<int>(spans.size()));
+	if (numSpans > static_cast<int>(spans.size()))
+	{
+		spans.resize(numSpans);
+		numSpans = indexproto(data, size, spans.data(), numSpans);
+	}
+
+	spans.resize(numSpans > 0 ? numSpans : 0);
+	return spans;
+}
+
+std::string Decompiler::decompileSpan(const char* data, size_t size, const FuncSpan &span, const std::string &name)
+{
+	FileStats* stats = m_stats ? &m_report.stats : nullptr;
+	m_report.stats.path = name;
+	m_report.stats.bytesRead = span.size;
+
+	// a span of the whole chunk does not fit into a truncated copy of it
+	if (span.offset > size || span.size > size - span.offset)
+	{
+		showErrorMessage("the function at offset " + std::to_string(span.offset) + " ends past the "
+			+ std::to_string(size) + " bytes of data, the chunk is truncated", false);
+		return finishChunk(std::string());
+	}
+
+	Proto* tf;
+	{
+		PhaseTimer timer(stats, FileStats::LOAD);
+		tf = loadprotospan(m_loader, data, size, &span, name.c_str());
+	}
+
+	return finishChunk(decompileLoaded(tf, name.c_str(), span.parent < 0));
+}
+
+std::string Decompiler::finishChunk(std::string sourceStr)
+{
+	m_chunkStats = std::move(m_report.stats);
+	m_chunkMessages = m_report.errors + m_report.status;
+	m_chunkSucceeded = m_success;
+
+	m_format.reset();
+	m_success = true;
+	m_report = FileReport();
+	return sourceStr;
+}
+
+const FileStats& Decompiler::chunkStats() const
+{
+	return m_chunkStats;
+}
+
+const std::string& Decompiler::chunkMessages() const
+{
+	return m_chunkMessages;
+}
+
+bool Decompiler::chunkSucceeded() const
+{
+	return m_chunkSucceeded;
+}
+
+void Decompiler::setJobs(unsigned int jobs)
+{
+	m_jobs = jobs;
+}
+
+void Decompiler::setReformat(bool reformat)
+{
+	m_reformat = reformat;
+}
+
+void Decompiler::setVerify(bool verify)
+{
+	// keep the verifier's loader if nothing changes
+	if (verify != (m_verifier != nullptr))
+		m_verifier.reset(verify ? new Verifier() : nullptr);
+}
+
+void Decompiler::setCache(const std::string &directory)
+{
+	m_cache = std::make_shared<ResultCache>(directory, m_cacheMaxBytes);
+}
+
+void Decompiler::setCacheSize(uint64_t maxBytes)
+{
+	m_cacheMaxBytes = maxBytes;
+	if (m_cache)
+		m_cache->setMaxBytes(maxBytes);
+}
+
+void Decompiler::setDedup(bool dedup)
+{
+	if (dedup != (m_memo != nullptr))
+		m_memo = dedup ? std::make_shared<FunctionMemo>(MEMO_BYTES) : nullptr;
+}
+
+void Decompiler::setStats(bool stats)
+{
+	m_stats = stats;
+}
+
+void Decompiler::setStatsFile(const std::string &path)
+{
+	m_statsPath = path;
+	m_statsTable.setKeepFiles(!path.empty());
+}
+
+void Decompiler::printStats()
+{
+	if (m_cache)
+	{
+		ResultCache::Counters counters = m_cache->counters();
+		std::fprintf(stderr, "\nCache: %zu hits, %zu misses, %zu stored, %zu evicted, %zu entries taking %.1f of %.1f MB\n",
+			counters.hits, counters.misses, counters.stores, counters.evictions, counters.entries,
+			counters.bytes / (1024.0 * 1024.0), m_cacheMaxBytes / (1024.0 * 1024.0));
+	}
 
+	if (m_filesSkipped != 0 || m_stats)
+		std::fprintf(stderr, "\nFiles: %zu accepted, %zu skipped by their header\n", m_filesAccepted, m_filesSkipped);
+
+	if (m_memo)
+	{
+		FunctionMemo::Counters counters = m_memo->counters();
+		double ratio = counters.lookups != 0 ? 100.0 * counters.hits / counters.lookups : 0.0;
+		std::fprintf(stderr, "\nFunctions: %zu looked up, %zu deduplicated (%.1f%%), %zu kept taking %.1f MB\n",
+			counters.lookups, counters.hits, ratio, counters.entries, counters.bytes / (1024.0 * 1024.0));
+	}
+
+	if (!m_stats)
+		return;
+
+	m_statsTable.printSummary(std::cerr);
+	if (!m_statsPath.empty() && !m_statsTable.writeFiles(m_statsPath))
+		std::cerr << "Error: could not write " << m_statsPath << "!\n";
+}
+
+Decompiler::FileReport Decompiler::processFile(const std::string &inputPath, const std::string &outputPath, OutputWriter &writer)
+{
+	m_report.stats.path = inputPath;
+	if (!acceptFile(inputPath))
+		return takeReport();
+
+	std::string sourceStr = m_cache ? decompileCached(inputPath) : decompileFile(inputPath.c_str());
+
+	if (!sourceStr.empty())
+	{
+		m_report.stats.bytesWritten = sourceStr.size();
+		writer.write(outputPath, std::move(sourceStr));
+		reportDecompiled(inputPath);
+	}
+
+	return takeReport();
+}
+
+bool Decompiler::acceptFile(const std::string &inputPath)
+{
+	if (ischunkfile(inputPath.c_str()))
+	{
+		++m_filesAccepted;
+		return true;
+	}
+
+	++m_filesSkipped;
+	reportNotChunk(inputPath.c_str());
+	return false;
+}
+
+void Decompiler::reportNotChunk(const char* fileName)
+{
+	std::ostringstream status;
+	status << "Error: file " << std::experimental::filesystem::path(fileName).filename() << " is not a compiled lua file!\n";
+	m_report.status += status.str();
+	// only seen by chunkSucceeded, the file is not reported as decompiled
+	m_success = false;
+}
+
+std::string Decompiler::decompileCached(const std::string &inputPath)
+{
+	// the key needs the bytes, the file is read instead of mapped
+	std::string image;
+	if (!readFile(inputPath, image))
+		return decompileFile(inputPath.c_str());
+
+	return decompileImage(image, inputPath);
+}
+
+std::string Decompiler::decompileImage(const std::string &image, const std::string &name)
+{
+	FileStats* stats = m_stats ? &m_report.stats : nullptr;
+	m_report.stats.bytesRead = image.size();
+
+	uint64_t key = 0;
 	std::string sourceStr;
+	if (m_cache)
+	{
+		key = m_cache->chunkKey(image, cacheSettings());
+		if (lookupCached(key, sourceStr))
+			return sourceStr;
+	}
 
-	if (!filesystem::exists(path))
+	Proto* tf;
 	{
-		std::cerr << "Path " << pathStr << " does not exist!" << '\n';
+		PhaseTimer timer(stats, FileStats::LOAD);
+		tf = loadprotobuffer(m_loader, image.data(), image.size(), name.c_str());
 	}
+	sourceStr = decompileLoaded(tf, name.c_str(), true);
+
+	if (m_cache && !sourceStr.empty())
+		m_cache->store(key, { m_success, m_report.errors, sourceStr });
+	return sourceStr;
+}
+
+std::string Decompiler::cacheSettings() const
+{
+	std::string settings = m_reformat ? "reformat" : "layout";
+	if (m_verifier)
+		settings += " verify";
+	return settings;
+}
+
+bool Decompiler::lookupCached(uint64_t key, std::string &sourceStr)
+{
+	ResultCache::Entry entry;
+	if (!m_cache->lookup(key, entry))
+		return false;
+
+	m_report.errors += entry.errors;
+	m_success = entry.success;
+	sourceStr = std::move(entry.source);
+	return true;
+}
+
+void Decompiler::reportDecompiled(const std::string &inputPath)
+{
+	std::experimental::filesystem::path path(inputPath);
+
+	std::ostringstream status;
+	if (m_success)
+		status << "File " << path.filename() << " successfully decompiled!\n";
+	else
+		status << "File " << path.filename() << " decompiled with errors!\n";
+	m_report.status += status.str();
+}
 
-	if (filesystem::is_regular_file(path))
+Decompiler::FileReport Decompiler::takeReport()
+{
+	m_format.reset();
+	m_success = true;
+
+	FileReport report = std::move(m_report);
+	m_report = FileReport();
+	return report;
+}
+
+void Decompiler::processDirectory(const std::string &pathStr, const std::string &rootOutputStr)
+{
+	using namespace std::experimental;
+
+	filesystem::recursive_directory_iterator dir(pathStr), end;
+	filesystem::path rootOutputPath(rootOutputStr);
+	// the next file is decompiled while the last one is written
+	OutputWriter writer(true);
+
+	while (dir != end)
 	{
-		sourceStr = decompileFile(path.string().c_str());
-		if (!sourceStr.empty())
+		if (filesystem::is_regular_file(dir->path()))
 		{
-			saveFile(sourceStr, path.parent_path().string() + "\\" + path.stem().string() + "_d" + path.extension().string());
+			printReport(processFile(dir->path().string(), outputPathFor(rootOutputPath, dir->path().string()), writer));
+		}
 
-			if (m_success)
-				std::cout << "File " << path.filename() << " successfully decompiled!\n";
-			else
-				std::cout << "File " << path.filename() << " decompiled with errors!\n";
+		++dir;
+	}
 
-			sourceStr.clear();
-			m_format.reset();
-			m_success = true;
+	finishOutput(writer);
+}
+
+void Decompiler::processArchive(const std::string &pathStr, const std::string &rootOutputStr)
+{
+	using namespace std::experimental;
+
+	ZipArchive archive;
+	if (!archive.open(pathStr))
+	{
+		std::cerr << "Error: " << filesystem::path(pathStr).filename() << " is not a readable zip archive!\n";
+		return;
+	}
+
+	if (m_jobs != 1)
+	{
+		processDirectoryParallel(pathStr, rootOutputStr, &archive);
+		return;
+	}
+
+	filesystem::path rootOutputPath(rootOutputStr);
+	OutputWriter writer(true);
+
+	for (const ZipArchive::Entry &entry : archive.entries())
+	{
+		std::string inputPath = (filesystem::path(pathStr) / entry.name).string();
+		m_report.stats.path = inputPath;
+
+		std::string image;
+		if (readEntry(archive, entry, image))
+		{
+			std::string sourceStr = decompileImage(image, inputPath);
+			if (!sourceStr.empty())
+			{
+				m_report.stats.bytesWritten = sourceStr.size();
+				writer.write((rootOutputPath / entry.name).string(), std::move(sourceStr));
+				reportDecompiled(inputPath);
+			}
 		}
+
+		printReport(takeReport());
 	}
+
+	finishOutput(writer);
+}
+
+bool Decompiler::readEntry(const ZipArchive &archive, const ZipArchive::Entry &entry, std::string &image)
+{
+	std::ostringstream status;
+	if (!isSafeEntryName(entry.name))
+		status << "Error: entry \"" << entry.name << "\" leads out of the output folder, it is skipped!\n";
+	else if (!archive.read(entry, image))
+		status << "Error: entry \"" << entry.name << "\" could not be read from the archive!\n";
 	else
-	{
-		filesystem::recursive_directory_iterator dir(path), end;
-		filesystem::path rootOutputPath = path.parent_path();
-		rootOutputPath.append(path.filename().string() + "_d");
+		return true;
 
-		filesystem::create_directory(rootOutputPath);
+	m_report.status += status.str();
+	image.clear();
+	return false;
+}
 
-		while (dir != end)
+void Decompiler::processDirectoryParallel(const std::string &pathStr, const std::string &rootOutputStr, const ZipArchive* archive)
+{
+	using namespace std::experimental;
+
+	// a file on its way through the stages, from its contents to its report
+	struct FileJob
+	{
+		size_t index;
+		std::string inputPath;
+		std::string outputPath;
+		// read by the worker, null for a file on disk
+		const ZipArchive::Entry* entry;
+		// empty if the reader could not read it, it is then loaded by name
+		std::string image;
+		std::string source;
+		FileReport report;
+		bool success;
+		// served from the cache, or to be stored there once it is written
+		bool cacheHit;
+		bool cacheMiss;
+		uint64_t cacheKey;
+	};
+	typedef BoundedQueue<std::unique_ptr<FileJob>> JobQueue;
+
+	unsigned int numWorkers = m_jobs != 0 ? m_jobs : std::max(1u, std::thread::hardware_concurrency());
+	// a few files per worker keep every stage busy, more would only take memory
+	const size_t queueCapacity = 2 * numWorkers;
+	JobQueue loaded(queueCapacity);
+	JobQueue decompiled(queueCapacity);
+	JobQueue finished(queueCapacity);
+
+	// decompiler workers, each owns a loader and an arena
+	std::vector<std::unique_ptr<Decompiler>> workers;
+	std::vector<std::thread> workerThreads;
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		workers.emplace_back(new Decompiler());
+		workers.back()->setReformat(m_reformat);
+		workers.back()->setVerify(m_verifier != nullptr);
+		workers.back()->setStats(m_stats);
+		workers.back()->m_cache = m_cache;
+		workers.back()->m_memo = m_memo;
+		Decompiler* worker = workers.back().get();
+		workerThreads.emplace_back([worker, archive, &loaded, &decompiled, &finished]()
 		{
-			if (filesystem::is_regular_file(dir->path()))
+			std::unique_ptr<FileJob> job;
+			while (loaded.pop(job))
 			{
-				sourceStr = decompileFile(dir->path().string().c_str());
-				if (!sourceStr.empty())
+				const char* fileName = job->inputPath.c_str();
+				FileStats &stats = worker->m_report.stats;
+				stats.path = job->inputPath;
+				// entries are inflated here, that takes as long as loading them
+				bool readable = job->entry == nullptr || worker->readEntry(*archive, *job->entry, job->image);
+				if (readable && worker->m_cache && !job->image.empty())
 				{
-					filesystem::path newPath = rootOutputPath / dir->path().string().substr(rootOutputPath.string().length() - 2);
+					stats.bytesRead = job->image.size();
+					job->cacheKey = worker->m_cache->chunkKey(job->image, worker->cacheSettings());
+					job->cacheHit = worker->lookupCached(job->cacheKey, job->source);
+					job->cacheMiss = !job->cacheHit;
+				}
+				if (readable && !job->cacheHit)
+				{
+					Proto* tf;
+					if (job->image.empty() && job->entry == nullptr)
+					{
+						PhaseTimer timer(worker->m_stats ? &stats : nullptr, FileStats::LOAD);
+						tf = worker->loadLuaStructure(fileName);
+					}
+					else
+					{
+						PhaseTimer timer(worker->m_stats ? &stats : nullptr, FileStats::LOAD);
+						tf = loadprotobuffer(worker->m_loader, job->image.data(), job->image.size(), fileName);
+						stats.bytesRead = job->image.size();
+					}
+					job->source = worker->decompileProto(tf, fileName, true);
+				}
+				if (!job->source.empty())
+					worker->reportDecompiled(job->inputPath);
+				job->success = worker->m_success;
+				job->report = worker->takeReport();
+				job->image = std::string();
+
+				// the lexer based formatter gets a stage of its own, cached sources are formatted already
+				if (worker->m_reformat && !job->source.empty() && !job->cacheHit)
+					decompiled.push(std::move(job));
+				else
+					finished.push(std::move(job));
+			}
+		});
+	}
 
-					if (!filesystem::exists(newPath.parent_path()))
-						filesystem::create_directory(newPath.parent_path());
+	// formatters, only needed for --reformat. otherwise the source is laid out while it is written
+	std::vector<std::unique_ptr<Decompiler>> formatters;
+	std::vector<std::thread> formatterThreads;
+	for (unsigned int i = 0; m_reformat && i < numWorkers; ++i)
+	{
+		formatters.emplace_back(new Decompiler());
+		Decompiler* formatter = formatters.back().get();
+		formatterThreads.emplace_back([this, formatter, &decompiled, &finished]()
+		{
+			std::unique_ptr<FileJob> job;
+			while (decompiled.pop(job))
+			{
+				PhaseTimer timer(m_stats ? &job->report.stats : nullptr, FileStats::FORMAT);
+				job->source = formatter->formatCode(job->source);
+				formatter->m_format.reset();
+				finished.push(std::move(job));
+			}
+		});
+	}
 
-					saveFile(sourceStr, newPath.string());
+	// the writer saves the files and prints the reports in traversal order
+	std::thread writerThread([this, &finished]()
+	{
+		std::map<size_t, FileReport> reports;
+		size_t nextReport = 0;
+		// this is the writer's thread already
+		OutputWriter writer(false);
 
-					if (m_success)
-						std::cout << "File " << dir->path().filename() << " successfully decompiled!\n";
-					else
-						std::cout << "File " << dir->path().filename() << " decompiled with errors!\n";
+		std::unique_ptr<FileJob> job;
+		while (finished.pop(job))
+		{
+			if (!job->source.empty())
+			{
+				if (job->cacheMiss)
+					m_cache->store(job->cacheKey, { job->success, job->report.errors, job->source });
+				job->report.stats.bytesWritten = job->source.size();
+				writer.write(job->outputPath, std::move(job->source));
+			}
 
-					m_format.reset();
-					sourceStr.clear();
-					m_success = true;
+			reports[job->index] = std::move(job->report);
+			job.reset();
+
+			for (auto next = reports.begin(); next != reports.end() && next->first == nextReport; next = reports.erase(next))
+			{
+				printReport(next->second);
+				++nextReport;
+			}
+		}
+
+		finishOutput(writer);
+	});
+
+	// the calling thread reads the files, the queue holds it back when the workers fall behind
+	filesystem::path rootOutputPath(rootOutputStr);
+	size_t numFiles = 0;
+	auto newJob = [&numFiles](const std::string &inputPath, const std::string &outputPath, const ZipArchive::Entry* entry)
+	{
+		std::unique_ptr<FileJob> job(new FileJob());
+		job->index = numFiles++;
+		job->success = false;
+		job->cacheHit = false;
+		job->cacheMiss = false;
+		job->cacheKey = 0;
+		job->inputPath = inputPath;
+		job->outputPath = outputPath;
+		job->entry = entry;
+		return job;
+	};
+
+	if (archive != nullptr)
+	{
+		// the workers read the entries, the archive is mapped already
+		for (const ZipArchive::Entry &entry : archive->entries())
+			loaded.push(newJob((filesystem::path(pathStr) / entry.name).string(), (rootOutputPath / entry.name).string(), &entry));
+	}
+	else
+	{
+		filesystem::recursive_directory_iterator dir(pathStr), end;
+		while (dir != end)
+		{
+			if (filesystem::is_regular_file(dir->path()))
+			{
+				std::string inputPath = dir->path().string();
+				std::unique_ptr<FileJob> job = newJob(inputPath, outputPathFor(rootOutputPath, inputPath), nullptr);
+				// files that are no chunks go straight to the writer, with their report
+				m_report.stats.path = inputPath;
+				if (acceptFile(inputPath))
+				{
+					readFile(job->inputPath, job->image);
+					loaded.push(std::move(job));
+				}
+				else
+				{
+					job->report = takeReport();
+					finished.push(std::move(job));
 				}
 			}
 
@@ -659,101 +1157,204 @@ void Decompiler::processPath(std::string pathStr)
 		}
 	}
 
+	// every stage drains its queue before the next one is told to stop
+	loaded.close();
+	for (std::thread &thread : workerThreads)
+		thread.join();
+	decompiled.close();
+	for (std::thread &thread : formatterThreads)
+		thread.join();
+	finished.close();
+	writerThread.join();
+
+	if (m_stats)
+	{
+		std::cerr << "\nPipeline, " << numWorkers << " workers, " << numFiles << " files\n";
+		printQueueStats("read", loaded.stats());
+		if (m_reformat)
+			printQueueStats("decompiled", decompiled.stats());
+		printQueueStats("finished", finished.stats());
+	}
 }
 
-std::string Decompiler::evalCondition(CondElem currentCond)
+void Decompiler::printReport(const FileReport &report)
 {
-	return "";
+	std::cerr << report.errors;
+	std::cout << report.status;
+
+	if (m_stats)
+		m_statsTable.add(report.stats);
 }
 
-int Decompiler::invertCond(int cnd)
+std::string Decompiler::decompileFile(const char* fileName)
 {
-	OpCode cond = (OpCode)cnd;
+	FileStats* stats = m_stats ? &m_report.stats : nullptr;
 
-	switch (cond)
+	Proto* tf;
 	{
-	case OP_JMPNE:
-		return OP_JMPEQ;
-	case OP_JMPEQ:
-		return OP_JMPNE;
-	case OP_JMPLT:
-		return OP_JMPGE;
-	case OP_JMPLE:
-		return OP_JMPGT;
-	case OP_JMPGT:
-		return OP_JMPLE;
-	case OP_JMPGE:
-		return OP_JMPLT;
-	case OP_JMPT:
-		return OP_JMPF;
-	case OP_JMPF:
-		return OP_JMPT;
-	case OP_JMPONT:
-		return OP_JMPONF;
-	case OP_JMPONF:
-		return OP_JMPONT;
-
-	default:
-		return -1;
+		PhaseTimer timer(stats, FileStats::LOAD);
+		tf = loadLuaStructure(fileName);
+	}
+	if (stats != nullptr)
+	{
+		std::error_code error;
+		uintmax_t size = std::experimental::filesystem::file_size(fileName, error);
+		stats->bytesRead = error ? 0 : static_cast<size_t>(size);
 	}
+
+	return decompileLoaded(tf, fileName, true);
 }
 
-std::string Decompiler::decompileFile(const char* fileName)
+std::string Decompiler::decompileLoaded(Proto* tf, const char* fileName, bool isMain)
 {
-	Proto* tf = loadLuaStructure(fileName);
-	std::string sourceStr;
+	std::string sourceStr = decompileProto(tf, fileName, isMain);
 
-	std::experimental::filesystem::path path(fileName);
+	if (!m_reformat || sourceStr.empty())
+		return sourceStr;
+
+	PhaseTimer timer(m_stats ? &m_report.stats : nullptr, FileStats::FORMAT);
+	return formatCode(sourceStr);
+}
+
+std::string Decompiler::decompileProto(Proto* tf, const char* fileName, bool isMain)
+{
+	std::string sourceStr;
 
 	if (tf == NULL)
 	{
-		std::cout << "Error: file " << path.filename() << " is not a compiled lua file!\n";
+		// a malformed chunk leaves its message in the loader, anything else is no chunk
+		const char* message = loadermessage(m_loader);
+		if (*message != '\0')
+			showErrorMessage(std::string("the chunk could not be loaded, ") + message, false);
+		else
+			reportNotChunk(fileName);
 		return sourceStr;
 	}
 
 	//std::cout << "File " << path.filename() << " opened successfully!\n";
 
 
-	FuncInfo mainInfo;
-	mainInfo.isMain = true;
-	mainInfo.tf = tf;
-	m_funcInfos.push_back(mainInfo);
-	sourceStr = decompileFunction();
-	m_funcInfos.pop_back();
+	if (m_jobs != 1 && !m_closurePool)
+	{
+		m_closurePool.reset(new ThreadPool(m_jobs));
+		for (unsigned int i = 0; i < m_closurePool->size(); ++i)
+		{
+			m_closureWorkers.emplace_back(new Decompiler());
+			m_closureWorkers.back()->m_closureOwner = this;
+			m_closureWorkers.back()->m_memo = m_memo;
+		}
+	}
+	m_closureOwner = m_jobs != 1 && m_closurePool ? this : nullptr;
+	m_closureTasks = &m_chunkClosures;
 
-	return formatCode(sourceStr);
+	FileStats* stats = m_stats ? &m_report.stats : nullptr;
+
+	Function* mainFunc;
+	{
+		PhaseTimer timer(stats, FileStats::DECOMPILE);
+		// a chunk met before is taken as a whole
+		uint64_t key = 0;
+		bool store = false;
+		bool keyed = isMain && m_memo && m_memo->functionKey(tf, true, nullptr, 0, key);
+		if (!isMain)
+		{
+			// a nested function on its own, the values it closes over are not known
+			int numUpvalues = countUpvalues(tf);
+			Expr** upvalues = m_arena.makeArray<Expr*>(numUpvalues);
+			for (int i = 0; i < numUpvalues; ++i)
+				upvalues[i] = newName("upvalue", i + 1);
+			mainFunc = decompileClosure(tf, upvalues, numUpvalues);
+			finishClosures();
+		}
+		else if (!keyed || !lookupMemo(key, mainFunc, store))
+		{
+			size_t errorsAt = m_report.errors.size();
+			bool success = m_success;
+			m_success = true;
+
+			FuncInfo mainInfo;
+			mainInfo.isMain = true;
+			mainInfo.tf = tf;
+			m_funcInfos.push_back(mainInfo);
+			mainFunc = decompileFunction();
+			m_funcInfos.pop_back();
+			finishClosures();
+
+			if (store)
+				storeMemo(key, mainFunc, errorsAt, m_success);
+			m_success = success && m_success;
+		}
+	}
+
+	// the tree points into the protos' strings, write it out before releasing them
+	{
+		PhaseTimer timer(stats, FileStats::WRITE);
+		m_source.clear();
+		SourceWriter writer(m_source, !m_reformat);
+		writer.writeChunk(mainFunc);
+	}
+
+	m_report.stats.allocations += m_arena.allocations();
+	m_report.stats.allocatedBytes += m_arena.bytesAllocated();
+	m_arena.reset();
+	for (std::unique_ptr<Decompiler> &worker : m_closureWorkers)
+	{
+		m_report.stats.allocations += worker->m_arena.allocations();
+		m_report.stats.allocatedBytes += worker->m_arena.bytesAllocated();
+		worker->m_arena.reset();
+	}
+
+	// the source is compiled back while the protos it came from are still loaded,
+	//  a nested function would compile to a chunk defining it
+	if (m_verifier && isMain)
+	{
+		PhaseTimer timer(stats, FileStats::VERIFY);
+		if (m_verifier->verify(tf, m_source, fileName, m_report.errors) != 0)
+			m_success = false;
+	}
+
+	// the protos are not needed anymore, release them before formatting
+	resetloader(m_loader);
+
+	return m_source;
 }
 
 std::string Decompiler::formatCode(std::string &sourceStr)
 {
 	const reflex::Input strInput(sourceStr);
-	yyFlexLexer lexer(strInput, &std::cout);
+	yyFlexLexer lexer(m_format, strInput, &std::cout);
 	lexer.yylex();
 	//std::cout << *m_formattedStr;
 
 	return m_format.getFormattedStr();
 }
 
-void Decompiler::saveFile(const std::string &src, const std::string &path)
+void Decompiler::finishOutput(OutputWriter &writer)
 {
-	std::ofstream file;
-	file.open(path, std::ios::trunc);
+	for (const std::string &path : writer.flush())
+		std::cerr << "Error: could not write " << std::experimental::filesystem::path(path) << "!\n";
 
-	file << src;
+	if (m_stats)
+	{
+		OutputWriter::Totals totals = writer.totals();
+		m_statsTable.addSaved(totals.files, totals.bytes, totals.wallSeconds, totals.cpuSeconds);
+	}
 }
 
 Proto* Decompiler::loadLuaStructure(const char* fileName)
 { 
-	return loadproto(fileName);
+	return loadproto(m_loader, fileName);
 }
 
 void Decompiler::showErrorMessage(std::string message, bool exitError)
 {
-	std::cerr << "Error: " << message << '\n';
+	m_report.errors += "Error: " + message + '\n';
 	m_success = false;
 
 	if (exitError)
 	{
+		printReport(m_report);
+
 		// pause
 		char f;
 		std::cin >> f;
@@ -761,95 +1362,75 @@ void Decompiler::showErrorMessage(std::string message, bool exitError)
 	}
 }
 
-void Decompiler::opEnd()
+void Decompiler::opEnd(const Operands &args)
 {
 }
 
-std::string Decompiler::opReturn(int returnBase)
+void Decompiler::opReturn(const Operands &args)
 {
-	//int returnBase = GETARG_U(instr);
-	std::vector<StackValue> args;
-	std::string tempStr;
-
+	int returnBase = args.a;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	// pop size - base
 	int items = currInfo.codeStack.size() - returnBase;
-	for (int i = 0; i < items; ++i)
-	{
-		args.push_back(currInfo.codeStack.back());
-		currInfo.codeStack.pop_back();
-	}
-
-	tempStr = "return ";
+	if (items < 0)
+		items = 0;
 
-	// insert arguments in the right order
-	for (auto it = args.rbegin(); it != args.rend(); ++it)
-	{
-		tempStr += (*it).str;
-		if (--args.rend() != it)
-			tempStr += ", ";
-	}
+	// arguments come out in the right order
+	Expr** values = popArgs(items);
+	addStmt(newStmt(m_arena, Stmt::RETURN, values, items));
+}
 
-	return (tempStr + '\n');
+void Decompiler::opCall(const Operands &args)
+{
+	addStmt(makeCall(args.a, args.b, false));
 }
 
-std::string Decompiler::opCall(int callBase, int numResults, bool isTailCall)
+Stmt* Decompiler::makeCall(int callBase, int numResults, bool isTailCall)
 {
-	std::vector<StackValue> args;
-	std::string funcName;
-	std::string tempStr;
-
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	funcName = currInfo.codeStack[callBase].str;
-
 	int items = currInfo.codeStack.size() - callBase;
+	Expr** args = m_arena.makeArray<Expr*>(items > 1 ? items - 1 : 0);
+	int numArgs = 0;
 	for (int i = 0; i < items - 1; ++i)
 	{
 		if (currInfo.codeStack.back().type == ValueType::STRING_PUSHSELF)
 		{
-			std::string str = currInfo.codeStack.back().str;
+			Expr* self = currInfo.codeStack.back().expr;
 			currInfo.codeStack.pop_back();
-			str = currInfo.codeStack.back().str + str;
+			Expr* object = currInfo.codeStack.back().expr;
 			currInfo.codeStack.pop_back();
 
 			StackValue result;
-			result.str = str;
+			result.expr = newSequence(m_arena, object, self);
 			result.type = ValueType::STRING_GLOBAL;
 			currInfo.codeStack.push_back(result);
 		}
 		else
 		{
-			args.push_back(currInfo.codeStack.back());
+			args[numArgs++] = currInfo.codeStack.back().expr;
 			currInfo.codeStack.pop_back();
 		}
 	}
 
+	// insert arguments in the right order
+	std::reverse(args, args + numArgs);
+
 	// get funcName
-	funcName = currInfo.codeStack.back().str;
+	Expr* funcName = currInfo.codeStack.back().expr;
 	currInfo.codeStack.pop_back();
 
-	tempStr = funcName + "(";
-
-	// insert arguments in the right order
-	for (auto it = args.rbegin(); it != args.rend(); ++it)
-	{
-		tempStr += (*it).str;
-		if (--args.rend() != it)
-			tempStr += ", ";
-	}
-
-	tempStr += ")";
+	Expr* call = newCall(m_arena, funcName, args, numArgs);
 
 	if (numResults > 0)
 	{
 		StackValue result;
-		result.str = tempStr;
+		result.expr = call;
 		result.type = ValueType::STRING;
 
 		if (isTailCall)
-			result.str = "return " + result.str;
+			result.expr = newPrefix(m_arena, "return ", call);
 
 		if (numResults != 255)
 		{
@@ -866,329 +1447,297 @@ std::string Decompiler::opCall(int callBase, int numResults, bool isTailCall)
 			// assume argb to be 1??
 			// HACK maybe working
 			currInfo.codeStack.pop_back();
-			return (result.str + '\n');
-			//funcStr += (result.str + '\n');
+			return newStmt(m_arena, Stmt::EXPR, nullptr, result.expr);
 		}
 
-		return "";
+		return nullptr;
 	}
 	else
 	{
-		//funcStr += (tempStr + '\n');
-		return (tempStr + '\n');
+		return newStmt(m_arena, Stmt::EXPR, nullptr, call);
 	}
 }
 
-std::string Decompiler::opTailCall(int callBase, int numResults)
+void Decompiler::opTailCall(const Operands &args)
 {
-	return opCall(callBase, numResults, true);
+	addStmt(makeCall(args.a, args.b, true));
 }
 
-void Decompiler::opPushNil(int numNil)
+void Decompiler::opPushNil(const Operands &args)
 {
+	if (m_funcInfos.back().structure.skipAdjust(args.pc))
+		return;
+
 	StackValue result;
-	result.str = "nil";
+	result.expr = newAtom(m_arena, "nil");
 	result.type = ValueType::NIL;
 
-	for (int i = 0; i < numNil; ++i)
+	for (int i = 0; i < args.a; ++i)
 		m_funcInfos.back().codeStack.push_back(result);
 }
 
-void Decompiler::opPop(int numPop)
+void Decompiler::opPop(const Operands &args)
 {
-	for (int i = 0; i < numPop; ++i)
+	if (m_funcInfos.back().structure.skipAdjust(args.pc))
+		return;
+
+	for (int i = 0; i < args.a; ++i)
 	{
 		m_funcInfos.back().codeStack.pop_back();
 	}
 }
 
-void Decompiler::opPushInt(int num)
+void Decompiler::opPushInt(const Operands &args)
 {
 	StackValue stackValue;
-	stackValue.str = std::to_string(num);
+	stackValue.expr = newName("", args.a);
 	stackValue.type = ValueType::INT;
 	m_funcInfos.back().codeStack.push_back(stackValue);
 }
 
-void Decompiler::opPushString(std::string str)
+void Decompiler::opPushString(const Operands &args)
 {
+	const char* str = m_funcInfos.back().tf->kstr[args.a]->str;
 	StackValue result;
-
-	if (str.find('\n') != std::string::npos || str.find('\t') != std::string::npos)
-	{
-		str.insert(0, "[[");
-		str.insert(str.size(), "]]");
-	}
-	else
-	{
-		str.insert(0, "\"");
-		str.insert(str.size(), "\"");
-	}
-	result.str = str;
+	result.expr = newString(m_arena, str);
 	result.type = ValueType::STRING;
 	m_funcInfos.back().codeStack.push_back(result);
 }
 
-void Decompiler::opPushNum(std::string numStr)
+void Decompiler::opPushNum(const Operands &args)
 {
+	double num = m_funcInfos.back().tf->knum[args.a];
 	StackValue stackValue;
-	stackValue.str = numStr;
-
-	// trim trailing zeros, if is a fp number
-	// don't have to check for .0 or 1.0, thx lua!
-	// it is guaranteed to have something beyond the . if fp
-	size_t dotPos = stackValue.str.find('.');
-	if (dotPos != std::string::npos)
-	{
-		for (size_t i = stackValue.str.size() - 1; i > dotPos; --i)
-		{
-			if (stackValue.str[i] == '0')
-				stackValue.str.erase(i);
-			else
-				break;
-		}
-	}
-
+	stackValue.expr = newNumber(num, false);
 	stackValue.type = ValueType::INT;
 	m_funcInfos.back().codeStack.push_back(stackValue);
 }
 
-void Decompiler::opPushNegNum(std::string numStr)
+void Decompiler::opPushNegNum(const Operands &args)
 {
+	double num = m_funcInfos.back().tf->knum[args.a];
 	StackValue stackValue;
-	stackValue.str = numStr;
-
-	// trim trailing zeros, if is a fp number
-	// don't have to check for .0 or 1.0, thx lua!
-	// it is guaranteed to have something beyond the . if fp
-	size_t dotPos = stackValue.str.find('.');
-	if (dotPos != std::string::npos)
-	{
-		for (size_t i = stackValue.str.size() - 1; i > dotPos; --i)
-		{
-			if (stackValue.str[i] == '0')
-				stackValue.str.erase(i);
-			else
-				break;
-		}
-	}
-
-	stackValue.str.insert(0, "-");
-
+	stackValue.expr = newNumber(num, true);
 	stackValue.type = ValueType::INT;
 	m_funcInfos.back().codeStack.push_back(stackValue);
 }
 
-void Decompiler::opPushUpvalue(int upvalueIndex)
+void Decompiler::opPushUpvalue(const Operands &args)
 {
+	int upvalueIndex = args.a;
 	StackValue result;
 
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	result.str = '%' + currInfo.upvalues.at(upvalueIndex);
+	// only a damaged chunk asks for more upvalues than its closure passed
+	auto upvalue = currInfo.upvalues.find(upvalueIndex);
+	if (upvalue == currInfo.upvalues.end())
+	{
+		showErrorMessage("PUSHUPVALUE " + std::to_string(upvalueIndex) + " is no upvalue of the function", false);
+		upvalue = currInfo.upvalues.insert(std::make_pair(upvalueIndex, newName("upvalue", upvalueIndex + 1))).first;
+	}
+
+	result.expr = newPrefix(m_arena, "%", upvalue->second);
 	result.type = ValueType::STRING;
 
 	currInfo.codeStack.push_back(result);
 }
 
-std::string Decompiler::opGetLocal(int localIndex)
+void Decompiler::opGetLocal(const Operands &args)
 {
+	int localIndex = args.a;
 	StackValue stackValue;
-	std::string tempStr;
 
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	if (currInfo.locals.find(localIndex) == currInfo.locals.end())
 	{
 		// local is not present in the list
-		// name it.
-		std::string localName = "loc" + std::to_string(localIndex - currInfo.tf->numparams + 1);
-		currInfo.locals.insert(std::make_pair(localIndex, localName));
+		// name it. its declaration is not written yet
+		Expr* name = localName(localIndex, args.pc);
+		if (name == nullptr)
+			name = newName("loc", localIndex - currInfo.tf->numparams + 1);
+		currInfo.locals.insert(std::make_pair(localIndex, name));
 		++currInfo.nLocals;
-
-		tempStr += "local " + localName + " = " + currInfo.codeStack[localIndex].str + "\n";
 	}
+	else
+		updateLocal(localIndex, args.pc);
 
-	stackValue.str = currInfo.locals.find(localIndex)->second;
+	stackValue.expr = currInfo.locals.find(localIndex)->second;
 	stackValue.type = ValueType::STRING_LOCAL;
 	m_funcInfos.back().codeStack.push_back(stackValue);
-
-	return tempStr;
 }
 
-void Decompiler::opGetGlobal(int globalIndex)
+void Decompiler::opGetGlobal(const Operands &args)
 {
+	int globalIndex = args.a;
 	StackValue stackValue;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	stackValue.index = globalIndex;
-	stackValue.str = std::string(currInfo.tf->kstr[stackValue.index]->str);
+	stackValue.expr = newAtom(m_arena, currInfo.tf->kstr[stackValue.index]->str);
 	stackValue.type = ValueType::STRING_GLOBAL;
 	currInfo.codeStack.push_back(stackValue);
 }
 
-void Decompiler::opGetTable()
+void Decompiler::opGetTable(const Operands &args)
 {
-	std::vector<StackValue> args;
-	StackValue result;
+	StackValue key, table, result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	args.push_back(currInfo.codeStack.back());
+	key = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
-	args.push_back(currInfo.codeStack.back());
+	table = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
-	result.str = args[1].str + '[' + args[0].str + ']';
+	result.expr = newIndex(m_arena, table.expr, key.expr);
+	result.type = ValueType::NONE;
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opGetDotted(int stringIndex)
+void Decompiler::opGetDotted(const Operands &args)
 {
+	int stringIndex = args.a;
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	std::string str = currInfo.tf->kstr[stringIndex]->str;
+	const char* str = currInfo.tf->kstr[stringIndex]->str;
 	StackValue target, result;
 
 	target = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
-	result.str = target.str + "." + str;
+	result.expr = newField(m_arena, target.expr, str);
 	result.type = ValueType::STRING;
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opGetIndexed(int localIndex)
+void Decompiler::opGetIndexed(const Operands &args)
 {
+	int localIndex = args.a;
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	std::string local = currInfo.locals.at(localIndex);
+	updateLocal(localIndex, args.pc);
+	Expr* local = currInfo.locals.at(localIndex);
 	StackValue target, result;
 
 	target = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
-	result.str = target.str + "[" + local + "]";
+	result.expr = newIndex(m_arena, target.expr, local);
 	result.type = target.type;
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opPushSelf(int stringIndex)
+void Decompiler::opPushSelf(const Operands &args)
 {
-	FuncInfo currInfo = m_funcInfos.back();
+	int stringIndex = args.a;
+	FuncInfo &currInfo = m_funcInfos.back();
 
-	std::string str = currInfo.tf->kstr[stringIndex]->str;
-	StackValue target, result;
+	const char* str = currInfo.tf->kstr[stringIndex]->str;
+	StackValue result;
 
-	result.str = ":" + str;
+	result.expr = newPrefix(m_arena, ":", newAtom(m_arena, str));
 	result.type = ValueType::STRING_PUSHSELF;
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opCreateTable(int numElems)
+void Decompiler::opCreateTable(const Operands &args)
 {
+	int numElems = args.a;
 	StackValue result;
 	if (numElems > 0)
 	{
-		result.str += "{ ";
+		result.expr = newTable(m_arena, nullptr, nullptr, 0, "", false);
 		result.type = ValueType::TABLE_BRACE;
 		result.index = numElems;
 	}
 	else
 	{
-		result.str = "{}";
+		result.expr = newTable(m_arena, nullptr, nullptr, 0, "", true);
 		result.type = ValueType::STRING_GLOBAL;
 	}
 
 	m_funcInfos.back().codeStack.push_back(result);
 }
 
-std::string Decompiler::opSetLocal(int localIndex)
+void Decompiler::opSetLocal(const Operands &args)
 {
+	int localIndex = args.a;
 	StackValue val;
-	std::string local, result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	val = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
-	if (currInfo.locals.size() <= localIndex)
+	if (static_cast<int>(currInfo.locals.size()) <= localIndex)
 	{
-		std::cout << "WARNING!! SETLOCAL out of bounds!!! ignoring";
-		return result;
+		m_report.status += "WARNING!! SETLOCAL out of bounds!!! ignoring";
+		return;
 	}
-	local = currInfo.locals.at(localIndex);
+	updateLocal(localIndex, args.pc);
 
-	result = local + " = " + val.str + "\n";
-
-	return result;
+	addStmt(newStmt(m_arena, Stmt::ASSIGN, currInfo.locals.at(localIndex), val.expr));
 }
 
-std::string Decompiler::opSetGlobal(int globalIndex)
+void Decompiler::opSetGlobal(const Operands &args)
 {
+	int globalIndex = args.a;
 	StackValue val;
-	std::string global, result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	val = currInfo.codeStack.back();
-	global = currInfo.tf->kstr[globalIndex]->str;
+	const char* global = currInfo.tf->kstr[globalIndex]->str;
 
 	if (val.type == ValueType::CLOSURE_STRING)
 	{
 		// we have a closure on the stack
-		// insert after "function ", which is 9 chars
+		// name it, "function global(...)"
 		currInfo.codeStack.pop_back();
-		val.str.insert(9, global);
-		return val.str;
-
+		addStmt(newStmt(m_arena, Stmt::FUNCTION, newAtom(m_arena, global), val.expr));
 	}
 	else
 	{
 		currInfo.codeStack.pop_back();
-		result = global + " = " + val.str + '\n';
-
-		return result;
+		addStmt(newStmt(m_arena, Stmt::ASSIGN, newAtom(m_arena, global), val.expr));
 	}
 }
 
-std::string Decompiler::opSetTable(int targetIndex, int numElems)
+void Decompiler::opSetTable(const Operands &args)
 {
-	std::vector<StackValue> args;
-	std::string result;
+	int targetIndex = args.a;
+	int numElems = args.b;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	if (targetIndex == numElems && numElems == 3)
 	{
+		StackValue values[3];
 		for (int i = 0; i < numElems; ++i)
 		{
-			args.push_back(currInfo.codeStack.back());
+			values[i] = currInfo.codeStack.back();
 			currInfo.codeStack.pop_back();
 		}
 
-		if (args[1].type == ValueType::STRING_GLOBAL)
-		{
-			args[1].str.erase(0, 1);
-			args[1].str.erase(args[1].str.size() - 1);
-		}
-
-		result = args[2].str + "[" + args[1].str + "] = " + args[0].str;
+		Expr* key = values[1].expr;
+		if (values[1].type == ValueType::STRING_GLOBAL)
+			key = newUnquote(m_arena, key);
 
-		return (result + '\n');
+		addStmt(newStmt(m_arena, Stmt::ASSIGN, newIndex(m_arena, values[2].expr, key), values[0].expr));
 	}
 	else
 	{
 		// unimplemented yet
 		showErrorMessage("SETTABLE " + std::to_string(targetIndex) + " " + std::to_string(numElems) + " not implemented!!!", false);
-		return result;
 	}
 }
 
-void Decompiler::opSetList(int targetIndex, int numElems)
+void Decompiler::opSetList(const Operands &args)
 {
-	std::vector<StackValue> args;
-	StackValue target, tableBrace, result;
+	int targetIndex = args.a;
+	int numElems = args.b;
+	StackValue tableBrace, result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	if (targetIndex != 0)
@@ -1196,31 +1745,16 @@ void Decompiler::opSetList(int targetIndex, int numElems)
 		showErrorMessage("SETLIST not fully implemented!, first arg is nonzero!", false);
 	}
 
-	for (int i = 0; i < numElems; ++i)
-	{
-		args.push_back(currInfo.codeStack.back());
-		currInfo.codeStack.pop_back();
-	}
+	Expr** values = popArgs(numElems);
 
 	tableBrace = currInfo.codeStack.back();
 	if (currInfo.codeStack.back().type == ValueType::TABLE_BRACE)
 	{
-		if (tableBrace.index > numElems)
+		if (static_cast<int>(tableBrace.index) > numElems)
 		{
-
 			currInfo.codeStack.pop_back();
 
-			for (auto it = args.rbegin(); it != args.rend(); ++it)
-			{
-				result.str += (*it).str;
-
-				if (--args.rend() != it)
-					result.str += ", ";
-			}
-
-			result.str += ";";
-
-			tableBrace.str += result.str;
+			tableBrace.expr = newTable(m_arena, tableBrace.expr, values, numElems, ";", false);
 			tableBrace.index -= numElems;
 
 			currInfo.codeStack.push_back(tableBrace);
@@ -1231,26 +1765,17 @@ void Decompiler::opSetList(int targetIndex, int numElems)
 		currInfo.codeStack.pop_back();
 	}
 
-	result.str = "{ ";
-
-	for (auto it = args.rbegin(); it != args.rend(); ++it)
-	{
-		result.str += (*it).str;
-
-		if (--args.rend() != it)
-			result.str += ", ";
-	}
-
-	result.str += " }";
+	result.expr = newTable(m_arena, nullptr, values, numElems, "", true);
 	result.type = ValueType::STRING;
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opSetMap(int numElems)
+void Decompiler::opSetMap(const Operands &args)
 {
+	int numElems = args.a;
 	StackValue identifier, mapValue, tableBrace, result;
-	std::vector<std::string> args;
+	std::vector<Expr*> items;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	// TODO: nicer name
@@ -1264,24 +1789,19 @@ void Decompiler::opSetMap(int numElems)
 		currInfo.codeStack.pop_back();
 
 		//remove quotes from identifier
+		Expr* key = identifier.expr;
 		if (identifier.type == ValueType::STRING)
-		{
-			identifier.str.erase(0, 1);
-			identifier.str.erase(identifier.str.size() - 1);
-		}
+			key = newUnquote(m_arena, key);
 		else if (identifier.type == ValueType::INT)
-		{
-			identifier.str.insert(0, "[");
-			identifier.str.insert(identifier.str.size(), "]");
-		}
+			key = newSequence(m_arena, newAtom(m_arena, "["), key, newAtom(m_arena, "]"));
 
-		args.push_back(identifier.str + " = " + mapValue.str);
+		items.push_back(newBinary(m_arena, key, " = ", mapValue.expr, false));
 	}
 
 	// pop until we find a brace
 	while (currInfo.codeStack.back().type != ValueType::TABLE_BRACE)
 	{
-		args.push_back(currInfo.codeStack.back().str);
+		items.push_back(currInfo.codeStack.back().expr);
 		currInfo.codeStack.pop_back();
 	}
 
@@ -1292,50 +1812,42 @@ void Decompiler::opSetMap(int numElems)
 	if (tableBrace.index > 0)
 		hasRemainingElems = true;
 
+	// fields were popped last to first
+	Expr** fields = m_arena.makeArray<Expr*>(items.size());
+	std::reverse_copy(items.begin(), items.end(), fields);
+
 	result.type = ValueType::STRING_GLOBAL;
-	for (int i = args.size() - 1; i >= 0; --i)
-	{
-		result.str += args[i];
-		if ((i - 1) >= 0)
-			result.str += ", ";
-	}
 
 	if (hasRemainingElems)
 	{
 		currInfo.codeStack.push_back(tableBrace);
+		result.expr = newList(m_arena, fields, static_cast<int>(items.size()), ", ");
 	}
 	else
 	{
-		result.str.insert(0, tableBrace.str);
-		result.str += " }";
+		result.expr = newTable(m_arena, tableBrace.expr, fields, static_cast<int>(items.size()), "", true);
 	}
 
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opConcat(int numElems)
+void Decompiler::opConcat(const Operands &args)
 {
+	int numElems = args.a;
 	StackValue result;
-	std::vector<StackValue> args;
-	FuncInfo &currInfo = m_funcInfos.back();
 
+	Expr** values = popArgs(numElems);
 	for (int i = 0; i < numElems; ++i)
 	{
-		args.push_back(currInfo.codeStack.back());
-		currInfo.codeStack.pop_back();
-	}
-	for (int i = numElems - 1; i >= 0; --i)
-	{
-		result.str += args[i].str;
-		if ((i - 1) >= 0)
-			result.str += "..";
+		if (isLogical(values[i]))
+			values[i] = makeParen(values[i]);
 	}
-
+	result.expr = newList(m_arena, values, numElems, "..");
 	result.type = ValueType::STRING_GLOBAL;
-	currInfo.codeStack.push_back(result);
+	m_funcInfos.back().codeStack.push_back(result);
 }
 
-void Decompiler::opAdd()
+void Decompiler::opArith(const char* op, bool paren)
 {
 	StackValue y, x, result;
 	FuncInfo &currInfo = m_funcInfos.back();
@@ -1345,13 +1857,25 @@ void Decompiler::opAdd()
 	x = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
-	result.str = x.str + " + " + y.str;
+	// and/or and comparisons bind looser than arithmetic
+	if (isLogical(x.expr))
+		x.expr = makeParen(x.expr);
+	if (isLogical(y.expr))
+		y.expr = makeParen(y.expr);
+
+	result.expr = newBinary(m_arena, x.expr, op, y.expr, paren);
 	result.type = ValueType::STRING_GLOBAL;
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opAddI(int value)
+void Decompiler::opAdd(const Operands &args)
 {
+	opArith(" + ", false);
+}
+
+void Decompiler::opAddI(const Operands &args)
+{
+	int value = args.a;
 	StackValue stackValue;
 	FuncInfo &currInfo = m_funcInfos.back();
 
@@ -1359,78 +1883,35 @@ void Decompiler::opAddI(int value)
 	StackValue newValue;
 	currInfo.codeStack.pop_back();
 
-	std::string op;
-	if (value >= 0)
-		op = " + ";
-	else
-		op = "";
+	// negative values bring their own sign
+	const char* op = (value >= 0) ? " + " : "";
 
-	newValue.str = stackValue.str + op + std::to_string(value);
+	newValue.expr = newBinary(m_arena, stackValue.expr, op, newName("", value), false);
 	newValue.type = ValueType::STRING_GLOBAL;
 	currInfo.codeStack.push_back(newValue);
 }
 
-void Decompiler::opSub()
+void Decompiler::opSub(const Operands &args)
 {
-	StackValue y, x, result;
-	FuncInfo &currInfo = m_funcInfos.back();
-
-	y = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-	x = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-
-	result.str = x.str + " - " + y.str;
-	result.type = ValueType::STRING_GLOBAL;
-	currInfo.codeStack.push_back(result);
+	opArith(" - ", false);
 }
 
-void Decompiler::opMult()
+void Decompiler::opMult(const Operands &args)
 {
-	StackValue y, x, result;
-	FuncInfo &currInfo = m_funcInfos.back();
-
-	y = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-	x = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-
-	result.str = "( " + x.str + " * " + y.str + " )";
-	result.type = ValueType::STRING_GLOBAL;
-	currInfo.codeStack.push_back(result);
+	opArith(" * ", true);
 }
 
-void Decompiler::opDiv()
+void Decompiler::opDiv(const Operands &args)
 {
-	StackValue y, x, result;
-	FuncInfo &currInfo = m_funcInfos.back();
-
-	y = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-	x = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-
-	result.str = "( " + x.str + " / " + y.str + " )";
-	result.type = ValueType::STRING_GLOBAL;
-	currInfo.codeStack.push_back(result);
+	opArith(" / ", true);
 }
 
-void Decompiler::opPow()
+void Decompiler::opPow(const Operands &args)
 {
-	StackValue y, x, result;
-	FuncInfo &currInfo = m_funcInfos.back();
-
-	y = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-	x = currInfo.codeStack.back();
-	currInfo.codeStack.pop_back();
-
-	result.str = "( " + x.str + " ^ " + y.str + " )";
-	result.type = ValueType::STRING_GLOBAL;
-	currInfo.codeStack.push_back(result);
+	opArith(" ^ ", true);
 }
 
-void Decompiler::opMinus()
+void Decompiler::opMinus(const Operands &args)
 {
 	StackValue x, result;
 	FuncInfo &currInfo = m_funcInfos.back();
@@ -1438,52 +1919,54 @@ void Decompiler::opMinus()
 	x = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
-	result.str = "-" + x.str;
+	if (isLogical(x.expr))
+		x.expr = makeParen(x.expr);
+	result.expr = newPrefix(m_arena, "-", x.expr);
 	result.type = ValueType::STRING_GLOBAL;
 	currInfo.codeStack.push_back(result);
 }
 
-void Decompiler::opNot()
+void Decompiler::opNot(const Operands &args)
 {
 	// showErrorMessage("Unimplemented opcode NOT! exiting!", true);
 	FuncInfo &currInfo = m_funcInfos.back();
-	std::string arg = "not " + currInfo.codeStack.back().str;
+	Expr* arg = makeNot(currInfo.codeStack.back().expr);
 	currInfo.codeStack.pop_back();
 
 	StackValue result;
 	result.type = ValueType::STRING_GLOBAL;
-	result.str = arg;
+	result.expr = arg;
 
 	currInfo.codeStack.push_back(result);
 }
 
-std::string Decompiler::opForPrep()
+void Decompiler::opForPrep(const Operands &args)
 {
-	StackValue val1, val2, val3;
-	std::string result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	val3 = currInfo.codeStack[currInfo.codeStack.size() - 1];
-	val2 = currInfo.codeStack[currInfo.codeStack.size() - 2];
-	val1 = currInfo.codeStack[currInfo.codeStack.size() - 3];
-
-
-
-	std::string locName = "for" + std::to_string(currInfo.nForLoops);
+	// initial value, limit and step stay on the stack
+	Expr** values = m_arena.makeArray<Expr*>(3);
+	values[2] = currInfo.codeStack[currInfo.codeStack.size() - 1].expr;
+	values[1] = currInfo.codeStack[currInfo.codeStack.size() - 2].expr;
+	values[0] = currInfo.codeStack[currInfo.codeStack.size() - 3].expr;
+
+	// the control variable is the slot under the limit and the step,
+	//  in scope from the first pc of the body
+	int slot = static_cast<int>(currInfo.codeStack.size()) - 3;
+	Expr* locName = isHiddenLocal(slot + 1, args.pc + 1, "(limit)") ? localName(slot, args.pc + 1) : nullptr;
+	if (locName == nullptr)
+		locName = newName("for", currInfo.nForLoops);
 	++currInfo.nForLoops;
 	++currInfo.nForLoopLevel;
 	int locIndex = currInfo.nLocals;
 	++currInfo.nLocals;
 	currInfo.locals.insert(std::make_pair(locIndex, locName));
-	result += "for " + locName + " = " + val1.str + ", " + val2.str + ", " +
-		val3.str + " do\n";
 
-	return result;
+	addStmt(newStmt(m_arena, Stmt::NUMERIC_FOR, values, 3, locName));
 }
 
-std::string Decompiler::opForLoop()
+void Decompiler::opForLoop(const Operands &args)
 {
-	std::string result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	// the last local should be the forloop var
@@ -1496,40 +1979,46 @@ std::string Decompiler::opForLoop()
 	currInfo.codeStack.pop_back();
 	currInfo.codeStack.pop_back();
 
-	result = "end\n";
-
-	return result;
+	addStmt(newStmt(m_arena, Stmt::END));
 }
 
-std::string Decompiler::opLForPrep()
+void Decompiler::opLForPrep(const Operands &args)
 {
 	//showErrorMessage("Unimplemented opcode LFORPREP! exiting!", true);
 	FuncInfo &currInfo = m_funcInfos.back();
 	StackValue tableName = currInfo.codeStack.back();
 	currInfo.codeStack.pop_back();
 
+	// the table keeps its slot, the index and the value are pushed above it
+	int slot = static_cast<int>(currInfo.codeStack.size());
+	bool named = isHiddenLocal(slot, args.pc + 1, "(table)");
+	Expr* indexName = named ? localName(slot + 1, args.pc + 1) : nullptr;
+	Expr* valueName = named ? localName(slot + 2, args.pc + 1) : nullptr;
+
 	StackValue invisTable, index, value;
 	invisTable.type = ValueType::STRING_LOCAL;
-	invisTable.str = "_t";
+	invisTable.expr = newAtom(m_arena, "_t");
 	index.type = ValueType::STRING_LOCAL;
-	index.str = "index";
+	index.expr = indexName != nullptr ? indexName : newAtom(m_arena, "index");
 	value.type = ValueType::STRING_LOCAL;
-	value.str = "value";
+	value.expr = valueName != nullptr ? valueName : newAtom(m_arena, "value");
 
 	currInfo.codeStack.push_back(invisTable);
 	currInfo.codeStack.push_back(index);
 	currInfo.codeStack.push_back(value);
 
-	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, "_t"));
-	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, "index"));
-	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, "value"));
+	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, invisTable.expr));
+	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, index.expr));
+	currInfo.locals.insert(std::make_pair(currInfo.nLocals++, value.expr));
 
-	return ("for index, value in " + tableName.str + " do\n");
+	Expr** names = m_arena.makeArray<Expr*>(2);
+	names[0] = index.expr;
+	names[1] = value.expr;
+	addStmt(newStmt(m_arena, Stmt::GENERIC_FOR, newList(m_arena, names, 2, ", "), tableName.expr));
 }
 
-std::string Decompiler::opLForLoop()
+void Decompiler::opLForLoop(const Operands &args)
 {
-	std::string result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
 	//showErrorMessage("Unimplemented opcode LFORLOOP! exiting!", true);
@@ -1541,104 +2030,582 @@ std::string Decompiler::opLForLoop()
 	currInfo.codeStack.pop_back();
 	currInfo.codeStack.pop_back();
 
-	result = "end\n";
-
-	return result;
+	addStmt(newStmt(m_arena, Stmt::END));
 }
 
-void Decompiler::opClosure(int closureIndex, int numUpvalues)
+void Decompiler::opClosure(const Operands &args)
 {
-	FuncInfo &currInfo = m_funcInfos.back();
-	FuncInfo funcInfo;
+	Proto* tf = m_funcInfos.back().tf->kproto[args.a];
 	StackValue stackValue;
-	std::string closureSrc;
 
-	// pop all upvalues if any are found
-	// and register them into funcInfo
-	for (int i = 0; i < numUpvalues; ++i)
-	{
-		StackValue upvalue;
-		upvalue = currInfo.codeStack.back();
-		currInfo.codeStack.pop_back();
+	// the upvalues are on top of the stack, the first one lowest
+	int numUpvalues = args.b;
+	Expr** upvalues = popArgs(numUpvalues);
 
-		currInfo.upvalues.insert(std::make_pair(numUpvalues - (i + 1), upvalue.str));
-	}
+	Function* closure;
+	if (m_closureOwner != nullptr && tf->ncode >= MIN_CLOSURE_TASK)
+		closure = startClosure(tf, upvalues, numUpvalues);
+	else
+		closure = decompileClosure(tf, upvalues, numUpvalues);
+
+	stackValue.expr = newClosure(m_arena, closure);
+	stackValue.type = ValueType::CLOSURE_STRING;
+
+	m_funcInfos.back().codeStack.push_back(stackValue);
+}
+
+Function* Decompiler::decompileClosure(Proto* tf, Expr** upvalues, int numUpvalues)
+{
+	uint64_t key = 0;
+	bool store = false;
+	bool keyed = m_memo && m_memo->functionKey(tf, false, upvalues, numUpvalues, key);
+	Function* closure;
+	if (keyed && lookupMemo(key, closure, store))
+		return closure;
+
+	size_t errorsAt = m_report.errors.size();
+	size_t numTasks = m_closureTasks != nullptr ? m_closureTasks->size() : 0;
+	bool success = m_success;
+	m_success = true;
 
-	// decompile closure
+	FuncInfo funcInfo;
 	funcInfo.isMain = false;
-	funcInfo.tf = currInfo.tf->kproto[closureIndex];
+	funcInfo.tf = tf;
+	for (int i = 0; i < numUpvalues; ++i)
+		funcInfo.upvalues.insert(std::make_pair(i, upvalues[i]));
 
 	m_funcInfos.push_back(funcInfo);
-	closureSrc = decompileFunction();
+	closure = decompileFunction();
 	m_funcInfos.pop_back();
 
-	stackValue.str = closureSrc;
-	stackValue.type = ValueType::CLOSURE_STRING;
+	// functions nested in tasks are filled in later, the tree is not complete yet
+	if (store && (m_closureTasks == nullptr || m_closureTasks->size() == numTasks))
+		storeMemo(key, closure, errorsAt, m_success);
+	m_success = success && m_success;
+	return closure;
+}
 
-	// closureSrc += "end\n";
+bool Decompiler::lookupMemo(uint64_t key, Function* &func, bool &store)
+{
+	const FunctionMemo::Entry* entry = m_memo->lookup(key, store);
+	if (entry == nullptr)
+		return false;
+
+	func = entry->func;
+	m_report.errors += entry->errors;
+	m_success = m_success && entry->success;
+	return true;
+}
 
-	m_funcInfos.back().codeStack.push_back(stackValue);
+void Decompiler::storeMemo(uint64_t key, const Function* func, size_t errorsAt, bool success)
+{
+	m_memo->store(key, func, m_report.errors.substr(errorsAt), success);
+}
+
+Function* Decompiler::startClosure(Proto* tf, Expr** upvalues, int numUpvalues)
+{
+	std::unique_ptr<ClosureTask> task(new ClosureTask());
+	task->tf = tf;
+	task->upvalues = upvalues;
+	task->numUpvalues = numUpvalues;
+	task->func = m_arena.make<Function>();
+	task->success = true;
+	task->errorsAt = m_report.errors.size();
+	task->statusAt = m_report.status.size();
+
+	ClosureTask* started = task.get();
+	m_closureTasks->push_back(std::move(task));
+
+	Decompiler* owner = m_closureOwner;
+	owner->m_closurePool->submit([owner, started]()
+	{
+		owner->m_closureWorkers[owner->m_closurePool->workerIndex()]->runClosure(*started);
+	});
+
+	return started->func;
+}
+
+void Decompiler::runClosure(ClosureTask &task)
+{
+	// closures nested in this one become tasks of their own
+	m_closureTasks = &task.children;
+	*task.func = *decompileClosure(task.tf, task.upvalues, task.numUpvalues);
+	m_closureTasks = nullptr;
+
+	task.report = std::move(m_report);
+	task.success = m_success;
+	m_report = FileReport();
+	m_success = true;
+}
+
+void Decompiler::finishClosures()
+{
+	if (m_chunkClosures.empty())
+		return;
+
+	m_closurePool->wait();
+	mergeReports(m_report, m_success, m_chunkClosures);
+	m_chunkClosures.clear();
+}
+
+void Decompiler::mergeReports(FileReport &report, bool &success, std::vector<std::unique_ptr<ClosureTask>> &tasks)
+{
+	// back to front, so the offsets of the earlier tasks stay valid
+	for (auto it = tasks.rbegin(); it != tasks.rend(); ++it)
+	{
+		ClosureTask &task = **it;
+		mergeReports(task.report, task.success, task.children);
+		report.stats.addCounts(task.report.stats);
+		report.errors.insert(task.errorsAt, task.report.errors);
+		report.status.insert(task.statusAt, task.report.status);
+		success = success && task.success;
+	}
+}
+
+template<OpCode op>
+void Decompiler::opCompareJump(const Operands &args)
+{
+	static_assert(opInfos[op].category == OpInfo::COMPARE_JUMP, "not a compare jump");
+
+	std::vector<StackValue> &codeStack = m_funcInfos.back().codeStack;
+	Expr* rhs = codeStack.back().expr;
+	codeStack.pop_back();
+	Expr* lhs = codeStack.back().expr;
+	codeStack.pop_back();
+
+	opCondJump(op, makeCompare(lhs, compareOperators[op - OP_JMPNE], rhs), args.pc, args.pc + 1 + args.a);
+}
+
+template<OpCode op>
+void Decompiler::opTestJump(const Operands &args)
+{
+	static_assert(opInfos[op].category == OpInfo::TEST_JUMP, "not a test jump");
+
+	std::vector<StackValue> &codeStack = m_funcInfos.back().codeStack;
+	Expr* cond = codeStack.back().expr;
+	codeStack.pop_back();
+
+	opCondJump(op, cond, args.pc, args.pc + 1 + args.a);
 }
 
-void Decompiler::opJmpne(int destLine, int currLine)
+void Decompiler::opCondJump(OpCode op, Expr* cond, int pc, int target)
 {
+	FuncInfo &currInfo = m_funcInfos.back();
+	const ControlStructure &structure = currInfo.structure;
+
+	CondJump jump;
+	jump.pc = pc;
+	jump.target = target;
+	jump.cond = cond;
+	jump.op = op;
+	jump.final = structure.valueFinal(pc);
+
+	// values are completed where they end, see closeValue
+	if (structure.role(pc) == ControlStructure::VALUE)
+	{
+		currInfo.valueJumps.push_back(jump);
+		return;
+	}
+
+	if (structure.role(pc) != ControlStructure::COND)
+		showErrorMessage("unstructured conditional jump at line " + std::to_string(pc + 1) + ", continuing!", false);
+
+	currInfo.condJumps.push_back(jump);
+	int numJumps = structure.numJumps(pc);
+	if (numJumps == 0)
+		return;
+
+	// the block runs when the condition holds, the last jump leaves it
+	std::vector<CondJump> &jumps = currInfo.condJumps;
+	numJumps = std::min(numJumps, static_cast<int>(jumps.size()));
+	Condition region;
+	region.jumps = jumps.data() + jumps.size() - numJumps;
+	region.numJumps = numJumps;
+	region.tail = nullptr;
+	region.value = false;
+	region.final = -1;
+	region.trueTarget = structure.resolve(pc + 1);
+	region.falseTarget = structure.resolve(target);
+	Expr* condition = buildCondition(region, 0, numJumps, TRUE_LABEL, FALSE_LABEL);
+	jumps.resize(jumps.size() - numJumps);
+
+	if (structure.isUnstructured(pc))
+		showErrorMessage("block of the condition at line " + std::to_string(pc + 1) + " is not nested properly, continuing!", false);
+
+	switch (structure.header(pc))
+	{
+	case ControlStructure::IF:
+		addStmt(newStmt(m_arena, Stmt::IF, nullptr, condition));
+		break;
+
+	case ControlStructure::ELSEIF:
+		addStmt(newStmt(m_arena, Stmt::ELSEIF, nullptr, condition));
+		break;
+
+	case ControlStructure::WHILE:
+		addStmt(newStmt(m_arena, Stmt::WHILE, nullptr, condition));
+		break;
+
+	case ControlStructure::UNTIL:
+		// the jump goes back to the loop unless the condition holds
+		addStmt(newStmt(m_arena, Stmt::UNTIL, nullptr, condition));
+		break;
+	}
 }
 
-void Decompiler::opJmpeq(int destLine, int currLine)
+void Decompiler::closeValue(int final)
 {
+	FuncInfo &currInfo = m_funcInfos.back();
+	const ControlStructure &structure = currInfo.structure;
+	std::vector<CondJump> &jumps = currInfo.valueJumps;
+	std::vector<StackValue> &codeStack = currInfo.codeStack;
+
+	size_t first = jumps.size();
+	while (first > 0 && jumps[first - 1].final == final)
+		--first;
+	int numJumps = static_cast<int>(jumps.size() - first);
+
+	// the nil and 1 pushed for comparisons
+	bool nilJump = structure.hasNilJump(final);
+	if (nilJump)
+	{
+		for (int i = 0; i < 2 && !codeStack.empty(); ++i)
+			codeStack.pop_back();
+	}
+
+	// the last operand is left on the stack unless it was a comparison
+	Expr* tail = nullptr;
+	if ((!nilJump || structure.hasSkip(final)) && !codeStack.empty())
+	{
+		tail = codeStack.back().expr;
+		codeStack.pop_back();
+	}
+
+	Condition value;
+	value.jumps = jumps.data() + first;
+	value.numJumps = numJumps;
+	value.tail = tail;
+	value.value = true;
+	value.final = final;
+	value.trueTarget = -1;
+	value.falseTarget = -1;
+
+	StackValue result;
+	int numOperands = numJumps + (tail != nullptr ? 1 : 0);
+	if (numOperands > 0)
+		result.expr = buildCondition(value, 0, numOperands, TRUE_LABEL, FALSE_LABEL);
+	else
+		result.expr = newAtom(m_arena, "nil");
+	result.type = ValueType::STRING_GLOBAL;
+	jumps.resize(first);
+	codeStack.push_back(result);
 }
 
-void Decompiler::opJmplt(int destLine, int currLine)
+int Decompiler::classify(const Condition &condition, const CondJump &jump)
 {
+	const ControlStructure &structure = m_funcInfos.back().structure;
+
+	if (!condition.value)
+	{
+		// an empty block is left either way, the compiler jumps when false
+		int target = structure.resolve(jump.target);
+		if (target == condition.falseTarget)
+			return FALSE_LABEL;
+		if (target == condition.trueTarget)
+			return TRUE_LABEL;
+		return jump.target;
+	}
+
+	// ONT/ONF land at the end with their operand, comparisons on the nil or 1
+	int final = condition.final;
+	if (jump.target == final && jump.op == OP_JMPONT)
+		return TRUE_LABEL;
+	if (jump.target == final && jump.op == OP_JMPONF)
+		return FALSE_LABEL;
+	if (structure.hasNilJump(final) && jump.target == final - 1)
+		return TRUE_LABEL;
+	if (structure.hasNilJump(final) && jump.target == final - 2)
+		return FALSE_LABEL;
+	return jump.target;
 }
 
-void Decompiler::opJmple(int destLine, int currLine)
+Expr* Decompiler::buildCondition(const Condition &condition, int first, int last, int onTrue, int onFalse)
 {
+	const CondJump* jumps = condition.jumps;
+
+	if (last - first == 1)
+	{
+		if (first == condition.numJumps)
+			return condition.tail;
+
+		// JMPF and JMPONF are taken when their operand fails
+		const CondJump &jump = jumps[first];
+		bool onFail = (jump.op == OP_JMPF || jump.op == OP_JMPONF);
+		int label = classify(condition, jump);
+		if (label == onTrue)
+			return onFail ? negate(jump.cond) : jump.cond;
+		if (label == onFalse)
+			return onFail ? jump.cond : negate(jump.cond);
+
+		showErrorMessage("conditional jump at line " + std::to_string(jump.pc + 1) + " leaves its expression, continuing!", false);
+		return jump.cond;
+	}
+
+	// the last operator splits the operands, lua groups and/or to the left.
+	//  the left side either goes to the right side or where the whole is true (or),
+	//  or to the right side or where the whole is false (and)
+	for (int k = last - 1; k > first; --k)
+	{
+		int start = jumps[k - 1].pc + 1;
+		bool toTrue = false;
+		bool toFalse = false;
+		bool valid = true;
+
+		for (int m = first; m < k && valid; ++m)
+		{
+			int label = classify(condition, jumps[m]);
+			if (label == onTrue)
+				toTrue = true;
+			else if (label == onFalse)
+				toFalse = true;
+			else if (label != start)
+			{
+				// right behind a later jump of the left side
+				const CondJump* inner = std::lower_bound(jumps + m + 1, jumps + k - 1, label - 1,
+					[](const CondJump &a, int pc) { return a.pc < pc; });
+				valid = (inner != jumps + k - 1 && inner->pc == label - 1);
+			}
+		}
+
+		if (!valid || (toTrue && toFalse))
+			continue;
+
+		Expr* rhs = buildCondition(condition, k, last, onTrue, onFalse);
+		// the constant of `c or 1` left no jump, the left side always goes on
+		if (!toTrue && !toFalse)
+			return makeAnd(makeOr(buildCondition(condition, first, k, start, onFalse), &trueValue), rhs);
+		if (toFalse)
+			return makeAnd(buildCondition(condition, first, k, start, onFalse), rhs);
+		return makeOr(buildCondition(condition, first, k, onTrue, start), rhs);
+	}
+
+	// nothing nests, the leaves report what is wrong
+	int start = jumps[last - 2].pc + 1;
+	return makeAnd(buildCondition(condition, first, last - 1, start, onFalse), buildCondition(condition, last - 1, last, onTrue, onFalse));
 }
 
-void Decompiler::opJmpgt(int destLine, int currLine)
+Expr* Decompiler::negate(Expr* expr)
 {
+	if (expr == &trueValue)
+		return &falseValue;
+	if (expr == &falseValue)
+		return &trueValue;
+
+	expr = stripParen(expr);
+	if (expr->kind == Expr::PREFIX && expr->text.str == NOT)
+	{
+		// the compiler turns the not of a test into the jump, anything else
+		//  got a NOT of its own. not not 5 also keeps the test of a constant
+		Expr* operand = stripParen(expr->lhs);
+		if (isLogical(operand))
+			return operand;
+	}
+
+	if (expr->kind == Expr::BINARY)
+	{
+		const char* op = expr->text.str;
+		if (op == AND)
+			return makeOr(negate(expr->lhs), negate(expr->rhs));
+		if (op == OR)
+			return makeAnd(negate(expr->lhs), negate(expr->rhs));
+
+		// the compiler inverts comparisons the same way
+		const char* inverse = nullptr;
+		if (op == EQ)
+			inverse = NE;
+		else if (op == NE)
+			inverse = EQ;
+		else if (op == LT)
+			inverse = GE;
+		else if (op == GE)
+			inverse = LT;
+		else if (op == LE)
+			inverse = GT;
+		else if (op == GT)
+			inverse = LE;
+
+		if (inverse != nullptr)
+			return newBinary(m_arena, expr->lhs, inverse, expr->rhs, false);
+	}
+
+	return makeNot(expr);
 }
 
-void Decompiler::opJmpge(int destLine, int currLine)
+Expr* Decompiler::makeNot(Expr* expr)
 {
+	if (expr->kind == Expr::BINARY || expr->kind == Expr::LIST)
+		expr = makeParen(expr);
+	return newPrefix(m_arena, NOT, expr);
 }
 
-void Decompiler::opJmpt(int destLine, int currLine)
+Expr* Decompiler::makeAnd(Expr* lhs, Expr* rhs)
 {
+	// and/or share a priority in lua 4 and group to the left,
+	//  the left operand is only wrapped to read the same in later versions
+	if (isBinary(lhs, OR))
+		lhs = makeParen(lhs);
+	if (isBinary(rhs, AND) || isBinary(rhs, OR))
+		rhs = makeParen(rhs);
+	return newBinary(m_arena, lhs, AND, rhs, false);
 }
 
-void Decompiler::opJmpf(int destLine, int currLine)
+Expr* Decompiler::makeOr(Expr* lhs, Expr* rhs)
 {
+	if (isBinary(rhs, AND) || isBinary(rhs, OR))
+		rhs = makeParen(rhs);
+	return newBinary(m_arena, lhs, OR, rhs, false);
 }
 
-void Decompiler::opJmpont(int destLine, int currLine)
+Expr* Decompiler::makeCompare(Expr* lhs, const char* op, Expr* rhs)
 {
+	if (isLogical(lhs))
+		lhs = makeParen(lhs);
+	if (isLogical(rhs))
+		rhs = makeParen(rhs);
+	return newBinary(m_arena, lhs, op, rhs, false);
 }
 
-void Decompiler::opJmponf(int destLine, int currLine)
+Expr* Decompiler::makeParen(Expr* expr)
 {
+	if (expr->kind == Expr::BINARY)
+	{
+		if (expr->paren)
+			return expr;
+		return newBinary(m_arena, expr->lhs, expr->text.str, expr->rhs, true);
+	}
+	return newSequence(m_arena, &openParen, expr, &closeParen);
 }
 
-void Decompiler::opJmp(int destLine)
+Expr* Decompiler::stripParen(Expr* expr)
 {
-	showErrorMessage("Unimplemented opcode JMP! continuing!", false);
-	FuncInfo &currInfo = m_funcInfos.back();
+	if (expr->kind == Expr::BINARY && expr->paren)
+		return newBinary(m_arena, expr->lhs, expr->text.str, expr->rhs, false);
+	if (expr->kind == Expr::SEQUENCE && expr->numItems == 3 && expr->items[0] == &openParen)
+		return expr->items[1];
+	return expr;
+}
 
-	if (!currInfo.context.empty() && destLine < 0)
+void Decompiler::opJmp(const Operands &args)
+{
+	switch (m_funcInfos.back().structure.role(args.pc))
 	{
-		currInfo.context.back().type = Context::WHILE;
+	case ControlStructure::ELSE:
+		addStmt(newStmt(m_arena, Stmt::ELSE));
+		break;
+
+	case ControlStructure::CONSTANT_ELSE:
+		// the statements in front of the jump make up the then block
+		addStmt(newStmt(m_arena, Stmt::IF, nullptr, newAtom(m_arena, "1")));
+		addStmt(newStmt(m_arena, Stmt::ELSE));
+		break;
+
+	case ControlStructure::LOOP_END:
+		addStmt(newStmt(m_arena, Stmt::END));
+		break;
+
+	case ControlStructure::BREAK:
+		addStmt(newStmt(m_arena, Stmt::BREAK));
+		break;
+
+	// the elseif and the value it jumps over do the rest
+	case ControlStructure::ELSE_IF:
+	case ControlStructure::VALUE_SKIP:
+		break;
+
+	default:
+		showErrorMessage("unstructured JMP at line " + std::to_string(args.pc + 1) + " to line " + std::to_string(args.pc + args.a + 2) + ", continuing!", false);
+		break;
 	}
 }
 
-void Decompiler::opPushNilJmp()
+void Decompiler::opPushNilJmp(const Operands &args)
 {
 	//showErrorMessage("Unimplemented opcode PUSHNILJMP! exiting!", true);
 	StackValue result;
 	FuncInfo &currInfo = m_funcInfos.back();
 
-	result.str = "nil";
+	result.expr = newAtom(m_arena, "nil");
 	result.type = ValueType::NIL;
 
 	currInfo.codeStack.push_back(result);
 }
+
+// in the order of lopcodes.h, like opInfos
+const Decompiler::OpHandler Decompiler::opHandlers[NUM_OPCODES] =
+{
+	&Decompiler::opEnd,
+	&Decompiler::opReturn,
+
+	&Decompiler::opCall,
+	&Decompiler::opTailCall,
+
+	&Decompiler::opPushNil,
+	&Decompiler::opPop,
+
+	&Decompiler::opPushInt,
+	&Decompiler::opPushString,
+	&Decompiler::opPushNum,
+	&Decompiler::opPushNegNum,
+
+	&Decompiler::opPushUpvalue,
+
+	&Decompiler::opGetLocal,
+	&Decompiler::opGetGlobal,
+
+	&Decompiler::opGetTable,
+	&Decompiler::opGetDotted,
+	&Decompiler::opGetIndexed,
+	&Decompiler::opPushSelf,
+
+	&Decompiler::opCreateTable,
+
+	&Decompiler::opSetLocal,
+	&Decompiler::opSetGlobal,
+	&Decompiler::opSetTable,
+
+	&Decompiler::opSetList,
+	&Decompiler::opSetMap,
+
+	&Decompiler::opAdd,
+	&Decompiler::opAddI,
+	&Decompiler::opSub,
+	&Decompiler::opMult,
+	&Decompiler::opDiv,
+	&Decompiler::opPow,
+	&Decompiler::opConcat,
+	&Decompiler::opMinus,
+	&Decompiler::opNot,
+
+	&Decompiler::opCompareJump<OP_JMPNE>,
+	&Decompiler::opCompareJump<OP_JMPEQ>,
+	&Decompiler::opCompareJump<OP_JMPLT>,
+	&Decompiler::opCompareJump<OP_JMPLE>,
+	&Decompiler::opCompareJump<OP_JMPGT>,
+	&Decompiler::opCompareJump<OP_JMPGE>,
+
+	&Decompiler::opTestJump<OP_JMPT>,
+	&Decompiler::opTestJump<OP_JMPF>,
+	&Decompiler::opTestJump<OP_JMPONT>,
+	&Decompiler::opTestJump<OP_JMPONF>,
+	&Decompiler::opJmp,
+
+	&Decompiler::opPushNilJmp,
+
+	&Decompiler::opForPrep,
+	&Decompiler::opForLoop,
+
+	&Decompiler::opLForPrep,
+	&Decompiler::opLForLoop,
+
+	&Decompiler::opClosure
+};
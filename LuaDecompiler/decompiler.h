@@ -1,54 +1,163 @@
 #pragma once
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include "formatter.h"
+#include "ir.h"
 #include "llimits.h"
+#include "localnames.h"
+#include "lopcodes.h"
+#include "lundump.h"
+#include "opcodes.h"
+#include "stats.h"
+#include "structure.h"
+#include "ziparchive.h"
 
 struct Proto;
+struct Loader;
+class FunctionMemo;
+class OutputWriter;
+class ResultCache;
+class ThreadPool;
+class Verifier;
 
 
 class Decompiler
 {
 public:
 	Decompiler();
+	~Decompiler();
+
+	// prevent copying, the loader state is owned
+	Decompiler(Decompiler const&) = delete;
+	void operator=(Decompiler const&) = delete;
+
 	void processPath(std::string path);
+	// decompiles the folder like processPath, then keeps its output in sync
+	//  with it. changed and new files are decompiled again as soon as they
+	//  are saved, the sources of removed ones are removed. only returns if
+	//  the folder can not be watched
+	void watchPath(std::string path);
+	// keeps a pool of decompilers warm and answers the requests of the
+	//  clients connecting to the unix socket at socketPath, see the README
+	//  for the frames they send. only returns if the socket fails
+	void serve(const std::string &socketPath);
+
+	// decompiles a single chunk and returns the formatted source,
+	//  empty if the file is not a compiled lua file
+	std::string decompileChunk(const std::string &inputPath);
+	// same for a chunk already in memory, nothing is read from or written to disk.
+	// data has to stay valid until this returns, name is used in the messages.
+	// a truncated or damaged chunk fails with a message instead of being loaded
+	std::string decompileBuffer(const char* data, size_t size, const std::string &name);
+	// where the functions of a chunk in memory are stored, main first and every
+	//  function before the ones nested in it. found without loading the chunk,
+	//  empty if it is no chunk or malformed
+	static std::vector<FuncSpan> indexChunk(const char* data, size_t size);
+	// decompileBuffer for one function of the chunk and the ones nested in it,
+	//  nothing else is loaded. the upvalues of a nested function are named
+	//  upvalue1, upvalue2 and so on, and its source is not verified
+	std::string decompileSpan(const char* data, size_t size, const FuncSpan &span, const std::string &name);
+	// counters of the last chunk, the phases are timed with stats enabled
+	const FileStats& chunkStats() const;
+	// messages of the last chunk, the way they would have been printed
+	const std::string& chunkMessages() const;
+	// false if the last chunk was not a compiled lua file or had errors
+	bool chunkSucceeded() const;
+
+	// number of worker threads used for directories and for the
+	//  nested functions of a single file, 0 picks the number of hardware threads
+	void setJobs(unsigned int jobs);
+
+	// format the output by running it through the lexer
+	//  based formatter instead of laying it out while writing
+	void setReformat(bool reformat);
+
+	// compile every decompiled source back and report the functions
+	//  whose code differs from the original chunk
+	void setVerify(bool verify);
+
+	// keep the decompiled sources in directory between runs and serve
+	//  unchanged files from there, without loading or decompiling them
+	void setCache(const std::string &directory);
+	// the least recently used sources go once the cache takes more than this
+	void setCacheSize(uint64_t maxBytes);
+
+	// decompile the functions found in several files of a run only once,
+	//  the ones met again are taken from a memo keyed by their contents
+	void setDedup(bool dedup);
+
+	// time the phases of every file and count what went through them,
+	//  parallel runs also print how full the queues between their stages were
+	void setStats(bool stats);
+	// also write the stats of every file, json if path ends in .json and csv otherwise
+	void setStatsFile(const std::string &path);
+	// summary of the files processed so far if stats are enabled,
+	//  and the hits and misses of the cache and the memo if there are any
+	void printStats();
 
 private:
 	enum ValueType { NONE, INT, STRING, STRING_PUSHSELF, STRING_GLOBAL, STRING_LOCAL, NIL, CLOSURE_STRING, TABLE_BRACE };
 
-	Formatter& m_format;
+	Formatter m_format;
+	// binary chunk loader, reused for every file
+	Loader* m_loader;
 	bool m_success;
+	unsigned int m_jobs;
+	bool m_reformat;
+	// null unless the sources are verified
+	std::unique_ptr<Verifier> m_verifier;
+	// shared with the pipeline's workers, null without --cache
+	std::shared_ptr<ResultCache> m_cache;
+	uint64_t m_cacheMaxBytes;
+	// shared with the pipeline's and the closure pool's workers, null without --dedup
+	std::shared_ptr<FunctionMemo> m_memo;
+	bool m_stats;
+	StatsTable m_statsTable;
+	FileStats m_chunkStats;
+	std::string m_chunkMessages;
+	bool m_chunkSucceeded;
+	std::string m_statsPath;
+	// files on disk whose header was checked before loading them, and the ones
+	//  left out because it was no chunk's
+	size_t m_filesAccepted;
+	size_t m_filesSkipped;
 
-	struct StackValue
+	// messages produced while decompiling a single file.
+	// they are buffered so that parallel runs can print them in traversal order
+	struct FileReport
 	{
-		std::string str;
-		unsigned int index;
-		int type;
+		std::string status;
+		std::string errors;
+		FileStats stats;
 	};
 
-	struct CondElem
+	FileReport m_report;
+
+	// nodes of the chunk being decompiled, rewound after every file
+	Arena m_arena;
+	// source text of the chunk before formatting, reused between files
+	std::string m_source;
+
+	struct StackValue
 	{
-		enum CondType
-		{
-			OR, AND, NONE
-		};
-		std::vector<std::string> args;
-		int jmpType;
-		int lineNum;
-		int dest;
-		CondType nextCond;
+		Expr* expr;
+		unsigned int index;
+		int type;
 	};
 
-	struct Context
+	// a conditional jump waiting for the rest of its condition.
+	// cond is the comparison or the operand tested, JMPF and JMPONF
+	//  jump when it fails. the operand of ONT/ONF jumps is kept
+	struct CondJump
 	{
-		enum ContextType
-		{
-			IF, WHILE
-		};
-		int dest;
-		int strIndex;
-		std::vector<CondElem> conds;
-		ContextType type;
+		int pc;
+		int target;
+		Expr* cond;
+		OpCode op;
+		int final;
 	};
 
 	struct FuncInfo
@@ -59,87 +168,232 @@ private:
 		int nForLoops;
 		int nForLoopLevel;
 		bool isMain;
-		std::unordered_map<int, std::string> locals;
-		std::unordered_map<int, std::string> upvalues;
+		std::unordered_map<int, Expr*> locals;
+		std::unordered_map<int, Expr*> upvalues;
 		std::vector<StackValue> codeStack;
-		std::vector<Context> context;
+		std::vector<Stmt*> stmts;
+		ControlStructure structure;
+		LocalNames localNames;
+		// atoms of the named locals by their index in locvars, made once
+		std::vector<Expr*> localAtoms;
+		// jumps of the conditions and values not complete yet
+		std::vector<CondJump> condJumps;
+		std::vector<CondJump> valueJumps;
 		Proto* tf;
 	};
 
 	std::vector<FuncInfo> m_funcInfos;
 
+	// a nested function decompiled on the closure pool.
+	// the closure expression points at func, which is filled in once the
+	//  task is done. its messages go where they would have been written
+	//  if the function had been decompiled in place
+	struct ClosureTask
+	{
+		Proto* tf;
+		Expr** upvalues;
+		int numUpvalues;
+		Function* func;
+		FileReport report;
+		bool success;
+		// offsets into the report of the function holding the CLOSURE
+		size_t errorsAt;
+		size_t statusAt;
+		// tasks started by this function, in the order of their CLOSURE
+		std::vector<std::unique_ptr<ClosureTask>> children;
+	};
+
+	// the decompiler owning the closure pool, null when nested
+	//  functions are decompiled in place
+	Decompiler* m_closureOwner;
+	// tasks started by the function being decompiled
+	std::vector<std::unique_ptr<ClosureTask>>* m_closureTasks;
+	std::vector<std::unique_ptr<ClosureTask>> m_chunkClosures;
+	// every thread of the pool owns a decompiler with its own arena,
+	//  the arenas are rewound after the chunk is written
+	std::vector<std::unique_ptr<Decompiler>> m_closureWorkers;
+	std::unique_ptr<ThreadPool> m_closurePool;
+
 	Proto* loadLuaStructure(const char* fileName);
-	// returns end offs
-	std::string evalCondition(CondElem currentCond);
-	int invertCond(int cnd);
 	std::string decompileFile(const char* fileName);
-	std::string decompileFunction();
+	// source of a loaded chunk, reformatted if asked to
+	std::string decompileLoaded(Proto* tf, const char* fileName, bool isMain);
+	// keeps the outcome of a chunk for chunkStats and chunkMessages
+	std::string finishChunk(std::string sourceStr);
+	// source of a loaded chunk, laid out unless it is reformatted.
+	//  tf is decompiled as a nested function unless isMain is set
+	std::string decompileProto(Proto* tf, const char* fileName, bool isMain);
+	FileReport processFile(const std::string &inputPath, const std::string &outputPath, OutputWriter &writer);
+	// reads only the header of the file, false with the reason in the report if
+	//  it is no compiled lua file. keeps loading textures and sounds out of the way
+	bool acceptFile(const std::string &inputPath);
+	void reportNotChunk(const char* fileName);
+	// processFile for a changed file, removing its source if it is none anymore
+	void syncFile(const std::string &inputPath, const std::string &outputPath, OutputWriter &writer);
+	// removes what is below outputPath without a counterpart below inputPath
+	void removeStale(const std::string &inputPath, const std::string &outputPath);
+	// decompileFile going through the cache
+	std::string decompileCached(const std::string &inputPath);
+	// source of a chunk held in memory, going through the cache if there is one
+	std::string decompileImage(const std::string &image, const std::string &name);
+	// decompiles the chunk or the file a --serve request names, request is
+	//  taken apart on the way
+	void answerRequest(std::string &request, std::string &answer);
+	// the options the output depends on, part of every cache key
+	std::string cacheSettings() const;
+	// takes the source and the report from the cache if the key is there
+	bool lookupCached(uint64_t key, std::string &sourceStr);
+	// adds the outcome of a decompiled file to the report
+	void reportDecompiled(const std::string &inputPath);
+	// hands over the report of the file and gets ready for the next one
+	FileReport takeReport();
+	void processDirectory(const std::string &pathStr, const std::string &rootOutputStr);
+	// decompiles the entries of a zip archive into a folder, without extracting them
+	void processArchive(const std::string &pathStr, const std::string &rootOutputStr);
+	// the contents of an entry, false with the reason in the report if it can not be used
+	bool readEntry(const ZipArchive &archive, const ZipArchive::Entry &entry, std::string &image);
+	// reads, decompiles, formats and writes the files in stages running
+	//  side by side, connected by bounded queues. the files are the
+	//  entries of archive unless it is null
+	void processDirectoryParallel(const std::string &pathStr, const std::string &rootOutputStr, const ZipArchive* archive);
+	// prints the messages of a file and adds up its stats
+	void printReport(const FileReport &report);
+	Function* decompileFunction();
+	Function* decompileClosure(Proto* tf, Expr** upvalues, int numUpvalues);
+	// takes the function from the memo and repeats its messages,
+	//  store tells if it should be kept once it is decompiled
+	bool lookupMemo(uint64_t key, Function* &func, bool &store);
+	// keeps a function whose nested functions are all complete,
+	//  with the messages written since errorsAt
+	void storeMemo(uint64_t key, const Function* func, size_t errorsAt, bool success);
+	Function* startClosure(Proto* tf, Expr** upvalues, int numUpvalues);
+	void runClosure(ClosureTask &task);
+	// waits for the closure tasks of the chunk and collects their messages
+	void finishClosures();
+	static void mergeReports(FileReport &report, bool &success, std::vector<std::unique_ptr<ClosureTask>> &tasks);
+	void addStmt(Stmt* stmt);
+	Expr* newNumber(double num, bool negative);
+	// prefix followed by num, an empty prefix gives integer constants
+	Expr* newName(const char* prefix, int num);
+	// name of the local in slot at pc from the debug info, null if the
+	//  chunk is stripped
+	Expr* localName(int slot, int pc);
+	// points the local in slot at its name at pc, for code using it
+	//  before the decompiler has seen it declared
+	void updateLocal(int slot, int pc);
+	// the local in slot at pc is the one the compiler named name, it
+	//  tells where the locals of a for loop are
+	bool isHiddenLocal(int slot, int pc, const char* name) const;
+	Expr** popArgs(int numArgs);
 	std::string formatCode(std::string &funcStr);
-	void saveFile(const std::string &src, const std::string &path);
+	// reports the files that could not be written and the time spent saving
+	void finishOutput(OutputWriter &writer);
 	void showErrorMessage(std::string, bool exitError);
 
+	// the jumps of a condition or a value, the value may end with an operand
+	struct Condition
+	{
+		const CondJump* jumps;
+		int numJumps;
+		Expr* tail;
+		bool value;
+		int final;
+		// resolved targets of the statement's block and of the code after it
+		int trueTarget;
+		int falseTarget;
+	};
+
+	// where a jump goes, a pc inside the condition or one of these
+	static const int TRUE_LABEL = -1;
+	static const int FALSE_LABEL = -2;
+
+	int classify(const Condition &condition, const CondJump &jump);
+	// the condition of operands [first, last) is rebuilt as a tree of and/or,
+	//  the tail is the operand behind the last jump
+	Expr* buildCondition(const Condition &condition, int first, int last, int onTrue, int onFalse);
+	Expr* negate(Expr* expr);
+	Expr* makeNot(Expr* expr);
+	Expr* makeAnd(Expr* lhs, Expr* rhs);
+	Expr* makeOr(Expr* lhs, Expr* rhs);
+	Expr* makeCompare(Expr* lhs, const char* op, Expr* rhs);
+	Expr* makeParen(Expr* expr);
+	Expr* stripParen(Expr* expr);
+	void opCondJump(OpCode op, Expr* cond, int pc, int target);
+	// leaves the value of an and/or ending at final on the stack
+	void closeValue(int final);
+
 	// Opcodes
 
-	void opEnd();
-
-	std::string opReturn(int returnBase);
-	std::string opCall(int callBase, int numResults, bool isTailCall);
-	std::string opTailCall(int callBase, int numResults);
-
-	void opPushNil(int numNil);
-	void opPop(int numPop);
-	void opPushInt(int num);
-	void opPushString(std::string str);
-	void opPushNum(std::string numStr);
-	void opPushNegNum(std::string numStr);
-	void opPushUpvalue(int upvalueIndex);
-
-	std::string opGetLocal(int localIndex);
-	void opGetGlobal(int globalIndex);
-	void opGetTable();
-	void opGetDotted(int stringIndex);
-	void opGetIndexed(int localIndex);
-
-	void opPushSelf(int stringIndex);
-	void opCreateTable(int numElems);
-
-	std::string opSetLocal(int localIndex);
-	std::string opSetGlobal(int globalIndex);
-	std::string opSetTable(int targetIndex, int numElems);
-	void opSetList(int targetIndex, int numElems);
-	void opSetMap(int numElems);
-
-	void opConcat(int numElems);
-
-	void opAdd();
-	void opAddI(int value);
-	void opSub();
-	void opMult();
-	void opDiv();
-	void opPow();
-	void opMinus();
-	void opNot();
-
-	std::string opForPrep();
-	std::string opForLoop();
-	std::string opLForPrep();
-	std::string opLForLoop();
-
-	void opClosure(int closureIndex, int numUpvalues);
-
-	void opJmpne(int destLine, int currLine);
-	void opJmpeq(int destLine, int currLine);
-	void opJmplt(int destLine, int currLine);
-	void opJmple(int destLine, int currLine);
-	void opJmpgt(int destLine, int currLine);
-	void opJmpge(int destLine, int currLine);
-	void opJmpt(int destLine, int currLine);
-	void opJmpf(int destLine, int currLine);
-	void opJmpont(int destLine, int currLine);
-	void opJmponf(int destLine, int currLine);
-	void opJmp(int destLine);
-
-	void opPushNilJmp();
+	// operands of an instruction decoded by the format of its opcode,
+	//  U, S and A end up in a and B in b
+	struct Operands
+	{
+		int pc;
+		int a;
+		int b;
+	};
+
+	typedef void (Decompiler::*OpHandler)(const Operands &args);
+
+	// indexed by OpCode like opInfos
+	static const OpHandler opHandlers[NUM_OPCODES];
+
+	void opEnd(const Operands &args);
+
+	void opReturn(const Operands &args);
+	void opCall(const Operands &args);
+	void opTailCall(const Operands &args);
+	Stmt* makeCall(int callBase, int numResults, bool isTailCall);
+
+	void opPushNil(const Operands &args);
+	void opPop(const Operands &args);
+	void opPushInt(const Operands &args);
+	void opPushString(const Operands &args);
+	void opPushNum(const Operands &args);
+	void opPushNegNum(const Operands &args);
+	void opPushUpvalue(const Operands &args);
+
+	void opGetLocal(const Operands &args);
+	void opGetGlobal(const Operands &args);
+	void opGetTable(const Operands &args);
+	void opGetDotted(const Operands &args);
+	void opGetIndexed(const Operands &args);
+
+	void opPushSelf(const Operands &args);
+	void opCreateTable(const Operands &args);
+
+	void opSetLocal(const Operands &args);
+	void opSetGlobal(const Operands &args);
+	void opSetTable(const Operands &args);
+	void opSetList(const Operands &args);
+	void opSetMap(const Operands &args);
+
+	void opConcat(const Operands &args);
+
+	void opArith(const char* op, bool paren);
+	void opAdd(const Operands &args);
+	void opAddI(const Operands &args);
+	void opSub(const Operands &args);
+	void opMult(const Operands &args);
+	void opDiv(const Operands &args);
+	void opPow(const Operands &args);
+	void opMinus(const Operands &args);
+	void opNot(const Operands &args);
+
+	void opForPrep(const Operands &args);
+	void opForLoop(const Operands &args);
+	void opLForPrep(const Operands &args);
+	void opLForLoop(const Operands &args);
+
+	void opClosure(const Operands &args);
+
+	// JMPNE to JMPGE, the operator is picked by op
+	template<OpCode op> void opCompareJump(const Operands &args);
+	// JMPT, JMPF, JMPONT and JMPONF
+	template<OpCode op> void opTestJump(const Operands &args);
+	void opJmp(const Operands &args);
+
+	void opPushNilJmp(const Operands &args);
 
 
 };
\ No newline at end of file
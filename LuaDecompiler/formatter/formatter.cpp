@@ -5,12 +5,6 @@ Formatter::Formatter()
 	: m_indent(0), m_tableDepth(0), m_outputParan(false), m_withinTable(false)
 {}
 
-Formatter & Formatter::getInstance()
-{
-	static Formatter instance;				 
-	return instance;
-}
-
 void Formatter::reset()
 {
 	m_indent = 0;
@@ -81,7 +75,10 @@ void Formatter::increaseIndent()
 
 void Formatter::decreaseIndent()
 {
-	--m_indent;
+	// while and repeat blocks have no rule opening them in the lexer,
+	//  their ends must not push the indent below zero
+	if (m_indent > 0)
+		--m_indent;
 	m_currIndent = "";
 	m_currIndent.insert(0, m_indent, '\t');
 }
@@ -1,11 +1,12 @@
 #pragma once
 #include <string>
 
+// every decompiler owns its formatter,
+//  the lexer writes the scanned code into it
 class Formatter
 {
 public:
-	// singleton accessor
-	static Formatter& getInstance();
+	Formatter();
 
 	// prevent copying
 	Formatter(Formatter const&) = delete;
@@ -48,9 +49,6 @@ public:
 	std::string& getFormattedStr();
 
 private:
-	// prevent outside instantiation
-	Formatter();
-
 	bool outputParan();
 
 	void increaseIndent();
@@ -22,6 +22,16 @@
 #define INITIAL (0)
 #define YY_NUM_RULES (22)
 
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  SECTION 1: %top{ user code %}                                             //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#line 1 "lua_format.l"
+
+    #include <formatter.h>
+
 ////////////////////////////////////////////////////////////////////////////////
 //                                                                            //
 //  REGEX MATCHER                                                             //
@@ -46,6 +56,19 @@ typedef reflex::FlexLexer<reflex::Matcher> FlexLexer;
 ////////////////////////////////////////////////////////////////////////////////
 
 class yyFlexLexer : public FlexLexer {
+#line 5 "lua_format.l"
+
+ public:
+  // every scanned token is handed to this formatter
+  yyFlexLexer(Formatter& format, const reflex::Input& input, std::ostream *os = NULL)
+    :
+      FlexLexer(input, os),
+      m_format(&format)
+  {
+  }
+ private:
+  Formatter* m_format;
+
  public:
   yyFlexLexer(
       const reflex::Input& input = reflex::Input(),
@@ -53,6 +76,10 @@ class yyFlexLexer : public FlexLexer {
     :
       FlexLexer(input, os)
   {
+#line 19 "lua_format.l"
+
+  m_format = NULL;
+
   }
   virtual int yylex();
   int yylex(
@@ -66,21 +93,6 @@ class yyFlexLexer : public FlexLexer {
   }
 };
 
-////////////////////////////////////////////////////////////////////////////////
-//                                                                            //
-//  SECTION 1: %{ user code %}                                                //
-//                                                                            //
-////////////////////////////////////////////////////////////////////////////////
-
-#line 1 "lua_format.l"
-
-
-    #include <formatter.h>
-
-	Formatter& format = Formatter::getInstance();
-
-
-
 ////////////////////////////////////////////////////////////////////////////////
 //                                                                            //
 //  SECTION 2: rules                                                          //
@@ -111,47 +123,47 @@ int yyFlexLexer::yylex()
               output(matcher().input());
             }
             YY_BREAK
-          case 1: // rule at line 7: (?:(?:\Q--\E).*)
+          case 1: // rule at line 23: (?:(?:\Q--\E).*)
             YY_USER_ACTION
-#line 7 "lua_format.l"
+#line 23 "lua_format.l"
 {
 
-    format.comment(std::string(yytext), false);
+    m_format->comment(std::string(yytext), false);
 
 }
 
 
             YY_BREAK
-          case 2: // rule at line 11: (?:[\x5b][\x5b][^\x5d]*[\x5d]+)
+          case 2: // rule at line 27: (?:[\x5b][\x5b][^\x5d]*[\x5d]+)
             YY_USER_ACTION
-#line 11 "lua_format.l"
+#line 27 "lua_format.l"
 {
 
 	// TODO: handle nested [[ [[ ]] ]]
 
-    format.comment(std::string(yytext), true);
+    m_format->comment(std::string(yytext), true);
 
 }
 
 
             YY_BREAK
-          case 3: // rule at line 16: (?:"(?:\\.|[^"\x5c])*")
+          case 3: // rule at line 32: (?:"(?:\\.|[^"\x5c])*")
             YY_USER_ACTION
-#line 16 "lua_format.l"
+#line 32 "lua_format.l"
 {
 
-    format.string(std::string(yytext));
+    m_format->string(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 4: // rule at line 20: (?:\Q;\E)
+          case 4: // rule at line 36: (?:\Q;\E)
             YY_USER_ACTION
-#line 20 "lua_format.l"
+#line 36 "lua_format.l"
 {
 
-    format.semicolon(std::string(yytext));
+    m_format->semicolon(std::string(yytext));
 
     unput('\n');
 
@@ -159,42 +171,42 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 5: // rule at line 25: (?:(?:\Q})\E)[\x29]+[,][\x20])
+          case 5: // rule at line 41: (?:(?:\Q})\E)[\x29]+[,][\x20])
             YY_USER_ACTION
-#line 25 "lua_format.l"
+#line 41 "lua_format.l"
 {
 
-    format.tableEnd(std::string(yytext));
+    m_format->tableEnd(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 6: // rule at line 29: (?:(?:\Q})\E)[\x29]+[,])
+          case 6: // rule at line 45: (?:(?:\Q})\E)[\x29]+[,])
             YY_USER_ACTION
-#line 29 "lua_format.l"
+#line 45 "lua_format.l"
 {
 
-    format.tableEnd(std::string(yytext));
+    m_format->tableEnd(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 7: // rule at line 33: (?:(?:\Q})\E)[\x29]+)
+          case 7: // rule at line 49: (?:(?:\Q})\E)[\x29]+)
             YY_USER_ACTION
-#line 33 "lua_format.l"
+#line 49 "lua_format.l"
 {
 
-    format.tableEnd(std::string(yytext));
+    m_format->tableEnd(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 8: // rule at line 37: (?:\Q({\E)
+          case 8: // rule at line 53: (?:\Q({\E)
             YY_USER_ACTION
-#line 37 "lua_format.l"
+#line 53 "lua_format.l"
 {
 
     unput('{');
@@ -203,9 +215,9 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 9: // rule at line 41: (?:\Q{ \E)
+          case 9: // rule at line 57: (?:\Q{ \E)
             YY_USER_ACTION
-#line 41 "lua_format.l"
+#line 57 "lua_format.l"
 {
 
     unput('{');
@@ -214,12 +226,12 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 10: // rule at line 45: (?:\Q{\E)
+          case 10: // rule at line 61: (?:\Q{\E)
             YY_USER_ACTION
-#line 45 "lua_format.l"
+#line 61 "lua_format.l"
 {
 
-    format.tableStart(std::string(yytext));
+    m_format->tableStart(std::string(yytext));
 
     unput('\n');
 
@@ -227,9 +239,9 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 11: // rule at line 50: (?:\Q})\E)
+          case 11: // rule at line 66: (?:\Q})\E)
             YY_USER_ACTION
-#line 50 "lua_format.l"
+#line 66 "lua_format.l"
 {
 
     unput('}');
@@ -238,9 +250,9 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 12: // rule at line 54: (?:\Q}, \E)
+          case 12: // rule at line 70: (?:\Q}, \E)
             YY_USER_ACTION
-#line 54 "lua_format.l"
+#line 70 "lua_format.l"
 {
 
     unput(',');
@@ -251,12 +263,12 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 13: // rule at line 59: (?:\Q},\E)
+          case 13: // rule at line 75: (?:\Q},\E)
             YY_USER_ACTION
-#line 59 "lua_format.l"
+#line 75 "lua_format.l"
 {
 
-    format.tableEnd(std::string(yytext));
+    m_format->tableEnd(std::string(yytext));
 
     unput('\n');
 
@@ -264,23 +276,23 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 14: // rule at line 64: (?:\Q}\E)
+          case 14: // rule at line 80: (?:\Q}\E)
             YY_USER_ACTION
-#line 64 "lua_format.l"
+#line 80 "lua_format.l"
 {
 
-    format.tableEnd(std::string(yytext));
+    m_format->tableEnd(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 15: // rule at line 68: (?:\Q, \E)
+          case 15: // rule at line 84: (?:\Q, \E)
             YY_USER_ACTION
-#line 68 "lua_format.l"
+#line 84 "lua_format.l"
 {
 
-    if (format.isWithinTable())
+    if (m_format->isWithinTable())
 
     {
 
@@ -290,20 +302,20 @@ int yyFlexLexer::yylex()
 
     else
 
-        format.comma(std::string(yytext));
+        m_format->comma(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 16: // rule at line 77: (?:\Q,\E)
+          case 16: // rule at line 93: (?:\Q,\E)
             YY_USER_ACTION
-#line 77 "lua_format.l"
+#line 93 "lua_format.l"
 {
 
-	format.comma(std::string(yytext));
+	m_format->comma(std::string(yytext));
 
-    if (format.isWithinTable())
+    if (m_format->isWithinTable())
 
     {
 
@@ -315,67 +327,67 @@ int yyFlexLexer::yylex()
 
 
             YY_BREAK
-          case 17: // rule at line 85: ^(?:function.*)
+          case 17: // rule at line 101: ^(?:function.*)
             YY_USER_ACTION
-#line 85 "lua_format.l"
+#line 101 "lua_format.l"
 {
 
-    format.functionStart(std::string(yytext));
+    m_format->functionStart(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 18: // rule at line 89: ^(?:if.*(?:then))
+          case 18: // rule at line 105: ^(?:if.*(?:then))
             YY_USER_ACTION
-#line 89 "lua_format.l"
+#line 105 "lua_format.l"
 {
 
-    format.conditionStart(std::string(yytext));
+    m_format->conditionStart(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 19: // rule at line 93: ^(?:for.*(?:do))
+          case 19: // rule at line 109: ^(?:for.*(?:do))
             YY_USER_ACTION
-#line 93 "lua_format.l"
+#line 109 "lua_format.l"
 {
 
-	format.forLoopStart(std::string(yytext));
+	m_format->forLoopStart(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 20: // rule at line 97: ^(?:end.*)
+          case 20: // rule at line 113: ^(?:end.*)
             YY_USER_ACTION
-#line 97 "lua_format.l"
+#line 113 "lua_format.l"
 {
 
-    format.blockEnd(std::string(yytext));
+    m_format->blockEnd(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 21: // rule at line 101: (?:\n)
+          case 21: // rule at line 117: (?:\n)
             YY_USER_ACTION
-#line 101 "lua_format.l"
+#line 117 "lua_format.l"
 {
 
-    format.newLine(std::string(yytext));
+    m_format->newLine(std::string(yytext));
 
 }
 
 
             YY_BREAK
-          case 22: // rule at line 105: .
+          case 22: // rule at line 121: .
             YY_USER_ACTION
-#line 105 "lua_format.l"
+#line 121 "lua_format.l"
 {
 
-    format.anyChar(std::string(yytext));
+    m_format->anyChar(std::string(yytext));
 
 }
             YY_BREAK
@@ -18,6 +18,16 @@
 #define REFLEX_OPTION_outfile             lex.yy.cpp
 #define REFLEX_OPTION_prefix              yy
 
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  SECTION 1: %top{ user code %}                                             //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#line 1 "lua_format.l"
+
+    #include <formatter.h>
+
 ////////////////////////////////////////////////////////////////////////////////
 //                                                                            //
 //  REGEX MATCHER                                                             //
@@ -42,6 +52,19 @@ typedef reflex::FlexLexer<reflex::Matcher> FlexLexer;
 ////////////////////////////////////////////////////////////////////////////////
 
 class yyFlexLexer : public FlexLexer {
+#line 5 "lua_format.l"
+
+ public:
+  // every scanned token is handed to this formatter
+  yyFlexLexer(Formatter& format, const reflex::Input& input, std::ostream *os = NULL)
+    :
+      FlexLexer(input, os),
+      m_format(&format)
+  {
+  }
+ private:
+  Formatter* m_format;
+
  public:
   yyFlexLexer(
       const reflex::Input& input = reflex::Input(),
@@ -49,6 +72,10 @@ class yyFlexLexer : public FlexLexer {
     :
       FlexLexer(input, os)
   {
+#line 19 "lua_format.l"
+
+  m_format = NULL;
+
   }
   virtual int yylex();
   int yylex(
@@ -0,0 +1,219 @@
+#include "functionmemo.h"
+#include <unordered_map>
+#include "hash.h"
+#include "luac\luac.h"
+
+namespace
+{
+	template <typename T>
+	uint64_t hashValue(const T &value, uint64_t seed)
+	{
+		return hashBytes(&value, sizeof(value), seed);
+	}
+
+	// everything the decompiled text depends on, line numbers are not used
+	uint64_t hashProto(const Proto* tf, uint64_t seed)
+	{
+		seed = hashValue(tf->numparams, seed);
+		seed = hashValue(tf->is_vararg, seed);
+		seed = hashValue(tf->ncode, seed);
+		seed = hashBytes(tf->code, tf->ncode * sizeof(Instruction), seed);
+		seed = hashValue(tf->nknum, seed);
+		seed = hashBytes(tf->knum, tf->nknum * sizeof(Number), seed);
+
+		seed = hashValue(tf->nkstr, seed);
+		for (int i = 0; i < tf->nkstr; ++i)
+		{
+			const TString* ts = tf->kstr[i];
+			seed = hashValue(ts->len, seed);
+			seed = hashBytes(ts->str, ts->len, seed);
+		}
+
+		// locals are named from their debug info
+		seed = hashValue(tf->nlocvars, seed);
+		for (int i = 0; i < tf->nlocvars; ++i)
+		{
+			const LocVar &var = tf->locvars[i];
+			seed = hashValue(var.startpc, seed);
+			seed = hashValue(var.endpc, seed);
+			seed = hashBytes(var.varname->str, var.varname->len, seed);
+		}
+
+		seed = hashValue(tf->nkproto, seed);
+		for (int i = 0; i < tf->nkproto; ++i)
+			seed = hashProto(tf->kproto[i], seed);
+		return seed;
+	}
+
+	// upvalues are names of the enclosing function, a closure is never keyed
+	bool hashExpr(const Expr* expr, uint64_t &seed)
+	{
+		int kind = expr != nullptr ? expr->kind : -1;
+		seed = hashValue(kind, seed);
+		if (expr == nullptr)
+			return true;
+		if (expr->kind == Expr::FUNCTION)
+			return false;
+
+		bool flags[] = { expr->paren, expr->longString, expr->closed };
+		seed = hashBytes(flags, sizeof(flags), seed);
+		seed = hashValue(expr->text.len, seed);
+		if (expr->text.str != nullptr)
+			seed = hashBytes(expr->text.str, expr->text.len, seed);
+
+		if (!hashExpr(expr->lhs, seed) || !hashExpr(expr->rhs, seed))
+			return false;
+		seed = hashValue(expr->numItems, seed);
+		for (int i = 0; i < expr->numItems; ++i)
+		{
+			if (!hashExpr(expr->items[i], seed))
+				return false;
+		}
+		return true;
+	}
+
+	// copies a tree into an arena of the memo, along with its strings.
+	// the constants and the arena of the chunk go away after it is written.
+	// nodes reached twice, like a closure assigned to a name, are copied once
+	class TreeCopier
+	{
+	public:
+		explicit TreeCopier(Arena &arena)
+			: m_arena(arena)
+		{}
+
+		Function* copy(const Function* func)
+		{
+			Function* result = m_arena.make<Function>();
+			*result = *func;
+			result->params = copy(func->params, func->numParams);
+			result->body = m_arena.makeArray<Stmt*>(func->numStmts);
+			for (int i = 0; i < func->numStmts; ++i)
+				result->body[i] = copy(func->body[i]);
+			return result;
+		}
+
+	private:
+		Stmt* copy(const Stmt* stmt)
+		{
+			Stmt* result = m_arena.make<Stmt>();
+			*result = *stmt;
+			result->target = copy(stmt->target);
+			result->expr = copy(stmt->expr);
+			result->items = copy(stmt->items, stmt->numItems);
+			return result;
+		}
+
+		Expr* copy(const Expr* expr)
+		{
+			if (expr == nullptr)
+				return nullptr;
+
+			auto copied = m_copies.find(expr);
+			if (copied != m_copies.end())
+				return copied->second;
+
+			Expr* result = m_arena.make<Expr>();
+			m_copies.insert(std::make_pair(expr, result));
+			*result = *expr;
+			if (expr->text.str != nullptr)
+				result->text.str = m_arena.copyString(expr->text.str, expr->text.len);
+			result->lhs = copy(expr->lhs);
+			result->rhs = copy(expr->rhs);
+			result->items = copy(expr->items, expr->numItems);
+			if (expr->func != nullptr)
+				result->func = copy(expr->func);
+			return result;
+		}
+
+		Expr** copy(Expr* const* items, int numItems)
+		{
+			if (items == nullptr)
+				return nullptr;
+
+			Expr** result = m_arena.makeArray<Expr*>(numItems);
+			for (int i = 0; i < numItems; ++i)
+				result[i] = copy(items[i]);
+			return result;
+		}
+
+		Arena &m_arena;
+		std::unordered_map<const Expr*, Expr*> m_copies;
+	};
+}
+
+FunctionMemo::FunctionMemo(uint64_t maxBytes)
+	: m_maxBytes(maxBytes), m_bytes(0)
+{}
+
+bool FunctionMemo::functionKey(const Proto* tf, bool isMain, Expr* const* upvalues, int numUpvalues, uint64_t &key) const
+{
+	uint64_t seed = hashValue(isMain, 0);
+	seed = hashValue(numUpvalues, seed);
+	for (int i = 0; i < numUpvalues; ++i)
+	{
+		if (!hashExpr(upvalues[i], seed))
+			return false;
+	}
+
+	key = hashProto(tf, seed);
+	return true;
+}
+
+const FunctionMemo::Entry* FunctionMemo::lookup(uint64_t key, bool &seenBefore)
+{
+	Shard &keyShard = shard(key);
+	std::lock_guard<std::mutex> lock(keyShard.mutex);
+	++keyShard.lookups;
+
+	auto found = keyShard.entries.find(key);
+	if (found == keyShard.entries.end())
+	{
+		seenBefore = !keyShard.seen.insert(key).second;
+		return nullptr;
+	}
+
+	++keyShard.hits;
+	return &found->second;
+}
+
+void FunctionMemo::store(uint64_t key, const Function* func, const std::string &errors, bool success)
+{
+	// a memo that is full keeps serving the functions it has
+	if (m_bytes.load(std::memory_order_relaxed) >= m_maxBytes)
+		return;
+
+	Shard &keyShard = shard(key);
+	std::lock_guard<std::mutex> lock(keyShard.mutex);
+	// decompiled by another thread at the same time
+	if (keyShard.entries.find(key) != keyShard.entries.end())
+		return;
+
+	keyShard.seen.erase(key);
+	size_t bytesBefore = keyShard.arena.bytesAllocated();
+	Entry &entry = keyShard.entries[key];
+	entry.func = TreeCopier(keyShard.arena).copy(func);
+	entry.errors = errors;
+	entry.success = success;
+	m_bytes += keyShard.arena.bytesAllocated() - bytesBefore + errors.size();
+}
+
+FunctionMemo::Counters FunctionMemo::counters()
+{
+	Counters counters = Counters();
+	for (Shard &keyShard : m_shards)
+	{
+		std::lock_guard<std::mutex> lock(keyShard.mutex);
+		counters.lookups += keyShard.lookups;
+		counters.hits += keyShard.hits;
+		counters.entries += keyShard.entries.size();
+	}
+	counters.bytes = m_bytes.load();
+	return counters;
+}
+
+FunctionMemo::Shard& FunctionMemo::shard(uint64_t key)
+{
+	// the low bits pick the bucket of the map, the shard comes from the top
+	return m_shards[key >> 60];
+}
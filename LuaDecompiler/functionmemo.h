@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "arena.h"
+#include "ir.h"
+
+struct Proto;
+
+// decompiled functions shared between the files of a run.
+// a function is keyed by the hash of its proto's contents (code, constants,
+//  locals, parameters and nested protos) and of the upvalues it was given, so the
+//  same helper copied into many chunks is decompiled only a couple of times.
+// a function is kept once it is met the second time, most are unique and
+//  copying them would cost more than it saves. the trees are copied into
+//  arenas of the memo and never modified afterwards
+class FunctionMemo
+{
+public:
+	struct Entry
+	{
+		Function* func;
+		// messages of the function and its nested ones
+		std::string errors;
+		bool success;
+	};
+
+	struct Counters
+	{
+		size_t lookups;
+		size_t hits;
+		size_t entries;
+		uint64_t bytes;
+	};
+
+	// nothing is stored once the trees take more than maxBytes
+	explicit FunctionMemo(uint64_t maxBytes);
+
+	// prevent copying
+	FunctionMemo(FunctionMemo const&) = delete;
+	void operator=(FunctionMemo const&) = delete;
+
+	// false if one of the upvalues can not be keyed
+	bool functionKey(const Proto* tf, bool isMain, Expr* const* upvalues, int numUpvalues, uint64_t &key) const;
+
+	// lookups and stores may come from several threads.
+	// an entry stays valid as long as the memo. on a miss, seenBefore
+	//  tells if the function is worth storing once it is decompiled
+	const Entry* lookup(uint64_t key, bool &seenBefore);
+	void store(uint64_t key, const Function* func, const std::string &errors, bool success);
+
+	Counters counters();
+
+private:
+	// keys are spread over shards, so threads rarely wait on each other
+	static const int NUM_SHARDS = 16;
+
+	struct Shard
+	{
+		Shard() : lookups(0), hits(0) {}
+
+		std::mutex mutex;
+		std::unordered_map<uint64_t, Entry> entries;
+		// keys missed once, not stored yet
+		std::unordered_set<uint64_t> seen;
+		Arena arena;
+		size_t lookups;
+		size_t hits;
+	};
+
+	Shard& shard(uint64_t key);
+
+	Shard m_shards[NUM_SHARDS];
+	uint64_t m_maxBytes;
+	std::atomic<uint64_t> m_bytes;
+};
@@ -0,0 +1,133 @@
+#include "hash.h"
+#include <cstring>
+
+namespace
+{
+	const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+	const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	// unaligned reads in the byte order of the machine, little endian
+	//  wherever the decompiler runs, so cached keys are portable
+	inline uint64_t read64(const unsigned char* p)
+	{
+		uint64_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint32_t read32(const unsigned char* p)
+	{
+		uint32_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * PRIME2;
+		acc = rotl(acc, 31);
+		return acc * PRIME1;
+	}
+
+	inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+	{
+		acc ^= round(0, value);
+		return acc * PRIME1 + PRIME4;
+	}
+
+	// the crc of every byte, crc32 takes a byte at a time
+	struct CrcTable
+	{
+		uint32_t entries[256];
+
+		CrcTable()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320u : 0);
+				entries[i] = crc;
+			}
+		}
+	};
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	uint64_t h;
+
+	if (size >= 32)
+	{
+		// four lanes over 32 byte stripes
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+		const unsigned char* limit = end - 32;
+		do
+		{
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	}
+	else
+		h = seed + PRIME5;
+
+	h += static_cast<uint64_t>(size);
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+	{
+		h ^= (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	// avalanche
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint32_t crc32(const void* data, size_t size)
+{
+	static const CrcTable table;
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; ++i)
+		crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// xxhash64 of size bytes at data, fast enough to key whole chunks by their contents
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed);
+
+// crc-32 as zip archives store it, to check the entries read from them
+uint32_t crc32(const void* data, size_t size);
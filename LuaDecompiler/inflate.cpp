@@ -0,0 +1,380 @@
+#include "inflate.h"
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	const int MAX_BITS = 15;
+	const int MAX_LITLEN_CODES = 288;
+	const int MAX_DIST_CODES = 30;
+
+	// deflate never packs more than this much into a byte
+	const size_t MAX_RATIO = 1032;
+
+	// codes up to this long are decoded with a single table lookup
+	const int FAST_BITS = 9;
+	const unsigned FAST_MASK = (1u << FAST_BITS) - 1;
+
+	const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	// order of the code length code lengths in a dynamic block header
+	const uint8_t lengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	// canonical huffman code. the short codes are looked up by their bits
+	//  in fast, as (symbol << 4) | length, the longer ones are walked in
+	//  code order through counts and symbols
+	struct Huffman
+	{
+		uint16_t fast[1 << FAST_BITS];
+		uint16_t counts[MAX_BITS + 1];
+		uint16_t symbols[MAX_LITLEN_CODES];
+
+		// false if there are more codes than the lengths allow
+		bool build(const uint8_t* lengths, int numSymbols)
+		{
+			std::memset(fast, 0, sizeof(fast));
+			std::memset(counts, 0, sizeof(counts));
+			for (int i = 0; i < numSymbols; ++i)
+				++counts[lengths[i]];
+			counts[0] = 0;
+
+			int left = 1;
+			for (int len = 1; len <= MAX_BITS; ++len)
+			{
+				left = (left << 1) - counts[len];
+				if (left < 0)
+					return false;
+			}
+
+			uint16_t offsets[MAX_BITS + 2];
+			unsigned nextCode[MAX_BITS + 1];
+			offsets[1] = 0;
+			unsigned code = 0;
+			for (int len = 1; len <= MAX_BITS; ++len)
+			{
+				offsets[len + 1] = offsets[len] + counts[len];
+				code = (code + counts[len - 1]) << 1;
+				nextCode[len] = code;
+			}
+
+			for (int symbol = 0; symbol < numSymbols; ++symbol)
+			{
+				int len = lengths[symbol];
+				if (len == 0)
+					continue;
+				symbols[offsets[len]++] = static_cast<uint16_t>(symbol);
+
+				unsigned symbolCode = nextCode[len]++;
+				if (len > FAST_BITS)
+					continue;
+
+				// the stream holds codes starting with their highest bit
+				unsigned reversed = 0;
+				for (int i = 0; i < len; ++i)
+					reversed |= ((symbolCode >> i) & 1) << (len - 1 - i);
+				for (unsigned i = reversed; i <= FAST_MASK; i += 1u << len)
+					fast[i] = static_cast<uint16_t>((symbol << 4) | len);
+			}
+			return true;
+		}
+	};
+
+	class Inflater
+	{
+	public:
+		Inflater(const unsigned char* data, size_t size, size_t maxSize, std::string &out)
+			: m_in(data), m_end(data + size), m_bits(0), m_count(0), m_out(out), m_start(out.size()), m_maxSize(maxSize)
+		{}
+
+		bool run()
+		{
+			bool last;
+			do
+			{
+				int header;
+				if (!getBits(3, header))
+					return false;
+				last = (header & 1) != 0;
+
+				bool done;
+				switch (header >> 1)
+				{
+				case 0:
+					done = stored();
+					break;
+				case 1:
+					done = codes(fixedLitLen(), fixedDist());
+					break;
+				case 2:
+					done = dynamic();
+					break;
+				default:
+					done = false;
+				}
+				if (!done)
+					return false;
+			} while (!last);
+			return true;
+		}
+
+	private:
+		// room for n more bytes below maxSize
+		bool fits(size_t n) const
+		{
+			return n <= m_maxSize - (m_out.size() - m_start);
+		}
+
+		void refill()
+		{
+			while (m_count <= 56 && m_in != m_end)
+			{
+				m_bits |= static_cast<uint64_t>(*m_in++) << m_count;
+				m_count += 8;
+			}
+		}
+
+		bool getBits(int n, int &value)
+		{
+			refill();
+			if (n > m_count)
+				return false;
+			value = static_cast<int>(m_bits & ((1u << n) - 1));
+			m_bits >>= n;
+			m_count -= n;
+			return true;
+		}
+
+		// -1 if the bits are no code or the stream ends
+		int decode(const Huffman &huffman)
+		{
+			refill();
+			unsigned entry = huffman.fast[m_bits & FAST_MASK];
+			if (entry != 0)
+			{
+				int len = entry & 15;
+				if (len > m_count)
+					return -1;
+				m_bits >>= len;
+				m_count -= len;
+				return static_cast<int>(entry >> 4);
+			}
+
+			// codes longer than the table, a bit at a time
+			int code = 0;
+			int first = 0;
+			int index = 0;
+			for (int len = 1; len <= MAX_BITS; ++len)
+			{
+				code |= static_cast<int>((m_bits >> (len - 1)) & 1);
+				int count = huffman.counts[len];
+				if (code - count < first)
+				{
+					if (len > m_count)
+						return -1;
+					m_bits >>= len;
+					m_count -= len;
+					return huffman.symbols[index + (code - first)];
+				}
+				index += count;
+				first = (first + count) << 1;
+				code <<= 1;
+			}
+			return -1;
+		}
+
+		bool stored()
+		{
+			// the rest of the current byte is skipped
+			m_bits >>= m_count & 7;
+			m_count -= m_count & 7;
+
+			int length, complement;
+			if (!getBits(16, length) || !getBits(16, complement) || length != (~complement & 0xffff))
+				return false;
+			if (!fits(static_cast<size_t>(length)))
+				return false;
+
+			// bytes already taken into the bit buffer come first
+			for (; length > 0 && m_count >= 8; --length)
+			{
+				m_out += static_cast<char>(m_bits & 0xff);
+				m_bits >>= 8;
+				m_count -= 8;
+			}
+			if (static_cast<size_t>(m_end - m_in) < static_cast<size_t>(length))
+				return false;
+			m_out.append(reinterpret_cast<const char*>(m_in), length);
+			m_in += length;
+			return true;
+		}
+
+		bool codes(const Huffman &litLen, const Huffman &dist)
+		{
+			for (;;)
+			{
+				int symbol = decode(litLen);
+				if (symbol < 0)
+					return false;
+				if (symbol < 256)
+				{
+					if (!fits(1))
+						return false;
+					m_out += static_cast<char>(symbol);
+					continue;
+				}
+				if (symbol == 256)
+					return true;
+
+				symbol -= 257;
+				if (symbol >= 29)
+					return false;
+				int extra;
+				if (!getBits(lengthExtra[symbol], extra))
+					return false;
+				int length = lengthBase[symbol] + extra;
+				if (!fits(static_cast<size_t>(length)))
+					return false;
+
+				symbol = decode(dist);
+				if (symbol < 0 || symbol >= MAX_DIST_CODES || !getBits(distExtra[symbol], extra))
+					return false;
+				// only what this stream wrote may be copied, not what out held before
+				size_t distance = distBase[symbol] + extra;
+				if (distance > m_out.size() - m_start)
+					return false;
+
+				// the copy may overlap what it appends, byte by byte
+				size_t from = m_out.size() - distance;
+				for (int i = 0; i < length; ++i)
+					m_out += m_out[from + i];
+			}
+		}
+
+		bool dynamic()
+		{
+			int numLitLen, numDist, numLengths;
+			if (!getBits(5, numLitLen) || !getBits(5, numDist) || !getBits(4, numLengths))
+				return false;
+			numLitLen += 257;
+			numDist += 1;
+			numLengths += 4;
+			if (numLitLen > 286 || numDist > MAX_DIST_CODES)
+				return false;
+
+			uint8_t lengths[MAX_LITLEN_CODES + MAX_DIST_CODES];
+			std::memset(lengths, 0, 19);
+			for (int i = 0; i < numLengths; ++i)
+			{
+				int len;
+				if (!getBits(3, len))
+					return false;
+				lengths[lengthOrder[i]] = static_cast<uint8_t>(len);
+			}
+
+			Huffman lengthCode;
+			if (!lengthCode.build(lengths, 19))
+				return false;
+
+			// the literal/length and the distance lengths form a single sequence
+			int total = numLitLen + numDist;
+			for (int i = 0; i < total;)
+			{
+				int symbol = decode(lengthCode);
+				if (symbol < 0)
+					return false;
+				if (symbol < 16)
+				{
+					lengths[i++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+
+				uint8_t len = 0;
+				int repeat;
+				if (symbol == 16)
+				{
+					if (i == 0 || !getBits(2, repeat))
+						return false;
+					len = lengths[i - 1];
+					repeat += 3;
+				}
+				else if (symbol == 17)
+				{
+					if (!getBits(3, repeat))
+						return false;
+					repeat += 3;
+				}
+				else
+				{
+					if (!getBits(7, repeat))
+						return false;
+					repeat += 11;
+				}
+				if (i + repeat > total)
+					return false;
+				while (repeat-- > 0)
+					lengths[i++] = len;
+			}
+
+			// a block without an end of block code could never end
+			if (lengths[256] == 0)
+				return false;
+
+			Huffman litLen, dist;
+			if (!litLen.build(lengths, numLitLen) || !dist.build(lengths + numLitLen, numDist))
+				return false;
+			return codes(litLen, dist);
+		}
+
+		static const Huffman& fixedLitLen()
+		{
+			static const Huffman huffman = []()
+			{
+				uint8_t lengths[MAX_LITLEN_CODES];
+				std::memset(lengths, 8, 144);
+				std::memset(lengths + 144, 9, 112);
+				std::memset(lengths + 256, 7, 24);
+				std::memset(lengths + 280, 8, 8);
+				Huffman fixed;
+				fixed.build(lengths, MAX_LITLEN_CODES);
+				return fixed;
+			}();
+			return huffman;
+		}
+
+		static const Huffman& fixedDist()
+		{
+			static const Huffman huffman = []()
+			{
+				uint8_t lengths[MAX_DIST_CODES];
+				std::memset(lengths, 5, MAX_DIST_CODES);
+				Huffman fixed;
+				fixed.build(lengths, MAX_DIST_CODES);
+				return fixed;
+			}();
+			return huffman;
+		}
+
+		const unsigned char* m_in;
+		const unsigned char* m_end;
+		// bits not used yet, the next one lowest
+		uint64_t m_bits;
+		int m_count;
+		std::string &m_out;
+		size_t m_start;
+		size_t m_maxSize;
+	};
+}
+
+bool inflateData(const void* data, size_t size, size_t maxSize, std::string &out)
+{
+	// a damaged maxSize would not reserve more than the data could hold
+	out.reserve(out.size() + (size > maxSize / MAX_RATIO ? maxSize : size * MAX_RATIO));
+	return Inflater(static_cast<const unsigned char*>(data), size, maxSize, out).run();
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// decompresses a raw deflate stream (rfc 1951), the format of zip entries,
+//  and appends it to out.
+// false if the stream is damaged or ends early, or as soon as it would
+//  append more than maxSize bytes
+bool inflateData(const void* data, size_t size, size_t maxSize, std::string &out);
@@ -0,0 +1,525 @@
+#include "ir.h"
+#include <cstring>
+
+namespace
+{
+	Text makeText(const char* str, size_t len)
+	{
+		Text text;
+		text.str = str;
+		text.len = len;
+		return text;
+	}
+}
+
+Expr* newAtom(Arena &arena, const char* str)
+{
+	return newAtom(arena, str, std::strlen(str));
+}
+
+Expr* newAtom(Arena &arena, const char* str, size_t len)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::ATOM;
+	expr->text = makeText(str, len);
+	return expr;
+}
+
+Expr* newString(Arena &arena, const char* str)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::STRING;
+	expr->text = makeText(str, std::strlen(str));
+	// strings with line breaks or tabs are written as [[long strings]]
+	expr->longString = std::strpbrk(str, "\n\t") != nullptr;
+	return expr;
+}
+
+Expr* newPrefix(Arena &arena, const char* prefix, Expr* operand)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::PREFIX;
+	expr->text = makeText(prefix, std::strlen(prefix));
+	expr->lhs = operand;
+	return expr;
+}
+
+Expr* newBinary(Arena &arena, Expr* lhs, const char* op, Expr* rhs, bool paren)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::BINARY;
+	expr->text = makeText(op, std::strlen(op));
+	expr->lhs = lhs;
+	expr->rhs = rhs;
+	expr->paren = paren;
+	return expr;
+}
+
+Expr* newIndex(Arena &arena, Expr* object, Expr* key)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::INDEX;
+	expr->lhs = object;
+	expr->rhs = key;
+	return expr;
+}
+
+Expr* newField(Arena &arena, Expr* object, const char* name)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::FIELD;
+	expr->text = makeText(name, std::strlen(name));
+	expr->lhs = object;
+	return expr;
+}
+
+Expr* newCall(Arena &arena, Expr* func, Expr** args, int numArgs)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::CALL;
+	expr->lhs = func;
+	expr->items = args;
+	expr->numItems = numArgs;
+	return expr;
+}
+
+Expr* newList(Arena &arena, Expr** items, int numItems, const char* separator)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::LIST;
+	expr->text = makeText(separator, std::strlen(separator));
+	expr->items = items;
+	expr->numItems = numItems;
+	return expr;
+}
+
+Expr* newSequence(Arena &arena, Expr* first, Expr* second)
+{
+	Expr** items = arena.makeArray<Expr*>(2);
+	items[0] = first;
+	items[1] = second;
+
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::SEQUENCE;
+	expr->items = items;
+	expr->numItems = 2;
+	return expr;
+}
+
+Expr* newSequence(Arena &arena, Expr* first, Expr* second, Expr* third)
+{
+	Expr** items = arena.makeArray<Expr*>(3);
+	items[0] = first;
+	items[1] = second;
+	items[2] = third;
+
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::SEQUENCE;
+	expr->items = items;
+	expr->numItems = 3;
+	return expr;
+}
+
+Expr* newUnquote(Arena &arena, Expr* operand)
+{
+	// a string constant simply loses its quotes
+	if (operand->kind == Expr::STRING && !operand->longString)
+		return newAtom(arena, operand->text.str, operand->text.len);
+
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::UNQUOTE;
+	expr->lhs = operand;
+	return expr;
+}
+
+Expr* newClosure(Arena &arena, Function* func)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::FUNCTION;
+	expr->func = func;
+	return expr;
+}
+
+Stmt* newStmt(Arena &arena, Stmt::Kind kind, Expr* target, Expr* expr)
+{
+	Stmt* stmt = arena.make<Stmt>();
+	stmt->kind = kind;
+	stmt->target = target;
+	stmt->expr = expr;
+	return stmt;
+}
+
+Stmt* newStmt(Arena &arena, Stmt::Kind kind, Expr** items, int numItems, Expr* target)
+{
+	Stmt* stmt = arena.make<Stmt>();
+	stmt->kind = kind;
+	stmt->target = target;
+	stmt->items = items;
+	stmt->numItems = numItems;
+	return stmt;
+}
+
+Expr* newTable(Arena &arena, Expr* prefix, Expr** items, int numItems, const char* terminator, bool closed)
+{
+	Expr* expr = arena.make<Expr>();
+	expr->kind = Expr::TABLE;
+	expr->text = makeText(terminator, std::strlen(terminator));
+	expr->lhs = prefix;
+	expr->items = items;
+	expr->numItems = numItems;
+	expr->closed = closed;
+	return expr;
+}
+
+SourceWriter::SourceWriter(std::string &out, bool layout)
+	: m_out(out), m_layout(layout), m_indent(0), m_tableDepth(0)
+{}
+
+void SourceWriter::writeChunk(const Function* main)
+{
+	writeFunction(main, nullptr);
+}
+
+void SourceWriter::writeFunction(const Function* func, const Expr* name)
+{
+	// commas of a function inside a table constructor stay on their line
+	int tableDepth = m_tableDepth;
+	m_tableDepth = 0;
+
+	if (!func->isMain)
+	{
+		m_out += "function ";
+		if (name != nullptr)
+			writeExpr(name);
+		m_out += '(';
+		writeList(func->params, func->numParams, ", ");
+		m_out += ')';
+		openBlock();
+		endLine();
+	}
+
+	for (int i = 0; i < func->numStmts; ++i)
+		writeStmt(func->body[i]);
+
+	if (!func->isMain)
+	{
+		closeBlock();
+		m_out += "end";
+		// with layout, a closure used as a value is followed by the rest of its line
+		if (!m_layout)
+			m_out += '\n';
+	}
+
+	m_tableDepth = tableDepth;
+}
+
+void SourceWriter::writeStmt(const Stmt* stmt)
+{
+	switch (stmt->kind)
+	{
+	case Stmt::EXPR:
+		writeExpr(stmt->expr);
+		endLine();
+		break;
+
+	case Stmt::ASSIGN:
+		writeExpr(stmt->target);
+		m_out += " = ";
+		writeExpr(stmt->expr);
+		endLine();
+		break;
+
+	case Stmt::LOCAL:
+		m_out += "local ";
+		writeExpr(stmt->target);
+		m_out += " = ";
+		writeExpr(stmt->expr);
+		endLine();
+		break;
+
+	case Stmt::RETURN:
+		m_out += "return ";
+		writeList(stmt->items, stmt->numItems, ", ");
+		endLine();
+		break;
+
+	case Stmt::NUMERIC_FOR:
+		m_out += "for ";
+		writeExpr(stmt->target);
+		m_out += " = ";
+		writeList(stmt->items, stmt->numItems, ", ");
+		m_out += " do";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::GENERIC_FOR:
+		m_out += "for ";
+		writeExpr(stmt->target);
+		m_out += " in ";
+		writeExpr(stmt->expr);
+		m_out += " do";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::IF:
+		m_out += "if ";
+		writeExpr(stmt->expr);
+		m_out += " then";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::WHILE:
+		m_out += "while ";
+		writeExpr(stmt->expr);
+		m_out += " do";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::ELSEIF:
+		closeBlock();
+		m_out += "elseif ";
+		writeExpr(stmt->expr);
+		m_out += " then";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::ELSE:
+		closeBlock();
+		m_out += "else";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::REPEAT:
+		m_out += "repeat";
+		openBlock();
+		endLine();
+		break;
+
+	case Stmt::UNTIL:
+		closeBlock();
+		m_out += "until ";
+		writeExpr(stmt->expr);
+		endLine();
+		if (m_layout)
+			lineBreak();
+		break;
+
+	case Stmt::BREAK:
+		m_out += "break";
+		endLine();
+		break;
+
+	case Stmt::END:
+		closeBlock();
+		m_out += "end";
+		endLine();
+		// blocks are followed by an empty line
+		if (m_layout)
+			lineBreak();
+		break;
+
+	case Stmt::FUNCTION:
+		writeFunction(stmt->expr->func, stmt->target);
+		if (m_layout)
+		{
+			lineBreak();
+			lineBreak();
+		}
+		break;
+	}
+}
+
+void SourceWriter::writeExpr(const Expr* expr)
+{
+	switch (expr->kind)
+	{
+	case Expr::ATOM:
+		append(expr->text);
+		break;
+
+	case Expr::STRING:
+		m_out += expr->longString ? "[[" : "\"";
+		append(expr->text);
+		m_out += expr->longString ? "]]" : "\"";
+		break;
+
+	case Expr::PREFIX:
+		append(expr->text);
+		writeExpr(expr->lhs);
+		break;
+
+	case Expr::BINARY:
+		if (expr->paren)
+			m_out += "( ";
+		writeExpr(expr->lhs);
+		append(expr->text);
+		writeExpr(expr->rhs);
+		if (expr->paren)
+			m_out += " )";
+		break;
+
+	case Expr::INDEX:
+		writeExpr(expr->lhs);
+		m_out += '[';
+		writeExpr(expr->rhs);
+		m_out += ']';
+		break;
+
+	case Expr::FIELD:
+		writeExpr(expr->lhs);
+		m_out += '.';
+		append(expr->text);
+		break;
+
+	case Expr::CALL:
+		writeExpr(expr->lhs);
+		m_out += '(';
+		writeList(expr->items, expr->numItems, ", ");
+		m_out += ')';
+		break;
+
+	case Expr::LIST:
+		writeList(expr->items, expr->numItems, expr->text.str);
+		break;
+
+	case Expr::SEQUENCE:
+		for (int i = 0; i < expr->numItems; ++i)
+			writeExpr(expr->items[i]);
+		break;
+
+	case Expr::UNQUOTE:
+		{
+			size_t start = m_out.size();
+			writeExpr(expr->lhs);
+			if (m_out.size() > start)
+				m_out.erase(start, 1);
+			if (m_out.size() > start)
+				m_out.pop_back();
+		}
+		break;
+
+	case Expr::FUNCTION:
+		writeFunction(expr->func, nullptr);
+		break;
+
+	case Expr::TABLE:
+		writeTable(expr);
+		break;
+	}
+}
+
+void SourceWriter::writeList(Expr* const* items, int numItems, const char* separator)
+{
+	// inside a table constructor every comma starts a new line
+	bool breakLines = m_layout && m_tableDepth > 0 && std::strcmp(separator, ", ") == 0;
+
+	for (int i = 0; i < numItems; ++i)
+	{
+		if (i != 0)
+		{
+			if (breakLines)
+			{
+				m_out += ',';
+				lineBreak();
+			}
+			else
+				m_out += separator;
+		}
+		writeExpr(items[i]);
+	}
+}
+
+void SourceWriter::writeTable(const Expr* table)
+{
+	if (!m_layout)
+	{
+		if (table->lhs == nullptr && table->numItems == 0 && table->closed)
+		{
+			m_out += "{}";
+			return;
+		}
+
+		m_out += "{ ";
+		writeTableEntries(table);
+		if (table->closed)
+			m_out += " }";
+		return;
+	}
+
+	// the braces get lines of their own, one entry per line in between
+	lineBreak();
+	m_out += '{';
+	++m_tableDepth;
+	++m_indent;
+	lineBreak();
+
+	writeTableEntries(table);
+
+	--m_indent;
+	--m_tableDepth;
+	if (table->closed)
+	{
+		lineBreak();
+		m_out += '}';
+	}
+}
+
+void SourceWriter::writeTableEntries(const Expr* table)
+{
+	if (table->lhs != nullptr)
+		writeTableEntries(table->lhs);
+
+	writeList(table->items, table->numItems, ", ");
+	append(table->text);
+
+	// a ';' ends the list part and its line
+	if (m_layout && table->text.len > 0)
+		lineBreak();
+}
+
+void SourceWriter::append(const Text &text)
+{
+	m_out.append(text.str, text.len);
+}
+
+void SourceWriter::endLine()
+{
+	if (m_layout)
+		lineBreak();
+	else
+		m_out += '\n';
+}
+
+void SourceWriter::lineBreak()
+{
+	// no trailing whitespace, then indent the next line
+	while (!m_out.empty() && (m_out.back() == ' ' || m_out.back() == '\t'))
+		m_out.pop_back();
+
+	m_out += '\n';
+	m_out.append(m_indent, '\t');
+}
+
+void SourceWriter::openBlock()
+{
+	if (m_layout)
+		++m_indent;
+}
+
+void SourceWriter::closeBlock()
+{
+	if (!m_layout)
+		return;
+
+	// the line was already indented for the block's body
+	if (!m_out.empty() && m_out.back() == '\t')
+		m_out.pop_back();
+	if (m_indent > 0)
+		--m_indent;
+}
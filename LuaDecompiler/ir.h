@@ -0,0 +1,138 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "arena.h"
+
+// expression and statement tree built by the opcode handlers.
+// nodes are allocated from an Arena and only point at each other or at
+//  strings that outlive them (constants of the loaded chunk, arena copies),
+//  the source text is written in a single pass once a chunk is done
+
+struct Expr;
+struct Stmt;
+struct Function;
+
+struct Text
+{
+	const char* str;
+	size_t len;
+};
+
+struct Expr
+{
+	enum Kind
+	{
+		ATOM,		// text: names, numbers, nil
+		STRING,		// quoted text
+		PREFIX,		// text lhs
+		BINARY,		// lhs text rhs, wrapped in "( " " )" if paren
+		INDEX,		// lhs[rhs]
+		FIELD,		// lhs.text
+		CALL,		// lhs(items)
+		LIST,		// items separated by text
+		SEQUENCE,	// items written back to back
+		UNQUOTE,	// lhs without its first and last character
+		FUNCTION,	// func
+		TABLE		// lhs entries, items, then text. closed once complete
+	};
+
+	Kind kind;
+	bool paren;
+	bool longString;
+	bool closed;
+	Text text;
+	Expr* lhs;
+	Expr* rhs;
+	Expr** items;
+	int numItems;
+	Function* func;
+};
+
+struct Stmt
+{
+	enum Kind
+	{
+		EXPR,			// expr
+		ASSIGN,			// target = expr
+		LOCAL,			// local target = expr
+		RETURN,			// return items
+		NUMERIC_FOR,	// for target = items do
+		GENERIC_FOR,	// for target in expr do, target lists the index and the value
+		IF,				// if expr then
+		WHILE,			// while expr do
+		ELSEIF,			// elseif expr then
+		ELSE,			// else
+		REPEAT,			// repeat
+		UNTIL,			// until expr
+		BREAK,			// break
+		END,			// end
+		FUNCTION		// function target, expr is the closure
+	};
+
+	Kind kind;
+	Expr* target;
+	Expr* expr;
+	Expr** items;
+	int numItems;
+};
+
+struct Function
+{
+	Expr** params;
+	int numParams;
+	Stmt** body;
+	int numStmts;
+	bool isMain;
+};
+
+// node constructors, str has to outlive the arena
+Expr* newAtom(Arena &arena, const char* str);
+Expr* newAtom(Arena &arena, const char* str, size_t len);
+Expr* newString(Arena &arena, const char* str);
+Expr* newPrefix(Arena &arena, const char* prefix, Expr* operand);
+Expr* newBinary(Arena &arena, Expr* lhs, const char* op, Expr* rhs, bool paren);
+Expr* newIndex(Arena &arena, Expr* object, Expr* key);
+Expr* newField(Arena &arena, Expr* object, const char* name);
+Expr* newCall(Arena &arena, Expr* func, Expr** args, int numArgs);
+Expr* newList(Arena &arena, Expr** items, int numItems, const char* separator);
+Expr* newSequence(Arena &arena, Expr* first, Expr* second);
+Expr* newSequence(Arena &arena, Expr* first, Expr* second, Expr* third);
+Expr* newUnquote(Arena &arena, Expr* operand);
+Expr* newClosure(Arena &arena, Function* func);
+// a table constructor is built in segments, one per SETLIST/SETMAP.
+//  a segment continues the entries of prefix and ends with terminator
+Expr* newTable(Arena &arena, Expr* prefix, Expr** items, int numItems, const char* terminator, bool closed);
+
+Stmt* newStmt(Arena &arena, Stmt::Kind kind, Expr* target = nullptr, Expr* expr = nullptr);
+Stmt* newStmt(Arena &arena, Stmt::Kind kind, Expr** items, int numItems, Expr* target = nullptr);
+
+// appends the source of a chunk to out.
+// with layout set, blocks are indented and tables are split into lines
+//  while writing. without it the text is left for the lexer based formatter
+class SourceWriter
+{
+public:
+	SourceWriter(std::string &out, bool layout);
+
+	void writeChunk(const Function* main);
+
+private:
+	// name is null for closures used as values
+	void writeFunction(const Function* func, const Expr* name);
+	void writeStmt(const Stmt* stmt);
+	void writeExpr(const Expr* expr);
+	void writeList(Expr* const* items, int numItems, const char* separator);
+	void writeTable(const Expr* table);
+	void writeTableEntries(const Expr* table);
+	void append(const Text &text);
+
+	void endLine();
+	void lineBreak();
+	void openBlock();
+	void closeBlock();
+
+	std::string& m_out;
+	bool m_layout;
+	int m_indent;
+	int m_tableDepth;
+};
@@ -0,0 +1,81 @@
+#include "localnames.h"
+#include <algorithm>
+#include "lobject.h"
+
+void LocalNames::build(const Proto* tf)
+{
+	m_tf = tf;
+	m_ranges.clear();
+	m_starts.clear();
+	m_slots.clear();
+
+	int numCode = std::max(tf->ncode, 0);
+	std::vector<int> cuts(1, 0);
+	std::vector<int> byStart;
+	for (int i = 0; i < tf->nlocvars; ++i)
+	{
+		const LocVar &var = tf->locvars[i];
+		if (var.startpc >= var.endpc || var.startpc >= numCode || var.endpc <= 0)
+			continue;
+		cuts.push_back(std::max(var.startpc, 0));
+		cuts.push_back(std::min(var.endpc, numCode));
+		byStart.push_back(i);
+	}
+	std::sort(cuts.begin(), cuts.end());
+	cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+	std::stable_sort(byStart.begin(), byStart.end(), [tf](int a, int b)
+	{
+		return tf->locvars[a].startpc < tf->locvars[b].startpc;
+	});
+
+	// the locals of a range follow from the ones of the range before it,
+	//  kept in declaration order which is the order of their slots
+	m_ranges.resize(numCode + 1);
+	std::vector<int> active;
+	size_t nextStart = 0;
+	for (size_t range = 0; range < cuts.size(); ++range)
+	{
+		int pc = cuts[range];
+		int end = range + 1 < cuts.size() ? cuts[range + 1] : numCode + 1;
+		std::fill(m_ranges.begin() + pc, m_ranges.begin() + end, static_cast<int>(range));
+
+		active.erase(std::remove_if(active.begin(), active.end(), [tf, pc](int i)
+		{
+			return tf->locvars[i].endpc <= pc;
+		}), active.end());
+		for (; nextStart < byStart.size() && tf->locvars[byStart[nextStart]].startpc <= pc; ++nextStart)
+		{
+			int i = byStart[nextStart];
+			active.insert(std::upper_bound(active.begin(), active.end(), i), i);
+		}
+
+		m_starts.push_back(static_cast<int>(m_slots.size()));
+		m_slots.insert(m_slots.end(), active.begin(), active.end());
+	}
+	m_starts.push_back(static_cast<int>(m_slots.size()));
+}
+
+const LocVar* LocalNames::local(int slot, int pc) const
+{
+	int i = index(slot, pc);
+	return i >= 0 ? &m_tf->locvars[i] : nullptr;
+}
+
+const char* LocalNames::name(int slot, int pc) const
+{
+	const LocVar* var = local(slot, pc);
+	if (var == nullptr || var->varname == nullptr || var->varname->str[0] == '(')
+		return nullptr;
+	return var->varname->str;
+}
+
+int LocalNames::index(int slot, int pc) const
+{
+	if (slot < 0 || pc < 0 || static_cast<size_t>(pc) >= m_ranges.size())
+		return -1;
+	int range = m_ranges[pc];
+	int first = m_starts[range];
+	if (slot >= m_starts[range + 1] - first)
+		return -1;
+	return m_slots[first + slot];
+}
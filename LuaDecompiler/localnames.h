@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+
+struct Proto;
+struct LocVar;
+
+// the locals of a function from the debug info in its Proto, indexed once
+//  so every lookup takes constant time instead of a scan of locvars.
+// the locals active at a pc take the stack slots in the order they were
+//  declared, so the pcs where one starts or ends cut the code into ranges
+//  with the same locals. every pc knows its range and every range lists
+//  the local in each of its slots.
+// a stripped chunk has no locvars, nothing is found then
+class LocalNames
+{
+public:
+	void build(const Proto* tf);
+
+	// local in slot at pc, null if there is none
+	const LocVar* local(int slot, int pc) const;
+	// its name, also null for the ones named by the compiler like the
+	//  (limit) and (step) of a for loop, they are no valid names
+	const char* name(int slot, int pc) const;
+	// position of the local in locvars, -1 if there is none
+	int index(int slot, int pc) const;
+
+private:
+	const Proto* m_tf;
+	// range of every pc, one more for the end of the code
+	std::vector<int> m_ranges;
+	// where the slots of a range start in m_slots, one more at the end
+	std::vector<int> m_starts;
+	// locvars index of every slot of every range
+	std::vector<int> m_slots;
+};
@@ -8,6 +8,14 @@
 // modified: prevented exiting on file error, this is being handled elsewhere
 // modified: replaced entry point.
 // modified: prevented opening and parsing text files, can only open compiled lua files.
+// modified: lua_state is thread local, so several threads can load files at once.
+// modified: loadproto goes through a reusable Loader instead of leaking a lua_State per file.
+// modified: loadproto memory maps the file and loads it in-place, load is kept as the stream path.
+// modified: loadprotobuffer loads in-place from memory the caller already read the file into.
+// modified: compileproto parses a source held in memory, syntax errors are returned instead of printed.
+// modified: ischunkheader and ischunkfile check the header of a chunk without a lua_State, every in-place load checks it first.
+// modified: indexproto finds the functions of a chunk without loading it, loadprotospan loads a single one.
+// modified: chunks are undumped under an error handler, a malformed one fails with its message kept in the loader.
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +25,7 @@
 #include "lstate.h"
 #include "lzio.h"
 #include "luac.h"
+#include "mapfile.h"
 
 #define	OUTPUT	"luac.out"		/* default output file */
 
@@ -27,7 +36,7 @@ static FILE* efopen(const char* name, const char* mode);
 static void strip(Proto* tf);
 static Proto* combine(Proto** P, int n);
 
-lua_State* lua_state=NULL;		/* lazy! */
+LUAC_THREAD lua_State* lua_state=NULL;	/* lazy! */
 
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
@@ -58,20 +67,245 @@ Proto* loadproto(int argc, const char* argv[])
 }
 */
 
-Proto* loadproto(const char* fileName)
+/*
+** a loader keeps one lua_State alive for as many files as it is given.
+** the protos and strings of the previous file are released before the next
+** one is loaded, so memory use stays flat over long runs.
+** loaders are not shared, every thread should own its own.
+*/
+struct Loader
 {
-	Proto** P, *tf;
+ lua_State* state;
+ MappedFile image;			/* file the current protos may point into */
+ int borrowed;				/* image is the caller's buffer, not a mapping */
+ char message[256];			/* why the last chunk failed to load */
+};
 
-	L = lua_open(0);
+Loader* newloader(void)
+{
+ Loader* loader=(Loader*)malloc(sizeof(Loader));
+ if (loader==NULL) return NULL;
+ loader->state=lua_open(0);
+ loader->image.data=NULL;
+ loader->borrowed=0;
+ loader->message[0]='\0';
+ if (loader->state==NULL)
+ {
+  free(loader);
+  return NULL;
+ }
+ return loader;
+}
 
-	P = luaM_newvector(L, 1, Proto*);
+static void freestrings(lua_State* L, int all)
+{
+ int i;
+ for (i=0; i<L->strt.size; i++)
+ {
+  TString** p=&L->strt.hash[i];
+  TString* next;
+  while ((next=*p)!=NULL)
+  {
+   if (next->marked>=FIXMARK && !all)	/* keep reserved words */
+    p=&next->nexthash;
+   else
+   {
+    *p=next->nexthash;
+    L->strt.nuse--;
+    L->nblocks-=sizestring(next->len);
+    luaM_free(L,next);
+   }
+  }
+ }
+}
 
-	P[0] = load(fileName);
+#define INIMAGE(m,p)	((m)->data!=NULL && (const char*)(p)>=(m)->data && \
+			 (const char*)(p)<(m)->data+(m)->size)
 
-	tf = P[0];
-	//luaU_printchunk(tf);
+void resetloader(Loader* loader)
+{
+ lua_State* L=loader->state;
+ MappedFile* image=&loader->image;
+ while (L->rootproto!=NULL)
+ {
+  Proto* tf=L->rootproto;
+  Proto* next=tf->next;
+  /* vectors loaded in-place belong to the mapping, not to the allocator */
+  if (INIMAGE(image,tf->code)) tf->code=NULL;
+  if (INIMAGE(image,tf->knum)) tf->knum=NULL;
+  if (INIMAGE(image,tf->lineinfo)) tf->lineinfo=NULL;
+  luaF_freeproto(L,tf);
+  L->rootproto=next;
+ }
+ freestrings(L,0);
+ loader->message[0]='\0';
+ if (loader->borrowed)
+ {
+  image->data=NULL;
+  image->size=0;
+  loader->borrowed=0;
+ }
+ else
+  unmapfile(image);
+}
 
-	return tf;
+void freeloader(Loader* loader)
+{
+ lua_State* L;
+ if (loader==NULL) return;
+ L=loader->state;
+ resetloader(loader);
+ freestrings(L,1);
+ luaS_freeall(L);
+ luaH_free(L,L->gt);
+ luaM_free(L,L->Mbuffer);
+ luaM_free(L,L);
+ free(loader);
+}
+
+static Proto* loadmapped(Loader* loader, const char* filename)
+{
+ MappedFile* image=&loader->image;
+ ZIO z;
+ char source[512];
+ if (!mapfile(image,filename))
+  return load(filename);		/* let the stream path report the error */
+ if (!ischunkheader(image->data,image->size))
+  return NULL;
+ sprintf(source,"@%.*s",Sizeof(source)-2,filename);
+ zimopen(&z,image->data,image->size,source);
+ return luac_protectedundump(L,&z,loader->message,Sizeof(loader->message));
+}
+
+/*
+** why the last load failed, empty if it did not or the data was no chunk.
+** NULL returned for a malformed chunk comes with its message here
+*/
+const char* loadermessage(const Loader* loader)
+{
+ return loader->message;
+}
+
+/* the returned proto stays valid until the next call on the same loader */
+Proto* loadproto(Loader* loader, const char* fileName)
+{
+ resetloader(loader);
+ L = loader->state;
+ return loadmapped(loader,fileName);
+}
+
+/*
+** same as loadproto, for a file already read into memory.
+** the protos point into data, it has to outlive them
+*/
+Proto* loadprotobuffer(Loader* loader, const char* data, size_t size, const char* fileName)
+{
+ ZIO z;
+ char source[512];
+ resetloader(loader);
+ L = loader->state;
+ if (!ischunkheader(data,size))
+  return NULL;
+ loader->image.data=data;
+ loader->image.size=size;
+ loader->borrowed=1;
+ sprintf(source,"@%.*s",Sizeof(source)-2,fileName);
+ zimopen(&z,data,size,source);
+ return luac_protectedundump(L,&z,loader->message,Sizeof(loader->message));
+}
+
+/*
+** checks the header of a chunk the way LoadHeader does, without loading it.
+** data has to hold CHUNKHEADER bytes for it to pass
+*/
+int ischunkheader(const char* data, size_t size)
+{
+ static const unsigned char sizes[]={sizeof(int),sizeof(size_t),sizeof(Instruction),
+	SIZE_INSTRUCTION,SIZE_OP,SIZE_B,sizeof(Number)};
+ const unsigned char* p=(const unsigned char*)data;
+ unsigned char* n;
+ Number f;
+ int i,swap;
+ if (size<CHUNKHEADER || p[0]!=ID_CHUNK || memcmp(p+1,SIGNATURE,sizeof(SIGNATURE)-1)!=0)
+  return 0;
+ p+=sizeof(SIGNATURE);
+ if (p[0]>VERSION || p[0]<VERSION0)
+  return 0;
+ swap=(luaU_endianess()!=p[1]);
+ if (memcmp(p+2,sizes,sizeof(sizes))!=0)
+  return 0;
+ p+=2+sizeof(sizes);
+ n=(unsigned char*)&f;
+ for (i=0; i<Sizeof(Number); i++)
+  n[i]=p[swap ? Sizeof(Number)-1-i : i];
+ return (long)f==(long)TEST_NUMBER;	/* disregard errors in last bit of fraction */
+}
+
+/* same for a file, only its header is read */
+int ischunkfile(const char* fileName)
+{
+ char header[CHUNKHEADER];
+ return ischunkheader(header,readhead(fileName,header,sizeof(header)));
+}
+
+/* the chunk was written with the other byte order, data passed ischunkheader */
+static int chunkswap(const char* data)
+{
+ return luaU_endianess()!=data[sizeof(SIGNATURE)+1];
+}
+
+/*
+** finds where the functions of a chunk held in memory are stored, without
+** loading it. see luaU_indexchunk, -1 if it is no chunk or malformed
+*/
+int indexproto(const char* data, size_t size, FuncSpan* spans, int max)
+{
+ if (!ischunkheader(data,size))
+  return -1;
+ return luaU_indexchunk(data,size,CHUNKHEADER,chunkswap(data),spans,max);
+}
+
+/*
+** same as loadprotobuffer for the function of the chunk at span and the
+** ones nested in it, nothing else of the chunk is loaded
+*/
+Proto* loadprotospan(Loader* loader, const char* data, size_t size, const FuncSpan* span, const char* fileName)
+{
+ ZIO z;
+ char source[512];
+ resetloader(loader);
+ L = loader->state;
+ if (!ischunkheader(data,size) || span->offset<CHUNKHEADER || span->offset>size || span->size>size-span->offset)
+  return NULL;
+ loader->image.data=data;
+ loader->image.size=size;
+ loader->borrowed=1;
+ sprintf(source,"@%.*s",Sizeof(source)-2,fileName);
+ zimopen(&z,data+span->offset,span->size,source);
+ return luac_protectedundumpfunction(L,&z,chunkswap(data),loader->message,Sizeof(loader->message));
+}
+
+/* same as loadproto, but reads through a FILE stream and copies everything */
+Proto* loadprotostream(Loader* loader, const char* fileName)
+{
+ resetloader(loader);
+ L = loader->state;
+ return load(fileName);
+}
+
+/*
+** parses a source into the loader, the protos are kept like loaded ones.
+** returns NULL on a syntax error and leaves its message in message
+*/
+Proto* compileproto(Loader* loader, const char* text, size_t size, const char* name, char* message, int messagesize)
+{
+ ZIO z;
+ char source[512];
+ resetloader(loader);
+ L = loader->state;
+ sprintf(source,"@%.*s",Sizeof(source)-2,name);
+ zmopen(&z,text,size,source);
+ return luac_protectedparser(L,&z,message,messagesize);
 }
 
 static void usage(const char* message, const char* arg)
@@ -149,6 +383,8 @@ Proto* load(const char* filename)
  }
  else
   f=efopen(filename,"r");
+ if (f==NULL)
+  return NULL;
  c=ungetc(fgetc(f),f);
  if (ferror(f))
  {
@@ -162,10 +398,18 @@ Proto* load(const char* filename)
  {
   fclose(f);
   f=efopen(filename,"rb");
+  if (f==NULL)
+   return NULL;
  }
  sprintf(source,"@%.*s",Sizeof(source)-2,filename);
  luaZ_Fopen(&z,f,source);
- tf = undump ? luaU_undump(L, &z) : NULL;//luaY_parser(L,&z);
+ tf=NULL;
+ if (undump)				/* errors are printed like lua_error would */
+ {
+  char message[256];
+  tf=luac_protectedundump(L,&z,message,Sizeof(message));
+  if (tf==NULL && message[0]!='\0') fprintf(stderr,"luac: %s\n",message);
+ }
  if (f!=stdin) fclose(f);
  return tf;
 }
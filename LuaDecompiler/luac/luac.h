@@ -13,7 +13,18 @@
 #include "ltable.h"
 #include "lundump.h"
 
-extern lua_State *lua_state;
+/* one loader state per thread, so files can be loaded concurrently */
+#ifdef _MSC_VER
+#define LUAC_THREAD	__declspec(thread)
+#else
+#define LUAC_THREAD	__thread
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern LUAC_THREAD lua_State *lua_state;
 #define	L	lua_state		/* lazy! */
 
 /* from dump.c */
@@ -28,6 +39,34 @@ void luaU_printchunk(const Proto* Main);
 /* from test.c */
 void luaU_testchunk(const Proto* Main);
 
+/* from stubs.c */
+Proto* luac_protectedparser(lua_State* L, ZIO* z, char* message, int size);
+Proto* luac_protectedundump(lua_State* L, ZIO* z, char* message, int size);
+Proto* luac_protectedundumpfunction(lua_State* L, ZIO* z, int swap, char* message, int size);
+
 //Proto* loadproto(int argc, const char* argv[]);
 
+/* from luac.c */
+typedef struct Loader Loader;
+
+Loader* newloader(void);
+void resetloader(Loader* loader);
+void freeloader(Loader* loader);
+const char* loadermessage(const Loader* loader);
+Proto* loadproto(Loader* loader, const char* fileName);
+Proto* loadprotobuffer(Loader* loader, const char* data, size_t size, const char* fileName);
+Proto* loadprotostream(Loader* loader, const char* fileName);
+Proto* compileproto(Loader* loader, const char* text, size_t size, const char* name, char* message, int messagesize);
+int ischunkheader(const char* data, size_t size);
+int ischunkfile(const char* fileName);
+int indexproto(const char* data, size_t size, FuncSpan* spans, int max);
+Proto* loadprotospan(Loader* loader, const char* data, size_t size, const FuncSpan* span, const char* fileName);
+
+#ifdef __cplusplus
+}
+#endif
+
 #define Sizeof(x)	((int)sizeof(x))
+
+/* bytes of a chunk checked by ischunkheader: id, signature, version, endianess, sizes and test number */
+#define CHUNKHEADER	(1+(sizeof(SIGNATURE)-1)+1+1+7+sizeof(Number))
@@ -0,0 +1,113 @@
+/*
+** read-only memory mapped files, used to load chunks without copying them
+** See Copyright Notice in lua.h
+*/
+
+#include "mapfile.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+int mapfile(MappedFile* m, const char* filename)
+{
+ HANDLE file,mapping;
+ LARGE_INTEGER size;
+ m->data=NULL;
+ m->size=0;
+ m->handle=NULL;
+ file=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+	FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+ if (file==INVALID_HANDLE_VALUE) return 0;
+ if (!GetFileSizeEx(file,&size) || size.QuadPart==0 || (ULONGLONG)size.QuadPart>(size_t)-1)
+ {
+  CloseHandle(file);
+  return 0;
+ }
+ mapping=CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+ CloseHandle(file);			/* the mapping keeps the file open */
+ if (mapping==NULL) return 0;
+ m->data=(const char*)MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+ if (m->data==NULL)
+ {
+  CloseHandle(mapping);
+  return 0;
+ }
+ m->size=(size_t)size.QuadPart;
+ m->handle=mapping;
+ return 1;
+}
+
+void unmapfile(MappedFile* m)
+{
+ if (m->data==NULL) return;
+ UnmapViewOfFile(m->data);
+ CloseHandle((HANDLE)m->handle);
+ m->data=NULL;
+ m->size=0;
+ m->handle=NULL;
+}
+
+size_t readhead(const char* filename, char* buffer, size_t size)
+{
+ HANDLE file;
+ DWORD n=0;
+ file=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+ if (file==INVALID_HANDLE_VALUE) return 0;
+ if (!ReadFile(file,buffer,(DWORD)size,&n,NULL)) n=0;
+ CloseHandle(file);
+ return (size_t)n;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int mapfile(MappedFile* m, const char* filename)
+{
+ struct stat st;
+ void* p;
+ int fd;
+ m->data=NULL;
+ m->size=0;
+ m->handle=NULL;
+ fd=open(filename,O_RDONLY);
+ if (fd<0) return 0;
+ if (fstat(fd,&st)!=0 || !S_ISREG(st.st_mode) || st.st_size==0)
+ {
+  close(fd);
+  return 0;
+ }
+ p=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+ close(fd);				/* the mapping keeps the file open */
+ if (p==MAP_FAILED) return 0;
+#ifdef POSIX_MADV_SEQUENTIAL
+ posix_madvise(p,(size_t)st.st_size,POSIX_MADV_SEQUENTIAL);
+#endif
+ m->data=(const char*)p;
+ m->size=(size_t)st.st_size;
+ return 1;
+}
+
+void unmapfile(MappedFile* m)
+{
+ if (m->data==NULL) return;
+ munmap((void*)m->data,m->size);
+ m->data=NULL;
+ m->size=0;
+}
+
+size_t readhead(const char* filename, char* buffer, size_t size)
+{
+ ssize_t n;
+ int fd=open(filename,O_RDONLY);
+ if (fd<0) return 0;
+ n=pread(fd,buffer,size,0);		/* fails on directories */
+ close(fd);
+ return n<0 ? 0 : (size_t)n;
+}
+
+#endif
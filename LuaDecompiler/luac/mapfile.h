@@ -0,0 +1,35 @@
+/*
+** read-only memory mapped files, used to load chunks without copying them
+** See Copyright Notice in lua.h
+*/
+
+#ifndef mapfile_h
+#define mapfile_h
+
+#include <stddef.h>
+
+typedef struct MappedFile
+{
+ const char* data;			/* start of the image, NULL if not mapped */
+ size_t size;
+ void* handle;				/* platform mapping handle */
+} MappedFile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* map a whole file, returns 0 on failure (including empty files) */
+int mapfile(MappedFile* m, const char* filename);
+
+/* release a mapping, does nothing if m is not mapped */
+void unmapfile(MappedFile* m);
+
+/* read the first size bytes of a file with a single read, returns the number read */
+size_t readhead(const char* filename, char* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
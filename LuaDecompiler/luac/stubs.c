@@ -5,12 +5,16 @@
 */
 
 // modified: prevented outright exiting on error
+// modified: errors jump back to luac_protectedparser, so sources can be compiled without exiting.
+// modified: luac_protectedundump does the same for loading, a malformed chunk fails instead of being read past its end.
 
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "ldo.h"
 #include "llex.h"
+#include "lparser.h"
 #include "luac.h"
 #undef L
 
@@ -24,9 +28,21 @@ const char luac_ident[] = "$luac: " LUA_VERSION " " LUA_COPYRIGHT " $\n"
 * use only lcode lfunc llex lmem lobject lparser lstring ltable lzio
 */
 
-/* simplified from ldo.c */
+/* simplified from ldo.c, the message is kept for the caller instead of being printed */
+struct lua_longjmp {
+  jmp_buf b;
+  struct lua_longjmp *previous;
+  volatile int status;  /* error code */
+  char message[256];
+};
+
 void lua_error (lua_State* L, const char* s) {
-  UNUSED(L);
+  if (L->errorJmp) {
+    struct lua_longjmp *lj = L->errorJmp;
+    lj->status = LUA_ERRRUN;
+    sprintf(lj->message,"%.*s",Sizeof(lj->message)-1,s ? s : "");
+    longjmp(lj->b, 1);
+  }
   if (s) fprintf(stderr,"luac: %s\n",s);
   //exit(1);
   return;
@@ -38,6 +54,52 @@ void luaD_breakrun (lua_State *L, int errcode) {
   lua_error(L,"memory allocation error");
 }
 
+typedef Proto *(*Load) (lua_State *L, ZIO *z, int swap);
+
+/*
+** simplified from ldo.c, runs f and returns NULL if it raised an error.
+** message receives the error, if there was one
+*/
+static Proto *protectedload (lua_State *L, Load f, ZIO *z, int swap, char *message, int size) {
+  Proto *volatile tf = NULL;
+  struct lua_longjmp lj;
+  lj.status = 0;
+  lj.message[0] = '\0';
+  lj.previous = L->errorJmp;  /* chain new error handler */
+  L->errorJmp = &lj;
+  if (setjmp(lj.b) == 0)
+    tf = f(L, z, swap);
+  L->errorJmp = lj.previous;  /* restore old error handler */
+  if (message != NULL && size > 0)
+    sprintf(message,"%.*s",size-1,lj.message);
+  return lj.status == 0 ? tf : NULL;
+}
+
+static Proto *parse (lua_State *L, ZIO *z, int swap) {
+  UNUSED(swap);
+  return luaY_parser(L, z);
+}
+
+static Proto *undump (lua_State *L, ZIO *z, int swap) {
+  UNUSED(swap);
+  return luaU_undump(L, z);
+}
+
+/* parses a source, NULL if it has a syntax error */
+Proto *luac_protectedparser (lua_State *L, ZIO *z, char *message, int size) {
+  return protectedload(L, parse, z, 0, message, size);
+}
+
+/* loads a chunk, NULL if it is malformed or ends early */
+Proto *luac_protectedundump (lua_State *L, ZIO *z, char *message, int size) {
+  return protectedload(L, undump, z, 0, message, size);
+}
+
+/* same for a single function, see luaU_undumpfunction */
+Proto *luac_protectedundumpfunction (lua_State *L, ZIO *z, int swap, char *message, int size) {
+  return protectedload(L, luaU_undumpfunction, z, swap, message, size);
+}
+
 /* simplified from lstate.c */
 lua_State *lua_open (int stacksize) {
   lua_State *L = luaM_new(NULL, lua_State);
@@ -1,5 +1,7 @@
 #include "decompiler.h"
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 int main(int argc, const char* argv[])
 {
@@ -7,15 +9,88 @@ int main(int argc, const char* argv[])
 
 	if (argc < 2)
 	{
-		std::cout << "Usage: LuaDecompiler file or folder path(s)";
+		std::cout << "Usage: LuaDecompiler [--jobs N] [--reformat] [--verify] [--cache dir] [--cache-size MB] [--dedup] [--stats] [--stats-file out.csv|out.json] [--watch folder] [--serve socket] file or folder path(s)";
 	}
 	else
 	{
 		for (int i = 1; i < argc; ++i)
 		{
+			// number of threads used for folders, 0 means one per core
+			if ((std::strcmp(argv[i], "--jobs") == 0 || std::strcmp(argv[i], "-j") == 0) && i + 1 < argc)
+			{
+				dec.setJobs(std::atoi(argv[++i]));
+				continue;
+			}
+
+			// format with the old lexer pass
+			if (std::strcmp(argv[i], "--reformat") == 0)
+			{
+				dec.setReformat(true);
+				continue;
+			}
+
+			// compile the output back and compare it with the input
+			if (std::strcmp(argv[i], "--verify") == 0)
+			{
+				dec.setVerify(true);
+				continue;
+			}
+
+			// keep the sources between runs, unchanged files are not decompiled again
+			if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+			{
+				dec.setCache(argv[++i]);
+				continue;
+			}
+
+			// the least recently used sources are removed above this size
+			if (std::strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+			{
+				dec.setCacheSize(std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024);
+				continue;
+			}
+
+			// functions found in several files are decompiled once
+			if (std::strcmp(argv[i], "--dedup") == 0)
+			{
+				dec.setDedup(true);
+				continue;
+			}
+
+			// phase timings and counters, with the queue depths of parallel runs
+			if (std::strcmp(argv[i], "--stats") == 0)
+			{
+				dec.setStats(true);
+				continue;
+			}
+
+			// the same per file
+			if (std::strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc)
+			{
+				dec.setStats(true);
+				dec.setStatsFile(argv[++i]);
+				continue;
+			}
+
+			// decompile the folder, then again whatever changes in it until stopped
+			if (std::strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+			{
+				dec.watchPath(argv[++i]);
+				continue;
+			}
+
+			// answer the requests of other programs on a unix socket until stopped
+			if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+			{
+				dec.serve(argv[++i]);
+				continue;
+			}
+
 			dec.processPath(std::string(argv[i]));
 		}
 
+		dec.printStats();
+
 		std::cout << "\nDone!\n";
 	}
 
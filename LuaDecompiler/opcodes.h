@@ -0,0 +1,115 @@
+#pragma once
+#include "lopcodes.h"
+
+// what the decompiler needs to know about an opcode of lopcodes.h.
+// pops and pushes follow the stack columns there, the values an
+//  instruction expects on the stack and the ones it leaves in their place
+struct OpInfo
+{
+	// how the operands are packed, K, L and N are U and J is S
+	enum Format { NONE, U, S, AB };
+
+	enum Category
+	{
+		END,
+		VALUE,			// pushes or pops values
+		STATEMENT,		// calls, returns and assignments
+		COMPARE_JUMP,	// compares the two values on top
+		TEST_JUMP,		// tests the value on top
+		JUMP,
+		LOOP			// for loop preparation and back jump
+	};
+
+	// depends on the operands
+	static const int VARIABLE = -1;
+
+	OpCode op;
+	const char* name;
+	Format format;
+	int pops;
+	int pushes;
+	Category category;
+};
+
+// indexed by OpCode
+constexpr OpInfo opInfos[] =
+{
+	{ OP_END, "END", OpInfo::NONE, 0, 0, OpInfo::END },
+	{ OP_RETURN, "RETURN", OpInfo::U, OpInfo::VARIABLE, 0, OpInfo::STATEMENT },
+
+	{ OP_CALL, "CALL", OpInfo::AB, OpInfo::VARIABLE, OpInfo::VARIABLE, OpInfo::STATEMENT },
+	{ OP_TAILCALL, "TAILCALL", OpInfo::AB, OpInfo::VARIABLE, 0, OpInfo::STATEMENT },
+
+	{ OP_PUSHNIL, "PUSHNIL", OpInfo::U, 0, OpInfo::VARIABLE, OpInfo::VALUE },
+	{ OP_POP, "POP", OpInfo::U, OpInfo::VARIABLE, 0, OpInfo::VALUE },
+
+	{ OP_PUSHINT, "PUSHINT", OpInfo::S, 0, 1, OpInfo::VALUE },
+	{ OP_PUSHSTRING, "PUSHSTRING", OpInfo::U, 0, 1, OpInfo::VALUE },
+	{ OP_PUSHNUM, "PUSHNUM", OpInfo::U, 0, 1, OpInfo::VALUE },
+	{ OP_PUSHNEGNUM, "PUSHNEGNUM", OpInfo::U, 0, 1, OpInfo::VALUE },
+
+	{ OP_PUSHUPVALUE, "PUSHUPVALUE", OpInfo::U, 0, 1, OpInfo::VALUE },
+
+	{ OP_GETLOCAL, "GETLOCAL", OpInfo::U, 0, 1, OpInfo::VALUE },
+	{ OP_GETGLOBAL, "GETGLOBAL", OpInfo::U, 0, 1, OpInfo::VALUE },
+
+	{ OP_GETTABLE, "GETTABLE", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_GETDOTTED, "GETDOTTED", OpInfo::U, 1, 1, OpInfo::VALUE },
+	{ OP_GETINDEXED, "GETINDEXED", OpInfo::U, 1, 1, OpInfo::VALUE },
+	{ OP_PUSHSELF, "PUSHSELF", OpInfo::U, 1, 2, OpInfo::VALUE },
+
+	{ OP_CREATETABLE, "CREATETABLE", OpInfo::U, 0, 1, OpInfo::VALUE },
+
+	{ OP_SETLOCAL, "SETLOCAL", OpInfo::U, 1, 0, OpInfo::STATEMENT },
+	{ OP_SETGLOBAL, "SETGLOBAL", OpInfo::U, 1, 0, OpInfo::STATEMENT },
+	{ OP_SETTABLE, "SETTABLE", OpInfo::AB, OpInfo::VARIABLE, 0, OpInfo::STATEMENT },
+
+	{ OP_SETLIST, "SETLIST", OpInfo::AB, OpInfo::VARIABLE, 1, OpInfo::VALUE },
+	{ OP_SETMAP, "SETMAP", OpInfo::U, OpInfo::VARIABLE, 1, OpInfo::VALUE },
+
+	{ OP_ADD, "ADD", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_ADDI, "ADDI", OpInfo::S, 1, 1, OpInfo::VALUE },
+	{ OP_SUB, "SUB", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_MULT, "MULT", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_DIV, "DIV", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_POW, "POW", OpInfo::NONE, 2, 1, OpInfo::VALUE },
+	{ OP_CONCAT, "CONCAT", OpInfo::U, OpInfo::VARIABLE, 1, OpInfo::VALUE },
+	{ OP_MINUS, "MINUS", OpInfo::NONE, 1, 1, OpInfo::VALUE },
+	{ OP_NOT, "NOT", OpInfo::NONE, 1, 1, OpInfo::VALUE },
+
+	{ OP_JMPNE, "JMPNE", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+	{ OP_JMPEQ, "JMPEQ", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+	{ OP_JMPLT, "JMPLT", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+	{ OP_JMPLE, "JMPLE", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+	{ OP_JMPGT, "JMPGT", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+	{ OP_JMPGE, "JMPGE", OpInfo::S, 2, 0, OpInfo::COMPARE_JUMP },
+
+	// JMPONT and JMPONF keep the value when they jump, it is taken
+	//  along with the jump until the end of the expression
+	{ OP_JMPT, "JMPT", OpInfo::S, 1, 0, OpInfo::TEST_JUMP },
+	{ OP_JMPF, "JMPF", OpInfo::S, 1, 0, OpInfo::TEST_JUMP },
+	{ OP_JMPONT, "JMPONT", OpInfo::S, 1, 0, OpInfo::TEST_JUMP },
+	{ OP_JMPONF, "JMPONF", OpInfo::S, 1, 0, OpInfo::TEST_JUMP },
+	{ OP_JMP, "JMP", OpInfo::S, 0, 0, OpInfo::JUMP },
+
+	{ OP_PUSHNILJMP, "PUSHNILJMP", OpInfo::NONE, 0, 1, OpInfo::VALUE },
+
+	// the control values stay on the stack until the loop ends
+	{ OP_FORPREP, "FORPREP", OpInfo::S, 3, 3, OpInfo::LOOP },
+	{ OP_FORLOOP, "FORLOOP", OpInfo::S, 3, 0, OpInfo::LOOP },
+
+	{ OP_LFORPREP, "LFORPREP", OpInfo::S, 1, 3, OpInfo::LOOP },
+	{ OP_LFORLOOP, "LFORLOOP", OpInfo::S, 3, 0, OpInfo::LOOP },
+
+	{ OP_CLOSURE, "CLOSURE", OpInfo::AB, OpInfo::VARIABLE, 1, OpInfo::VALUE }
+};
+
+static_assert(sizeof(opInfos) / sizeof(opInfos[0]) == NUM_OPCODES, "opInfos is missing opcodes of lopcodes.h");
+
+// every entry sits at the index of its opcode
+constexpr bool isOrdered(int index)
+{
+	return index == NUM_OPCODES || (opInfos[index].op == index && isOrdered(index + 1));
+}
+
+static_assert(isOrdered(0), "opInfos is out of order with lopcodes.h");
@@ -0,0 +1,201 @@
+#include "outputwriter.h"
+#include <chrono>
+#include <filesystem>
+#include "stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// the caller blocks once this much source is waiting to be written
+	const size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+
+#ifdef _WIN32
+	bool writeWhole(const std::string &path, std::string &contents)
+	{
+		// the files used to be written in text mode, keep their line endings
+		std::string text;
+		text.reserve(contents.size() + contents.size() / 16);
+		for (char c : contents)
+		{
+			if (c == '\n')
+				text += '\r';
+			text += c;
+		}
+
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		const char* data = text.data();
+		size_t left = text.size();
+		while (left > 0)
+		{
+			DWORD chunk = left > 0x40000000 ? 0x40000000 : static_cast<DWORD>(left);
+			DWORD written = 0;
+			if (!WriteFile(file, data, chunk, &written, NULL) || written == 0)
+			{
+				CloseHandle(file);
+				return false;
+			}
+			data += written;
+			left -= written;
+		}
+
+		return CloseHandle(file) != 0;
+	}
+#else
+	bool writeWhole(const std::string &path, std::string &contents)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+			return false;
+
+		const char* data = contents.data();
+		size_t left = contents.size();
+		while (left > 0)
+		{
+			ssize_t written = ::write(fd, data, left);
+			if (written <= 0)
+			{
+				close(fd);
+				return false;
+			}
+			data += written;
+			left -= written;
+		}
+
+		return close(fd) == 0;
+	}
+#endif
+}
+
+OutputWriter::OutputWriter(bool threaded)
+	: m_totals(), m_queuedBytes(0), m_busy(false), m_stop(false), m_threaded(threaded)
+{
+	if (m_threaded)
+		m_thread = std::thread(&OutputWriter::writerLoop, this);
+}
+
+OutputWriter::~OutputWriter()
+{
+	if (!m_threaded)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_queued.notify_one();
+	m_thread.join();
+}
+
+void OutputWriter::write(const std::string &path, std::string contents)
+{
+	File file = { path, std::move(contents) };
+	if (!m_threaded)
+	{
+		writeFile(file);
+		return;
+	}
+
+	size_t size = file.contents.size();
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_written.wait(lock, [&] { return m_queuedBytes < MAX_QUEUED_BYTES; });
+		m_files.push_back(std::move(file));
+		m_queuedBytes += size;
+	}
+	m_queued.notify_one();
+}
+
+std::vector<std::string> OutputWriter::flush()
+{
+	std::vector<std::string> failed;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_written.wait(lock, [&] { return m_files.empty() && !m_busy; });
+	failed.swap(m_failed);
+	return failed;
+}
+
+OutputWriter::Totals OutputWriter::totals()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_totals;
+}
+
+void OutputWriter::writerLoop()
+{
+	std::vector<File> batch;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_busy = false;
+			m_written.notify_all();
+
+			m_queued.wait(lock, [&] { return m_stop || !m_files.empty(); });
+			// finish the queue before stopping
+			if (m_files.empty())
+				return;
+
+			// take everything queued at once, the caller keeps adding to an empty vector
+			batch.swap(m_files);
+			m_busy = true;
+		}
+
+		size_t written = 0;
+		for (File &file : batch)
+		{
+			writeFile(file);
+			written += file.contents.size();
+		}
+		batch.clear();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queuedBytes -= written;
+	}
+}
+
+void OutputWriter::writeFile(File &file)
+{
+	std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+	double cpuStart = threadCpuSeconds();
+
+	createDirectories(file.path);
+	bool written = writeWhole(file.path, file.contents);
+
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	double cpuSeconds = threadCpuSeconds() - cpuStart;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!written)
+	{
+		m_failed.push_back(file.path);
+		return;
+	}
+	++m_totals.files;
+	m_totals.bytes += file.contents.size();
+	m_totals.wallSeconds += wallSeconds;
+	m_totals.cpuSeconds += cpuSeconds;
+}
+
+void OutputWriter::createDirectories(const std::string &path)
+{
+	using namespace std::experimental;
+
+	std::string parent = filesystem::path(path).parent_path().string();
+	if (parent.empty() || !m_directories.insert(parent).second)
+		return;
+
+	std::error_code error;
+	filesystem::create_directories(parent, error);
+}
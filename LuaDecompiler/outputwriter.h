@@ -0,0 +1,69 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// writes the decompiled files.
+// every file goes out with a single write of its whole buffer, and the
+//  directories are created once and remembered instead of being checked
+//  for every file. with a thread of its own the files are written in
+//  batches behind the caller, which only waits when too much is queued
+class OutputWriter
+{
+public:
+	// everything written so far
+	struct Totals
+	{
+		size_t files;
+		size_t bytes;
+		double wallSeconds;
+		double cpuSeconds;
+	};
+
+	explicit OutputWriter(bool threaded);
+	// writes whatever is still queued
+	~OutputWriter();
+
+	// prevent copying
+	OutputWriter(OutputWriter const&) = delete;
+	void operator=(OutputWriter const&) = delete;
+
+	// the parent directories of path are created as needed
+	void write(const std::string &path, std::string contents);
+
+	// waits for the queued files and hands over the paths that could not be written
+	std::vector<std::string> flush();
+
+	// only complete after a flush
+	Totals totals();
+
+private:
+	struct File
+	{
+		std::string path;
+		std::string contents;
+	};
+
+	void writerLoop();
+	void writeFile(File &file);
+	void createDirectories(const std::string &path);
+
+	// parents of the files written so far
+	std::unordered_set<std::string> m_directories;
+	std::vector<std::string> m_failed;
+	Totals m_totals;
+
+	std::mutex m_mutex;
+	std::condition_variable m_queued;
+	std::condition_variable m_written;
+	std::vector<File> m_files;
+	size_t m_queuedBytes;
+	// the writer thread holds a batch it took from m_files
+	bool m_busy;
+	bool m_stop;
+	bool m_threaded;
+	std::thread m_thread;
+};
@@ -0,0 +1,249 @@
+#include "resultcache.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "hash.h"
+
+namespace
+{
+	// bump whenever the decompiler's output changes, older entries are then never hit
+	const char* const VERSION = "luadec-2";
+
+	// first line of every entry, followed by its sizes
+	const char* const MAGIC = "LUADEC1";
+	const char* const EXTENSION = ".entry";
+
+	bool readWhole(const std::string &path, std::string &contents)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		contents = buffer.str();
+		return true;
+	}
+
+	bool parseEntry(const std::string &contents, ResultCache::Entry &entry)
+	{
+		size_t lineEnd = contents.find('\n');
+		if (lineEnd == std::string::npos)
+			return false;
+
+		std::istringstream header(contents.substr(0, lineEnd));
+		std::string magic;
+		int success = 0;
+		size_t errorsSize = 0;
+		size_t sourceSize = 0;
+		if (!(header >> magic >> success >> errorsSize >> sourceSize) || magic != MAGIC)
+			return false;
+		if (contents.size() - lineEnd - 1 != errorsSize + sourceSize)
+			return false;
+
+		entry.success = success != 0;
+		entry.errors = contents.substr(lineEnd + 1, errorsSize);
+		entry.source = contents.substr(lineEnd + 1 + errorsSize);
+		return true;
+	}
+
+	bool parseKey(const std::string &name, uint64_t &key)
+	{
+		if (name.size() != 16 || name.find_first_not_of("0123456789abcdef") != std::string::npos)
+			return false;
+		key = std::stoull(name, nullptr, 16);
+		return true;
+	}
+}
+
+ResultCache::ResultCache(const std::string &directory, uint64_t maxBytes)
+	: m_directory(directory), m_maxBytes(maxBytes), m_bytes(0), m_clock(0), m_counters()
+{
+	scan();
+}
+
+void ResultCache::setMaxBytes(uint64_t maxBytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_maxBytes = maxBytes;
+	if (m_bytes > m_maxBytes)
+		evict();
+}
+
+uint64_t ResultCache::chunkKey(const std::string &chunk, const std::string &settings) const
+{
+	uint64_t seed = hashBytes(VERSION, std::char_traits<char>::length(VERSION), 0);
+	seed = hashBytes(settings.data(), settings.size(), seed);
+	return hashBytes(chunk.data(), chunk.size(), seed);
+}
+
+bool ResultCache::lookup(uint64_t key, Entry &entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_index.find(key) == m_index.end())
+		{
+			++m_counters.misses;
+			return false;
+		}
+	}
+
+	// read without holding the lock, other threads keep looking up
+	std::string path = entryPath(key);
+	std::string contents;
+	bool valid = readWhole(path, contents) && parseEntry(contents, entry);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto indexed = m_index.find(key);
+	if (!valid)
+	{
+		// removed by another run or damaged, it is written again after the miss
+		if (indexed != m_index.end())
+		{
+			m_bytes -= indexed->second.bytes;
+			m_index.erase(indexed);
+		}
+		std::remove(path.c_str());
+		++m_counters.misses;
+		return false;
+	}
+
+	if (indexed != m_index.end())
+		indexed->second.lastUse = ++m_clock;
+	++m_counters.hits;
+
+	// the next run orders the entries by their files' times
+	std::error_code error;
+	std::experimental::filesystem::last_write_time(path, std::experimental::filesystem::file_time_type::clock::now(), error);
+	return true;
+}
+
+void ResultCache::store(uint64_t key, const Entry &entry)
+{
+	using namespace std::experimental;
+
+	std::string path = entryPath(key);
+	std::ostringstream header;
+	header << MAGIC << ' ' << (entry.success ? 1 : 0) << ' ' << entry.errors.size() << ' ' << entry.source.size() << '\n';
+	std::string contents = header.str() + entry.errors + entry.source;
+
+	// written aside and renamed, so a lookup never reads half an entry
+	std::ostringstream tempPath;
+	tempPath << path << '.' << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	std::error_code error;
+	filesystem::create_directories(filesystem::path(path).parent_path(), error);
+	{
+		std::ofstream file(tempPath.str(), std::ios::binary | std::ios::trunc);
+		if (!file || !file.write(contents.data(), contents.size()))
+			return;
+	}
+	filesystem::rename(tempPath.str(), path, error);
+	if (error)
+	{
+		std::remove(tempPath.str().c_str());
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Indexed &indexed = m_index[key];
+	m_bytes += contents.size() - indexed.bytes;
+	indexed.bytes = contents.size();
+	indexed.lastUse = ++m_clock;
+	++m_counters.stores;
+
+	if (m_bytes > m_maxBytes)
+		evict();
+}
+
+ResultCache::Counters ResultCache::counters()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Counters counters = m_counters;
+	counters.entries = m_index.size();
+	counters.bytes = m_bytes;
+	return counters;
+}
+
+std::string ResultCache::entryPath(uint64_t key) const
+{
+	// the first byte picks a subdirectory, keeping the directories small
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+	std::experimental::filesystem::path path(m_directory);
+	path /= std::string(name, 2);
+	path /= std::string(name) + EXTENSION;
+	return path.string();
+}
+
+void ResultCache::scan()
+{
+	using namespace std::experimental;
+
+	std::error_code error;
+	filesystem::create_directories(m_directory, error);
+
+	struct Found
+	{
+		uint64_t key;
+		uint64_t bytes;
+		filesystem::file_time_type time;
+	};
+	std::vector<Found> found;
+
+	filesystem::recursive_directory_iterator dir(m_directory, error), end;
+	for (; !error && dir != end; dir.increment(error))
+	{
+		const filesystem::path &path = dir->path();
+		Found entry;
+		if (path.extension() != EXTENSION || !parseKey(path.stem().string(), entry.key))
+			continue;
+
+		std::error_code fileError;
+		entry.bytes = filesystem::file_size(path, fileError);
+		entry.time = filesystem::last_write_time(path, fileError);
+		if (!fileError)
+			found.push_back(entry);
+	}
+
+	std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) { return a.time < b.time; });
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const Found &entry : found)
+	{
+		Indexed &indexed = m_index[entry.key];
+		indexed.bytes = entry.bytes;
+		indexed.lastUse = ++m_clock;
+		m_bytes += entry.bytes;
+	}
+
+	if (m_bytes > m_maxBytes)
+		evict();
+}
+
+void ResultCache::evict()
+{
+	// a tenth below the cap, so the next stores do not evict again right away
+	uint64_t target = m_maxBytes - m_maxBytes / 10;
+
+	std::vector<std::pair<uint64_t, uint64_t>> byAge;
+	byAge.reserve(m_index.size());
+	for (const auto &indexed : m_index)
+		byAge.emplace_back(indexed.second.lastUse, indexed.first);
+	std::sort(byAge.begin(), byAge.end());
+
+	for (const auto &oldest : byAge)
+	{
+		if (m_bytes <= target)
+			break;
+
+		auto indexed = m_index.find(oldest.second);
+		m_bytes -= indexed->second.bytes;
+		m_index.erase(indexed);
+		std::remove(entryPath(oldest.second).c_str());
+		++m_counters.evictions;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// decompiled sources kept on disk between runs.
+// an entry is keyed by the hash of the chunk's bytes and of the settings
+//  changing the output, so an unchanged file is served without loading
+//  or decompiling it. every entry is a file below the cache directory,
+//  once they take more than the size cap the least recently used go
+class ResultCache
+{
+public:
+	struct Entry
+	{
+		bool success;
+		std::string errors;
+		std::string source;
+	};
+
+	struct Counters
+	{
+		size_t hits;
+		size_t misses;
+		size_t stores;
+		size_t evictions;
+		size_t entries;
+		uint64_t bytes;
+	};
+
+	// the entries already in directory are indexed, it is created if needed
+	ResultCache(const std::string &directory, uint64_t maxBytes);
+
+	// prevent copying
+	ResultCache(ResultCache const&) = delete;
+	void operator=(ResultCache const&) = delete;
+
+	void setMaxBytes(uint64_t maxBytes);
+
+	// settings are the options the output depends on
+	uint64_t chunkKey(const std::string &chunk, const std::string &settings) const;
+
+	// lookups and stores may come from several threads
+	bool lookup(uint64_t key, Entry &entry);
+	void store(uint64_t key, const Entry &entry);
+
+	Counters counters();
+
+private:
+	struct Indexed
+	{
+		uint64_t bytes;
+		// larger is more recent, the files' times order the ones found on start
+		uint64_t lastUse;
+	};
+
+	std::string entryPath(uint64_t key) const;
+	void scan();
+	// removes the oldest entries until they fit comfortably, m_mutex is held
+	void evict();
+
+	std::string m_directory;
+	std::mutex m_mutex;
+	std::unordered_map<uint64_t, Indexed> m_index;
+	uint64_t m_maxBytes;
+	uint64_t m_bytes;
+	uint64_t m_clock;
+	Counters m_counters;
+};
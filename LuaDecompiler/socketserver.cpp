@@ -0,0 +1,250 @@
+#include "socketserver.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// pause after accept ran out of handles
+	const int ACCEPT_BACKOFF_MS = 10;
+
+#ifdef _WIN32
+	const SocketHandle INVALID_HANDLE = INVALID_SOCKET;
+
+	void closeHandle(SocketHandle handle)
+	{
+		closesocket(handle);
+	}
+
+	int sendSome(SocketHandle handle, const char* data, size_t size)
+	{
+		return send(handle, data, static_cast<int>(size), 0);
+	}
+
+	int receiveSome(SocketHandle handle, char* data, size_t size)
+	{
+		return recv(handle, data, static_cast<int>(size), 0);
+	}
+
+	bool interrupted()
+	{
+		return false;
+	}
+
+	// the listening socket still works after these, the client was lost
+	//  or there are no handles left until another client hangs up
+	bool acceptCanRetry()
+	{
+		int error = WSAGetLastError();
+		return error == WSAEINTR || error == WSAECONNRESET || error == WSAEMFILE || error == WSAENOBUFS;
+	}
+
+	bool outOfHandles()
+	{
+		int error = WSAGetLastError();
+		return error == WSAEMFILE || error == WSAENOBUFS;
+	}
+
+	// an old socket file would make the bind fail
+	void removeSocketFile(const std::string &path)
+	{
+		DeleteFileA(path.c_str());
+	}
+#else
+	const SocketHandle INVALID_HANDLE = -1;
+
+	void closeHandle(SocketHandle handle)
+	{
+		close(handle);
+	}
+
+	ssize_t sendSome(SocketHandle handle, const char* data, size_t size)
+	{
+		// a client gone before its answer must not end the server with SIGPIPE
+#ifdef MSG_NOSIGNAL
+		return send(handle, data, size, MSG_NOSIGNAL);
+#else
+		return send(handle, data, size, 0);
+#endif
+	}
+
+	ssize_t receiveSome(SocketHandle handle, char* data, size_t size)
+	{
+		return recv(handle, data, size, 0);
+	}
+
+	bool interrupted()
+	{
+		return errno == EINTR;
+	}
+
+	// the listening socket still works after these, the client was lost
+	//  or there are no handles left until another client hangs up
+	bool acceptCanRetry()
+	{
+		switch (errno)
+		{
+		case EINTR:
+		case ECONNABORTED:
+		case EPROTO:
+		case EPERM:
+		case EMFILE:
+		case ENFILE:
+		case ENOBUFS:
+		case ENOMEM:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool outOfHandles()
+	{
+		return errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM;
+	}
+
+	// an old socket file would make the bind fail, other files are left alone
+	void removeSocketFile(const std::string &path)
+	{
+		struct stat status;
+		if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+			unlink(path.c_str());
+	}
+#endif
+}
+
+FramedSocket::FramedSocket(SocketHandle handle)
+	: m_handle(handle)
+{}
+
+FramedSocket::~FramedSocket()
+{
+	closeHandle(m_handle);
+}
+
+bool FramedSocket::readFrame(std::string &frame, size_t maxSize)
+{
+	unsigned char header[4];
+	if (!readAll(reinterpret_cast<char*>(header), sizeof(header)))
+		return false;
+
+	size_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<size_t>(header[3]) << 24;
+	if (size > maxSize)
+		return false;
+
+	frame.resize(size);
+	return size == 0 || readAll(&frame[0], size);
+}
+
+bool FramedSocket::writeFrame(const std::string &frame)
+{
+	uint32_t size = static_cast<uint32_t>(frame.size());
+	std::string buffer;
+	buffer.reserve(4 + frame.size());
+	for (int i = 0; i < 4; ++i)
+		buffer += static_cast<char>(size >> (8 * i));
+	buffer += frame;
+
+	const char* p = buffer.data();
+	size_t left = buffer.size();
+	while (left > 0)
+	{
+		auto sent = sendSome(m_handle, p, left);
+		if (sent <= 0)
+		{
+			if (sent < 0 && interrupted())
+				continue;
+			return false;
+		}
+		p += sent;
+		left -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool FramedSocket::readAll(char* data, size_t size)
+{
+	while (size > 0)
+	{
+		auto received = receiveSome(m_handle, data, size);
+		if (received <= 0)
+		{
+			if (received < 0 && interrupted())
+				continue;
+			return false;
+		}
+		data += received;
+		size -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+SocketServer::SocketServer(const std::string &path)
+	: m_path(path), m_handle(INVALID_HANDLE), m_valid(false)
+{
+#ifdef _WIN32
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		return;
+#endif
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return;
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+
+	m_handle = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_handle == INVALID_HANDLE)
+		return;
+
+	removeSocketFile(path);
+	m_valid = bind(m_handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+		listen(m_handle, SOMAXCONN) == 0;
+}
+
+SocketServer::~SocketServer()
+{
+	if (m_handle != INVALID_HANDLE)
+	{
+		closeHandle(m_handle);
+		if (m_valid)
+			removeSocketFile(m_path);
+	}
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+bool SocketServer::valid() const
+{
+	return m_valid;
+}
+
+std::unique_ptr<FramedSocket> SocketServer::accept()
+{
+	for (;;)
+	{
+		SocketHandle client = ::accept(m_handle, nullptr, nullptr);
+		if (client != INVALID_HANDLE)
+			return std::unique_ptr<FramedSocket>(new FramedSocket(client));
+		if (!acceptCanRetry())
+			return nullptr;
+		// retrying at once would only spin until a handle is free again
+		if (outOfHandles())
+			std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_BACKOFF_MS));
+	}
+}
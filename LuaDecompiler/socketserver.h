@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+typedef uintptr_t SocketHandle;
+#else
+typedef int SocketHandle;
+#endif
+
+// one end of a stream connection carrying frames, each a 32 bit little
+//  endian length followed by that many bytes
+class FramedSocket
+{
+public:
+	// takes over handle and closes it
+	explicit FramedSocket(SocketHandle handle);
+	~FramedSocket();
+
+	// prevent copying, the handle is owned
+	FramedSocket(FramedSocket const&) = delete;
+	void operator=(FramedSocket const&) = delete;
+
+	// false once the other end is closed, or if the frame is longer than maxSize
+	bool readFrame(std::string &frame, size_t maxSize);
+	// sends the length and the frame with a single write
+	bool writeFrame(const std::string &frame);
+
+private:
+	bool readAll(char* data, size_t size);
+
+	SocketHandle m_handle;
+};
+
+// a unix domain socket listening for clients, AF_UNIX on windows 10 too.
+// a socket file left behind by an earlier server is replaced
+class SocketServer
+{
+public:
+	explicit SocketServer(const std::string &path);
+	~SocketServer();
+
+	// prevent copying, the socket is owned
+	SocketServer(SocketServer const&) = delete;
+	void operator=(SocketServer const&) = delete;
+
+	// false if path could not be bound
+	bool valid() const;
+
+	// blocks until a client connects, null once the socket is broken.
+	//  a client lost while connecting or running out of handles is retried
+	std::unique_ptr<FramedSocket> accept();
+
+private:
+	std::string m_path;
+	SocketHandle m_handle;
+	bool m_valid;
+};
@@ -0,0 +1,254 @@
+#include "stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include "opcodes.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace
+{
+	const char* const phaseNames[FileStats::NUM_PHASES] = { "load", "decompile", "write", "format", "verify" };
+
+	std::string escapeJson(const std::string &str)
+	{
+		std::string result;
+		for (char c : str)
+		{
+			if (c == '"' || c == '\\')
+				result += '\\';
+			result += c;
+		}
+		return result;
+	}
+
+	// the paths may hold commas, csv quotes them and doubles the quotes inside
+	std::string escapeCsv(const std::string &str)
+	{
+		std::string result = "\"";
+		for (char c : str)
+		{
+			if (c == '"')
+				result += '"';
+			result += c;
+		}
+		return result + '"';
+	}
+}
+
+FileStats::FileStats()
+	: wallSeconds(), cpuSeconds(), bytesRead(0), bytesWritten(0), functions(0),
+	opcodes(), allocations(0), allocatedBytes(0)
+{}
+
+void FileStats::addCounts(const FileStats &other)
+{
+	bytesRead += other.bytesRead;
+	bytesWritten += other.bytesWritten;
+	functions += other.functions;
+	for (int i = 0; i < NUM_OPCODES; ++i)
+		opcodes[i] += other.opcodes[i];
+	allocations += other.allocations;
+	allocatedBytes += other.allocatedBytes;
+}
+
+size_t FileStats::instructions() const
+{
+	size_t total = 0;
+	for (int i = 0; i < NUM_OPCODES; ++i)
+		total += opcodes[i];
+	return total;
+}
+
+const char* phaseName(FileStats::Phase phase)
+{
+	return phaseNames[phase];
+}
+
+double threadCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0.0;
+
+	// both count 100ns ticks
+	ULARGE_INTEGER kernelTicks, userTicks;
+	kernelTicks.LowPart = kernel.dwLowDateTime;
+	kernelTicks.HighPart = kernel.dwHighDateTime;
+	userTicks.LowPart = user.dwLowDateTime;
+	userTicks.HighPart = user.dwHighDateTime;
+	return (kernelTicks.QuadPart + userTicks.QuadPart) * 1e-7;
+#else
+	timespec now;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0)
+		return 0.0;
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+PhaseTimer::PhaseTimer(FileStats* stats, FileStats::Phase phase)
+	: m_stats(stats), m_phase(phase), m_cpuStart(0.0)
+{
+	if (m_stats == nullptr)
+		return;
+
+	m_wallStart = std::chrono::steady_clock::now();
+	m_cpuStart = threadCpuSeconds();
+}
+
+PhaseTimer::~PhaseTimer()
+{
+	if (m_stats == nullptr)
+		return;
+
+	m_stats->wallSeconds[m_phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wallStart).count();
+	m_stats->cpuSeconds[m_phase] += threadCpuSeconds() - m_cpuStart;
+}
+
+StatsTable::StatsTable()
+	: m_numFiles(0), m_savedFiles(0), m_savedBytes(0), m_saveWallSeconds(0.0), m_saveCpuSeconds(0.0),
+	m_keepFiles(false)
+{}
+
+void StatsTable::setKeepFiles(bool keepFiles)
+{
+	m_keepFiles = keepFiles;
+}
+
+void StatsTable::add(const FileStats &stats)
+{
+	for (int i = 0; i < FileStats::NUM_PHASES; ++i)
+	{
+		m_total.wallSeconds[i] += stats.wallSeconds[i];
+		m_total.cpuSeconds[i] += stats.cpuSeconds[i];
+	}
+	m_total.addCounts(stats);
+	++m_numFiles;
+
+	if (m_keepFiles)
+		m_files.push_back(stats);
+}
+
+void StatsTable::addSaved(size_t files, size_t bytes, double wallSeconds, double cpuSeconds)
+{
+	m_savedFiles += files;
+	m_savedBytes += bytes;
+	m_saveWallSeconds += wallSeconds;
+	m_saveCpuSeconds += cpuSeconds;
+}
+
+void StatsTable::printSummary(std::ostream &out) const
+{
+	char line[256];
+
+	out << "\nStats, " << m_numFiles << " files\n";
+	std::snprintf(line, sizeof(line), "  %-10s %12s %12s\n", "phase", "wall s", "cpu s");
+	out << line;
+	for (int i = 0; i < FileStats::NUM_PHASES; ++i)
+	{
+		std::snprintf(line, sizeof(line), "  %-10s %12.4f %12.4f\n",
+			phaseNames[i], m_total.wallSeconds[i], m_total.cpuSeconds[i]);
+		out << line;
+	}
+	std::snprintf(line, sizeof(line), "  %-10s %12.4f %12.4f  (%zu files on the writer)\n",
+		"save", m_saveWallSeconds, m_saveCpuSeconds, m_savedFiles);
+	out << line;
+
+	out << "  bytes read " << m_total.bytesRead << ", written " << m_total.bytesWritten << '\n';
+	out << "  functions " << m_total.functions << ", instructions " << m_total.instructions() << '\n';
+	out << "  allocations " << m_total.allocations << ", " << m_total.allocatedBytes << " bytes\n";
+
+	// most frequent first
+	std::vector<int> order;
+	for (int i = 0; i < NUM_OPCODES; ++i)
+	{
+		if (m_total.opcodes[i] != 0)
+			order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+	{
+		return m_total.opcodes[a] > m_total.opcodes[b];
+	});
+
+	double instructions = static_cast<double>(m_total.instructions());
+	for (int op : order)
+	{
+		std::snprintf(line, sizeof(line), "  %-12s %12zu %7.2f%%\n",
+			opInfos[op].name, m_total.opcodes[op], 100.0 * m_total.opcodes[op] / instructions);
+		out << line;
+	}
+}
+
+bool StatsTable::writeFiles(const std::string &path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file)
+		return false;
+
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json)
+		writeJson(file);
+	else
+		writeCsv(file);
+	return static_cast<bool>(file);
+}
+
+void StatsTable::writeCsv(std::ostream &out) const
+{
+	out << "path";
+	for (int i = 0; i < FileStats::NUM_PHASES; ++i)
+		out << ',' << phaseNames[i] << "_wall," << phaseNames[i] << "_cpu";
+	out << ",bytes_read,bytes_written,functions,instructions,allocations,allocated_bytes";
+	for (int i = 0; i < NUM_OPCODES; ++i)
+		out << ',' << opInfos[i].name;
+	out << '\n';
+
+	for (const FileStats &stats : m_files)
+	{
+		out << escapeCsv(stats.path);
+		for (int i = 0; i < FileStats::NUM_PHASES; ++i)
+			out << ',' << stats.wallSeconds[i] << ',' << stats.cpuSeconds[i];
+		out << ',' << stats.bytesRead << ',' << stats.bytesWritten << ',' << stats.functions
+			<< ',' << stats.instructions() << ',' << stats.allocations << ',' << stats.allocatedBytes;
+		for (int i = 0; i < NUM_OPCODES; ++i)
+			out << ',' << stats.opcodes[i];
+		out << '\n';
+	}
+}
+
+void StatsTable::writeJson(std::ostream &out) const
+{
+	out << "[\n";
+	for (size_t n = 0; n < m_files.size(); ++n)
+	{
+		const FileStats &stats = m_files[n];
+		out << "  {\"path\": \"" << escapeJson(stats.path) << "\", \"phases\": {";
+		for (int i = 0; i < FileStats::NUM_PHASES; ++i)
+		{
+			out << (i != 0 ? ", " : "") << '"' << phaseNames[i] << "\": {\"wall\": " << stats.wallSeconds[i]
+				<< ", \"cpu\": " << stats.cpuSeconds[i] << '}';
+		}
+		out << "}, \"bytes_read\": " << stats.bytesRead << ", \"bytes_written\": " << stats.bytesWritten
+			<< ", \"functions\": " << stats.functions << ", \"instructions\": " << stats.instructions()
+			<< ", \"allocations\": " << stats.allocations << ", \"allocated_bytes\": " << stats.allocatedBytes
+			<< ", \"opcodes\": {";
+
+		// only the opcodes the file uses
+		bool first = true;
+		for (int i = 0; i < NUM_OPCODES; ++i)
+		{
+			if (stats.opcodes[i] == 0)
+				continue;
+			out << (first ? "" : ", ") << '"' << opInfos[i].name << "\": " << stats.opcodes[i];
+			first = false;
+		}
+		out << "}}" << (n + 1 < m_files.size() ? "," : "") << '\n';
+	}
+	out << "]\n";
+}
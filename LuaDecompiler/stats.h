@@ -0,0 +1,96 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "lopcodes.h"
+
+// where the time and memory of a single file went, gathered with --stats
+struct FileStats
+{
+	enum Phase
+	{
+		LOAD,		// reading and undumping the chunk
+		DECOMPILE,	// building the tree of every function
+		WRITE,		// turning the tree into source text
+		FORMAT,		// the lexer based formatter, --reformat only
+		VERIFY,		// compiling the source back and comparing it, --verify only
+		NUM_PHASES
+	};
+
+	FileStats();
+
+	// adds the counts of other, the times are left alone.
+	// nested functions decompiled on other threads come back this way
+	void addCounts(const FileStats &other);
+
+	size_t instructions() const;
+
+	std::string path;
+	double wallSeconds[NUM_PHASES];
+	// cpu time of the thread running the phase
+	double cpuSeconds[NUM_PHASES];
+	size_t bytesRead;
+	size_t bytesWritten;
+	size_t functions;
+	size_t opcodes[NUM_OPCODES];
+	// nodes of the tree, allocated from the arenas
+	size_t allocations;
+	size_t allocatedBytes;
+};
+
+const char* phaseName(FileStats::Phase phase);
+
+// cpu time used by the calling thread so far
+double threadCpuSeconds();
+
+// adds the time from construction to destruction to a phase,
+//  does nothing when stats is null
+class PhaseTimer
+{
+public:
+	PhaseTimer(FileStats* stats, FileStats::Phase phase);
+	~PhaseTimer();
+
+	// prevent copying
+	PhaseTimer(PhaseTimer const&) = delete;
+	void operator=(PhaseTimer const&) = delete;
+
+private:
+	FileStats* m_stats;
+	FileStats::Phase m_phase;
+	std::chrono::steady_clock::time_point m_wallStart;
+	double m_cpuStart;
+};
+
+// the stats of every file of a run, summed up for the table
+//  and kept one by one if they are written to a file
+class StatsTable
+{
+public:
+	StatsTable();
+
+	void setKeepFiles(bool keepFiles);
+
+	void add(const FileStats &stats);
+	// files written by an output writer, saving runs on its own thread
+	void addSaved(size_t files, size_t bytes, double wallSeconds, double cpuSeconds);
+
+	void printSummary(std::ostream &out) const;
+	// one row per file, json if path ends in .json and csv otherwise
+	bool writeFiles(const std::string &path) const;
+
+private:
+	void writeCsv(std::ostream &out) const;
+	void writeJson(std::ostream &out) const;
+
+	FileStats m_total;
+	size_t m_numFiles;
+	size_t m_savedFiles;
+	size_t m_savedBytes;
+	double m_saveWallSeconds;
+	double m_saveCpuSeconds;
+	bool m_keepFiles;
+	std::vector<FileStats> m_files;
+};
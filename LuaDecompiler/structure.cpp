@@ -0,0 +1,651 @@
+#include "structure.h"
+#include <algorithm>
+#include <climits>
+
+void ControlStructure::analyze(const Instruction* code, int numCode)
+{
+	m_code = code;
+	m_numCode = numCode;
+	m_numUnstructured = 0;
+
+	Mark empty = {};
+	empty.final = -1;
+	m_marks.assign(numCode + 1, empty);
+	m_regions.clear();
+	m_opens.clear();
+	if (numCode <= 0)
+		return;
+
+	m_cfg.build(code, numCode);
+	resolveJumps();
+	findValues();
+	findConditions();
+	findLoops();
+	buildBlocks();
+}
+
+ControlStructure::Role ControlStructure::role(int pc) const
+{
+	return static_cast<Role>(m_marks[pc].role);
+}
+
+int ControlStructure::numEnds(int pc) const
+{
+	return m_marks[pc].numEnds;
+}
+
+int ControlStructure::numJumps(int pc) const
+{
+	return m_marks[pc].numJumps;
+}
+
+ControlStructure::Header ControlStructure::header(int pc) const
+{
+	return static_cast<Header>(m_marks[pc].header);
+}
+
+bool ControlStructure::isUnstructured(int pc) const
+{
+	return (m_marks[pc].flags & UNSTRUCTURED_BLOCK) != 0;
+}
+
+const std::vector<ControlStructure::Open>& ControlStructure::opens() const
+{
+	return m_opens;
+}
+
+bool ControlStructure::isValueFinal(int pc) const
+{
+	return (m_marks[pc].flags & FINAL) != 0;
+}
+
+bool ControlStructure::hasNilJump(int final) const
+{
+	return (m_marks[final].flags & NIL_JUMP) != 0;
+}
+
+bool ControlStructure::hasSkip(int final) const
+{
+	return (m_marks[final].flags & SKIP) != 0;
+}
+
+int ControlStructure::valueFinal(int pc) const
+{
+	return m_marks[pc].final;
+}
+
+bool ControlStructure::skipAdjust(int pc) const
+{
+	return (m_marks[pc].flags & SKIP_ADJUST) != 0;
+}
+
+int ControlStructure::resolve(int pc) const
+{
+	return m_resolved[pc];
+}
+
+int ControlStructure::numUnstructured() const
+{
+	return m_numUnstructured;
+}
+
+void ControlStructure::resolveJumps()
+{
+	m_resolved.assign(m_numCode + 1, -1);
+	m_resolved[m_numCode] = m_numCode;
+	m_minSource.assign(m_numCode + 1, INT_MAX);
+	m_maxSource.assign(m_numCode + 1, -1);
+	m_jumpIndex.clear();
+
+	// -2 marks the chain being followed, a cycle ends where it closes
+	std::vector<int> chain;
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		int target = jumpTarget(pc);
+		if (target >= 0)
+		{
+			m_minSource[target] = std::min(m_minSource[target], pc);
+			m_maxSource[target] = std::max(m_maxSource[target], pc);
+		}
+
+		int at = pc;
+		while (m_resolved[at] == -1 && opcode(at) == OP_JMP && jumpTarget(at) >= 0)
+		{
+			m_resolved[at] = -2;
+			chain.push_back(at);
+			at = jumpTarget(at);
+		}
+
+		int end = (m_resolved[at] >= 0) ? m_resolved[at] : at;
+		if (m_resolved[at] == -1)
+			m_resolved[at] = at;
+		for (int link : chain)
+			m_resolved[link] = end;
+		chain.clear();
+	}
+
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		if (opcode(pc) == OP_JMP && jumpTarget(pc) >= 0)
+			m_jumpIndex.push_back(std::make_pair(m_resolved[pc], pc));
+	}
+	std::sort(m_jumpIndex.begin(), m_jumpIndex.end());
+}
+
+void ControlStructure::findValues()
+{
+	// the nil and 1 pushed for comparisons used as values
+	std::vector<char> valueLabel(m_numCode + 1, 0);
+
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		OpCode op = opcode(pc);
+		Mark &mark = m_marks[pc];
+
+		if (op == OP_PUSHNILJMP && pc + 2 < m_numCode)
+		{
+			m_marks[pc + 2].flags |= FINAL | NIL_JUMP;
+			valueLabel[pc] = 1;
+			valueLabel[pc + 1] = 1;
+		}
+		else if (op == OP_JMPONT || op == OP_JMPONF)
+		{
+			// the value is kept when jumping, it lands at the end of the expression
+			int target = jumpTarget(pc);
+			if (target >= 0)
+			{
+				mark.role = VALUE;
+				mark.final = target;
+				m_marks[target].flags |= FINAL;
+			}
+			else
+				mark.role = UNSTRUCTURED;
+		}
+		else if (op == OP_JMP && pc + 2 < m_numCode && opcode(pc + 1) == OP_POP && opcode(pc + 2) == OP_PUSHNILJMP
+			&& jumpTarget(pc) == pc + 4)
+		{
+			// JMP, POP 1, PUSHNILJMP, PUSHINT 1, the POP is never run
+			mark.role = VALUE_SKIP;
+			m_marks[pc + 1].flags |= SKIP_ADJUST;
+			m_marks[pc + 4].flags |= SKIP;
+		}
+	}
+
+	m_statements.assign(m_numCode + 1, 0);
+	for (int pc = 0; pc < m_numCode; ++pc)
+		m_statements[pc + 1] = m_statements[pc] + (isStatement(pc) ? 1 : 0);
+
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		OpCode op = opcode(pc);
+		if (op < OP_JMPNE || op > OP_JMPF)
+			continue;
+
+		Mark &mark = m_marks[pc];
+		int target = jumpTarget(pc);
+		if (target < 0)
+		{
+			mark.role = UNSTRUCTURED;
+			continue;
+		}
+
+		if (valueLabel[target])
+		{
+			mark.role = VALUE;
+			mark.final = (opcode(target) == OP_PUSHNILJMP) ? target + 2 : target + 1;
+			continue;
+		}
+
+		// every path through an and/or value meets again at its end
+		int merge = m_cfg.block(m_cfg.blockAt(pc)).ipdom;
+		if (merge >= 0 && merge < m_cfg.numBlocks())
+		{
+			int start = m_cfg.block(merge).start;
+			if ((m_marks[start].flags & FINAL) && target > pc && target <= start)
+			{
+				mark.role = VALUE;
+				mark.final = start;
+				continue;
+			}
+		}
+
+		mark.role = COND;
+	}
+}
+
+void ControlStructure::findConditions()
+{
+	m_regionAt.assign(m_numCode, -1);
+
+	// jumps separated by plain expressions form a chain, adjacent
+	//  conditions of a chain merge as long as they form a single and/or
+	std::vector<Region> chain;
+	int previous = -1;
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		if (m_marks[pc].role != COND)
+			continue;
+
+		if (previous < 0 || !isPure(previous + 1, pc))
+		{
+			m_regions.insert(m_regions.end(), chain.begin(), chain.end());
+			chain.clear();
+		}
+		previous = pc;
+
+		Region region = { pc, pc, 1, jumpTarget(pc), IF, -1, -1 };
+		chain.push_back(region);
+		while (chain.size() >= 2 && tryMerge(chain[chain.size() - 2], chain.back()))
+			chain.pop_back();
+	}
+	m_regions.insert(m_regions.end(), chain.begin(), chain.end());
+
+	for (size_t i = 0; i < m_regions.size(); ++i)
+	{
+		m_regionAt[m_regions[i].lastPc] = static_cast<int>(i);
+		m_marks[m_regions[i].lastPc].numJumps = m_regions[i].numJumps;
+	}
+}
+
+bool ControlStructure::tryMerge(Region &first, const Region &second) const
+{
+	// a jump landing right behind itself is a statement of its own, unless
+	//  it is the rest of `c or 1` in front of another condition
+	bool empty = isEmpty(first.lastPc, first.target);
+	if (empty && opcode(first.lastPc) == OP_JMPF)
+		return false;
+
+	// the code of second starts right after first, nobody else may land there
+	if (!isReachedOnlyFrom(first.lastPc + 1, first.firstPc, first.lastPc))
+		return false;
+
+	// both leave to the same place, or first skips the test of second.
+	//  the skip is not resolved, a break right behind second would match it too.
+	//  an until has nothing to break from, its exit is threaded past the blocks it ends
+	bool skips = empty || (first.target == second.lastPc + 1)
+		|| (second.target <= second.firstPc && m_resolved[first.target] == m_resolved[second.lastPc + 1]);
+	if (m_resolved[first.target] != m_resolved[second.target] && !skips)
+		return false;
+
+	first.lastPc = second.lastPc;
+	first.numJumps += second.numJumps;
+	first.target = second.target;
+	return true;
+}
+
+void ControlStructure::findLoops()
+{
+	m_candidates.clear();
+
+	// the last backward JMP to a header ends its loop, the others were threaded through it
+	auto isBackJump = [this](int pc, int target)
+	{
+		if (opcode(pc) != OP_JMP || m_marks[pc].role != NONE || jumpTarget(pc) != target || target > pc)
+			return false;
+		int block = m_cfg.blockAt(pc);
+		return !m_cfg.isReachable(block) || m_cfg.dominates(m_cfg.blockAt(target), block);
+	};
+
+	std::vector<int> loopEnd(m_numCode, -1);
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		if (isBackJump(pc, jumpTarget(pc)))
+			loopEnd[jumpTarget(pc)] = pc;
+	}
+
+	for (int start = 0; start < m_numCode; ++start)
+	{
+		if (loopEnd[start] < 0)
+			continue;
+
+		// loops sharing a header end with back to back jumps, the innermost first
+		int innermost = loopEnd[start];
+		while (innermost - 1 > start && isBackJump(innermost - 1, start))
+			--innermost;
+
+		// a while ending earlier is found from its condition, which leaves right behind its back jump.
+		//  a break of the outer loop inside makes it the escape of an if at the end of that loop
+		int inner = findRegion(start, innermost);
+		if (inner >= 0)
+		{
+			Region &cond = m_regions[inner];
+			int end = cond.target - 1;
+			auto outerBreak = std::lower_bound(m_jumpIndex.begin(), m_jumpIndex.end(),
+				std::make_pair(m_resolved[loopEnd[start] + 1], cond.lastPc));
+			bool breaksOuter = outerBreak != m_jumpIndex.end()
+				&& outerBreak->first == m_resolved[loopEnd[start] + 1] && outerBreak->second < end;
+			if (end > cond.lastPc && end < innermost && isBackJump(end, start) && !breaksOuter)
+			{
+				m_marks[end].role = LOOP_END;
+				cond.header = WHILE;
+				cond.loopStart = start;
+				cond.loopEnd = end;
+			}
+		}
+
+		for (int end = innermost; end <= loopEnd[start]; ++end)
+		{
+			m_marks[end].role = LOOP_END;
+			int exit = end + 1;
+
+			// a while starts with its condition, which leaves the loop when it fails.
+			//  the exit may have been threaded to an outer loop, never into this one.
+			//  two breaks in front of the back jump belong to `while 1`, the first
+			//  ended the body of an if leaving the loop and nothing reaches the second
+			int region = (end == innermost) ? findRegion(start, end) : -1;
+			auto isBreak = [&](int pc)
+			{
+				return pc > start && opcode(pc) == OP_JMP && jumpTarget(pc) > pc && m_resolved[jumpTarget(pc)] == m_resolved[exit];
+			};
+			bool deadBreak = isBreak(end - 1) && isBreak(end - 2) && !m_cfg.isReachable(m_cfg.blockAt(end - 1));
+			if (region >= 0 && !deadBreak)
+			{
+				Region &cond = m_regions[region];
+				if (m_resolved[cond.target] == m_resolved[exit]
+					&& (cond.target == exit || cond.target <= start || cond.target > end))
+				{
+					cond.header = WHILE;
+					cond.loopStart = start;
+					cond.loopEnd = end;
+					continue;
+				}
+			}
+
+			Candidate loop = { { start, false }, exit, end, exit, -1, end };
+			m_candidates.push_back(loop);
+		}
+	}
+
+	// a condition jumping back to a block dominating it is an until,
+	//  unless it sits in a loop with that header and was threaded to it
+	for (size_t i = 0; i < m_regions.size(); ++i)
+	{
+		Region &cond = m_regions[i];
+		int target = cond.target;
+		if (cond.header != IF || target >= cond.firstPc || loopEnd[target] > cond.lastPc + 1)
+			continue;
+		// nothing reaches a condition right behind a break
+		int block = m_cfg.blockAt(cond.lastPc);
+		if (m_cfg.isReachable(block) && !m_cfg.dominates(m_cfg.blockAt(target), block))
+			continue;
+
+		cond.header = UNTIL;
+		Candidate loop = { { target, true }, cond.lastPc + 1, cond.firstPc, cond.lastPc + 1, static_cast<int>(i), -1 };
+		m_candidates.push_back(loop);
+	}
+
+	std::sort(m_candidates.begin(), m_candidates.end(), [](const Candidate &a, const Candidate &b)
+	{
+		return a.open.pc != b.open.pc ? a.open.pc < b.open.pc : a.end > b.end;
+	});
+}
+
+void ControlStructure::buildBlocks()
+{
+	m_blocks.clear();
+	addBlock(FUNCTION, 0, m_numCode, m_numCode - 1, -1, false);
+	size_t nextCandidate = 0;
+
+	for (int pc = 0; pc < m_numCode; ++pc)
+	{
+		// a then block followed by an else hands over to it
+		while (m_blocks.size() > 1 && m_blocks.back().end <= pc)
+		{
+			Block block = m_blocks.back();
+			m_blocks.pop_back();
+			if (block.emitEnd)
+				++m_marks[pc].numEnds;
+
+			if (block.kind == THEN && block.elseEnd >= 0)
+			{
+				addBlock(ELSE_BLOCK, pc, block.elseEnd, block.elseEnd, -1, true);
+				m_blocks.back().escape = pc - 1;
+			}
+		}
+
+		while (nextCandidate < m_candidates.size() && m_candidates[nextCandidate].open.pc == pc)
+		{
+			const Candidate &loop = m_candidates[nextCandidate++];
+			if (loop.end <= m_blocks.back().end)
+			{
+				addBlock(loop.open.repeat ? REPEAT_BLOCK : LOOP_BLOCK, pc, loop.end, loop.limit, loop.exit, false);
+				m_opens.push_back(loop.open);
+			}
+			else if (loop.open.repeat)
+				m_regions[loop.region].header = IF;
+			else
+				m_marks[loop.backJump].role = NONE;
+		}
+
+		OpCode op = opcode(pc);
+		if (m_regionAt[pc] >= 0)
+		{
+			openCondition(pc, m_regionAt[pc]);
+		}
+		else if (op == OP_FORPREP || op == OP_LFORPREP)
+		{
+			// the jump past the loop may be threaded, the FORLOOP jumping back is not
+			int loopEnd = m_maxSource[pc + 1];
+			OpCode loopOp = (op == OP_FORPREP) ? OP_FORLOOP : OP_LFORLOOP;
+			if (loopEnd > pc && opcode(loopEnd) == loopOp && loopEnd + 1 <= m_blocks.back().end)
+				addBlock(FOR_BLOCK, pc + 1, loopEnd + 1, loopEnd, loopEnd + 1, false);
+		}
+		else if (op == OP_JMP && m_marks[pc].role == NONE)
+		{
+			const Block* loop = innermostLoop();
+			int target = jumpTarget(pc);
+			if (loop != nullptr && target >= 0 && m_resolved[target] == m_resolved[loop->exit])
+			{
+				m_marks[pc].role = BREAK;
+				// POP n, JMP, PUSHNIL n, the locals stay in scope for the decompiler
+				if (pc > 0 && pc + 1 < m_numCode && opcode(pc - 1) == OP_POP && opcode(pc + 1) == OP_PUSHNIL
+					&& GETARG_U(m_code[pc - 1]) == GETARG_U(m_code[pc + 1]) && m_maxSource[pc + 1] < 0)
+				{
+					m_marks[pc - 1].flags |= SKIP_ADJUST;
+					m_marks[pc + 1].flags |= SKIP_ADJUST;
+				}
+			}
+			else if ((target > pc || (loop != nullptr && loop->kind != REPEAT_BLOCK && target >= 0
+				&& m_resolved[target] == m_resolved[loop->start])) && findEnd(pc, target, m_blocks.back().limit) >= 0)
+			{
+				// `if 1 then` loses its condition, only the jump over the else block is left.
+				//  at the end of a loop it was threaded to the header
+				int elseEnd = findEnd(pc, target, m_blocks.back().limit);
+				m_marks[pc].role = CONSTANT_ELSE;
+				addBlock(ELSE_BLOCK, pc + 1, elseEnd, elseEnd, -1, true);
+			}
+			else
+			{
+				m_marks[pc].role = UNSTRUCTURED;
+				++m_numUnstructured;
+			}
+		}
+	}
+}
+
+void ControlStructure::openCondition(int pc, int region)
+{
+	Region &cond = m_regions[region];
+
+	if (cond.header == WHILE)
+	{
+		int end = cond.loopEnd + 1;
+		if (end <= m_blocks.back().end)
+		{
+			m_marks[pc].header = WHILE;
+			addBlock(WHILE_BLOCK, cond.loopStart, end, cond.loopEnd, end, false);
+			return;
+		}
+		m_marks[cond.loopEnd].role = NONE;
+	}
+	else if (cond.header == UNTIL)
+	{
+		const Block &top = m_blocks.back();
+		if (top.kind == REPEAT_BLOCK && top.end == pc + 1)
+		{
+			m_marks[pc].header = UNTIL;
+			return;
+		}
+	}
+
+	cond.header = IF;
+	openIf(pc, region);
+}
+
+void ControlStructure::openIf(int pc, int region)
+{
+	Region &cond = m_regions[region];
+	Block top = m_blocks.back();
+
+	int end = findEnd(pc, cond.target, top.limit);
+	int elseEnd = -1;
+	if (end < 0)
+	{
+		// blocks crossing the enclosing one are closed where it ends
+		end = top.limit;
+		m_marks[pc].flags |= UNSTRUCTURED_BLOCK;
+		++m_numUnstructured;
+	}
+	else if (end - 1 > pc && opcode(end - 1) == OP_JMP && m_marks[end - 1].role == NONE)
+	{
+		// the jump in front of the else label leaves the then block,
+		//  unless it leaves the loop as well. an if followed by a break
+		//  has its jumps threaded to the loop exit, nothing reaches that break
+		int escape = end - 1;
+		int target = jumpTarget(escape);
+		const Block* loop = innermostLoop();
+		if (target >= 0)
+		{
+			elseEnd = findEnd(escape, target, top.limit);
+			if (loop != nullptr && m_resolved[target] == m_resolved[loop->exit]
+				&& (elseEnd <= end || elseEnd >= m_numCode || m_cfg.isReachable(m_cfg.blockAt(elseEnd))))
+				elseEnd = -1;
+			if (elseEnd >= 0)
+				m_marks[escape].role = ELSE;
+		}
+	}
+
+	// an if right at the start of an else block and ending with it is an elseif
+	Header header = IF;
+	int blockEnd = (elseEnd >= 0) ? elseEnd : end;
+	if (top.kind == ELSE_BLOCK && top.escape >= 0 && blockEnd == top.end && !isUnstructured(pc) && isPure(top.start, cond.firstPc))
+	{
+		m_marks[top.escape].role = ELSE_IF;
+		m_blocks.pop_back();
+		header = ELSEIF;
+	}
+
+	cond.header = header;
+	m_marks[pc].header = header;
+	addBlock(THEN, pc + 1, end, end, -1, elseEnd < 0);
+	m_blocks.back().elseEnd = elseEnd;
+}
+
+void ControlStructure::addBlock(BlockKind kind, int start, int end, int limit, int exit, bool emitEnd)
+{
+	Block block = { kind, start, end, limit, exit, -1, -1, emitEnd };
+	m_blocks.push_back(block);
+}
+
+const ControlStructure::Block* ControlStructure::innermostLoop() const
+{
+	for (size_t i = m_blocks.size(); i > 0; --i)
+	{
+		if (m_blocks[i - 1].exit >= 0)
+			return &m_blocks[i - 1];
+	}
+	return nullptr;
+}
+
+bool ControlStructure::isStatement(int pc) const
+{
+	switch (opcode(pc))
+	{
+	case OP_CALL:
+		// calls used as values return something
+		return GETARG_B(m_code[pc]) == 0;
+
+	case OP_JMP:
+		return m_marks[pc].role != VALUE_SKIP;
+
+	case OP_POP:
+		return !skipAdjust(pc);
+
+	case OP_END:
+	case OP_RETURN:
+	case OP_TAILCALL:
+	case OP_SETLOCAL:
+	case OP_SETGLOBAL:
+	case OP_SETTABLE:
+	case OP_FORPREP:
+	case OP_FORLOOP:
+	case OP_LFORPREP:
+	case OP_LFORLOOP:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool ControlStructure::isPure(int start, int end) const
+{
+	// no statements in [start, end) and nothing lands inside from elsewhere
+	if (m_statements[end] != m_statements[start])
+		return false;
+
+	for (int pc = start + 1; pc <= end; ++pc)
+	{
+		if (!isReachedOnlyFrom(pc, start, end))
+			return false;
+	}
+	return true;
+}
+
+bool ControlStructure::isReachedOnlyFrom(int pc, int first, int last) const
+{
+	return m_maxSource[pc] < 0 || (m_minSource[pc] >= first && m_maxSource[pc] <= last);
+}
+
+bool ControlStructure::isEmpty(int pc, int target) const
+{
+	return m_resolved[target] == m_resolved[pc + 1];
+}
+
+int ControlStructure::findEnd(int from, int target, int limit) const
+{
+	if (target < 0)
+		return -1;
+	if (target > from && target <= limit)
+		return target;
+
+	// the jump was threaded through the JMPs ending the enclosing blocks,
+	//  the last one of them before the limit ends this block
+	int key = m_resolved[target];
+	auto it = std::upper_bound(m_jumpIndex.begin(), m_jumpIndex.end(), std::make_pair(key, limit));
+	if (it == m_jumpIndex.begin())
+		return -1;
+	--it;
+	if (it->first != key || it->second <= from)
+		return -1;
+	return it->second;
+}
+
+int ControlStructure::findRegion(int start, int limit) const
+{
+	auto it = std::lower_bound(m_regions.begin(), m_regions.end(), start,
+		[](const Region &region, int pc) { return region.firstPc < pc; });
+	if (it == m_regions.end() || it->lastPc >= limit || it->header != IF || !isPure(start, it->firstPc))
+		return -1;
+	return static_cast<int>(it - m_regions.begin());
+}
+
+int ControlStructure::jumpTarget(int pc) const
+{
+	return ControlFlowGraph::jumpTarget(m_code, m_numCode, pc);
+}
+
+OpCode ControlStructure::opcode(int pc) const
+{
+	return GET_OPCODE(m_code[pc]);
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "lopcodes.h"
+
+// recovers the statements of a function from its jumps, once per Proto.
+// conditional jumps are grouped into regions of short-circuit conditions,
+//  loops are found from their backward jumps and checked against the
+//  dominator tree, and/or used as values are told apart by their
+//  post-dominator which is the end of the expression.
+// the decompiler then walks the code once and asks what every pc opens or closes
+class ControlStructure
+{
+public:
+	enum Role
+	{
+		NONE,
+		COND,			// part of the condition of a statement
+		VALUE,			// part of an and/or used as a value
+		ELSE,			// leaves the then block, an else block follows
+		ELSE_IF,		// leaves the then block, an elseif follows
+		BREAK,
+		LOOP_END,		// back to the loop header
+		VALUE_SKIP,		// jumps over the nil and 1 pushed for a value
+		CONSTANT_ELSE,	// leaves the then block of an if with a constant condition
+		UNSTRUCTURED
+	};
+
+	// statement opened by the last jump of a condition
+	enum Header { IF, ELSEIF, WHILE, UNTIL };
+
+	// loops that are not opened by a condition, repeat or `while 1`
+	struct Open
+	{
+		int pc;
+		bool repeat;
+	};
+
+	void analyze(const Instruction* code, int numCode);
+
+	Role role(int pc) const;
+	// blocks closed right before pc
+	int numEnds(int pc) const;
+	// number of jumps of the condition ending at pc, 0 if none ends there
+	int numJumps(int pc) const;
+	Header header(int pc) const;
+	// the block of the condition ending at pc could not be nested properly
+	bool isUnstructured(int pc) const;
+	// sorted by pc, outer loops first
+	const std::vector<Open>& opens() const;
+
+	// a value expression ends at pc, it is left on the stack there
+	bool isValueFinal(int pc) const;
+	// the expression ends with PUSHNILJMP, PUSHINT 1
+	bool hasNilJump(int final) const;
+	// the last operand jumps over the nil and 1
+	bool hasSkip(int final) const;
+	// end of the value expression a VALUE jump belongs to
+	int valueFinal(int pc) const;
+
+	// POP or PUSHNIL only there to keep the compiler's stack level right,
+	//  around a break and in front of the nil and 1 of a value
+	bool skipAdjust(int pc) const;
+
+	// where a jump to pc ends up after following JMP chains
+	int resolve(int pc) const;
+
+	int numUnstructured() const;
+
+private:
+	enum Flags
+	{
+		FINAL = 1,
+		NIL_JUMP = 2,
+		SKIP = 4,
+		SKIP_ADJUST = 8,
+		UNSTRUCTURED_BLOCK = 16
+	};
+
+	struct Mark
+	{
+		unsigned char role;
+		unsigned char header;
+		unsigned char flags;
+		int numEnds;
+		int numJumps;
+		int final;
+	};
+
+	// a run of conditional jumps evaluated as one condition
+	struct Region
+	{
+		int firstPc;
+		int lastPc;
+		int numJumps;
+		// target of the last jump, taken when the condition fails
+		int target;
+		Header header;
+		// WHILE: header and backward jump of the loop
+		int loopStart;
+		int loopEnd;
+	};
+
+	struct Candidate
+	{
+		Open open;
+		int end;
+		int limit;
+		int exit;
+		int region;
+		int backJump;
+	};
+
+	enum BlockKind { FUNCTION, THEN, ELSE_BLOCK, WHILE_BLOCK, LOOP_BLOCK, REPEAT_BLOCK, FOR_BLOCK };
+
+	struct Block
+	{
+		BlockKind kind;
+		int start;
+		// closes right before end
+		int end;
+		// the last pc a nested block may end at
+		int limit;
+		// where a break goes, -1 if this is not a loop
+		int exit;
+		// THEN: end of the else block following it, -1 if there is none
+		int elseEnd;
+		// ELSE_BLOCK: the jump leaving the then block
+		int escape;
+		bool emitEnd;
+	};
+
+	void resolveJumps();
+	void findValues();
+	void findConditions();
+	void findLoops();
+	void buildBlocks();
+
+	void openCondition(int pc, int region);
+	void openIf(int pc, int region);
+	void addBlock(BlockKind kind, int start, int end, int limit, int exit, bool emitEnd);
+	const Block* innermostLoop() const;
+
+	bool isStatement(int pc) const;
+	bool isPure(int start, int end) const;
+	bool isReachedOnlyFrom(int pc, int first, int last) const;
+	bool tryMerge(Region &first, const Region &second) const;
+	bool isEmpty(int pc, int target) const;
+	int findEnd(int from, int target, int limit) const;
+	int findRegion(int start, int limit) const;
+	int jumpTarget(int pc) const;
+	OpCode opcode(int pc) const;
+
+	const Instruction* m_code;
+	int m_numCode;
+	ControlFlowGraph m_cfg;
+
+	std::vector<Mark> m_marks;
+	std::vector<int> m_resolved;
+	// lowest and highest pc of the jumps landing on every pc
+	std::vector<int> m_minSource;
+	std::vector<int> m_maxSource;
+	// statements in front of every pc, to tell expressions apart
+	std::vector<int> m_statements;
+	// every JMP keyed by where it ends up, for threaded jumps
+	std::vector<std::pair<int, int>> m_jumpIndex;
+
+	std::vector<Region> m_regions;
+	std::vector<int> m_regionAt;
+	std::vector<Candidate> m_candidates;
+	std::vector<Open> m_opens;
+	std::vector<Block> m_blocks;
+	int m_numUnstructured;
+};
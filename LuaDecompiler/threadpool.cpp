@@ -0,0 +1,135 @@
+#include "threadpool.h"
+
+namespace
+{
+	// which pool and worker the current thread belongs to
+	thread_local const ThreadPool* t_pool = nullptr;
+	thread_local int t_workerIndex = -1;
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+	: m_nextQueue(0), m_queued(0), m_pending(0), m_stop(false)
+{
+	if (numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	for (unsigned int i = 0; i < numThreads; ++i)
+		m_queues.emplace_back(new WorkQueue);
+
+	for (unsigned int i = 0; i < numThreads; ++i)
+		m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::submit(Task task)
+{
+	int index = workerIndex();
+	if (index < 0)
+		index = m_nextQueue++ % m_queues.size();
+
+	++m_pending;
+	{
+		WorkQueue& queue = *m_queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	// bump the counter under the lock so a worker
+	//  about to sleep cannot miss the wakeup
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_queued;
+	}
+	m_workAvailable.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_allDone.wait(lock, [this] { return m_pending == 0; });
+}
+
+unsigned int ThreadPool::size() const
+{
+	return m_threads.size();
+}
+
+int ThreadPool::workerIndex() const
+{
+	return (t_pool == this) ? t_workerIndex : -1;
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+	t_pool = this;
+	t_workerIndex = index;
+
+	for (;;)
+	{
+		Task task;
+		if (popTask(index, task) || stealTask(index, task))
+		{
+			--m_queued;
+			task();
+			finishTask();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_workAvailable.wait(lock, [this] { return m_stop || m_queued > 0; });
+		if (m_stop && m_queued == 0)
+			return;
+	}
+}
+
+bool ThreadPool::popTask(unsigned int index, Task& task)
+{
+	WorkQueue& queue = *m_queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::stealTask(unsigned int index, Task& task)
+{
+	// start with the neighbour so thieves spread out
+	for (size_t i = 1; i < m_queues.size(); ++i)
+	{
+		WorkQueue& queue = *m_queues[(index + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::finishTask()
+{
+	if (--m_pending == 0)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_allDone.notify_all();
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing thread pool
+// every worker owns a deque of tasks. it pops its own work from the back
+//  and, when it runs dry, steals from the front of the other deques
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// numThreads == 0 picks the number of hardware threads
+	explicit ThreadPool(unsigned int numThreads);
+	~ThreadPool();
+
+	// prevent copying
+	ThreadPool(ThreadPool const&) = delete;
+	void operator=(ThreadPool const&) = delete;
+
+	// queue a task. tasks submitted from a worker go to that worker's
+	//  own deque, tasks from outside are dealt round-robin
+	void submit(Task task);
+
+	// block until every submitted task has finished
+	void wait();
+
+	unsigned int size() const;
+
+	// index of the worker running the calling thread,
+	//  -1 if the caller does not belong to this pool
+	int workerIndex() const;
+
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(unsigned int index);
+	bool popTask(unsigned int index, Task& task);
+	bool stealTask(unsigned int index, Task& task);
+	void finishTask();
+
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_allDone;
+
+	std::atomic<unsigned int> m_nextQueue;
+	// tasks sitting in a deque
+	std::atomic<size_t> m_queued;
+	// tasks submitted but not finished yet
+	std::atomic<size_t> m_pending;
+	bool m_stop;
+};
@@ -0,0 +1,142 @@
+#include "verifier.h"
+#include <cstring>
+#include <sstream>
+#include "opcodes.h"
+#include "luac\luac.h"
+
+namespace
+{
+	// the parser's messages run over two lines
+	const int MESSAGE_SIZE = 512;
+
+	// the longest piece of a string constant quoted in a message
+	const size_t QUOTED_LENGTH = 32;
+
+	bool usesString(OpCode op)
+	{
+		return op == OP_PUSHSTRING || op == OP_GETGLOBAL || op == OP_GETDOTTED ||
+			op == OP_PUSHSELF || op == OP_SETGLOBAL;
+	}
+
+	bool usesNumber(OpCode op)
+	{
+		return op == OP_PUSHNUM || op == OP_PUSHNEGNUM;
+	}
+
+	bool sameInstruction(const Proto* expected, Instruction a, const Proto* actual, Instruction b)
+	{
+		OpCode op = GET_OPCODE(a);
+		if (op != GET_OPCODE(b))
+			return false;
+
+		// the constants may have been numbered differently
+		if (usesString(op))
+		{
+			const TString* lhs = expected->kstr[GETARG_U(a)];
+			const TString* rhs = actual->kstr[GETARG_U(b)];
+			return lhs->len == rhs->len && std::memcmp(lhs->str, rhs->str, lhs->len) == 0;
+		}
+		if (usesNumber(op))
+			return expected->knum[GETARG_U(a)] == actual->knum[GETARG_U(b)];
+
+		return a == b;
+	}
+
+	std::string describe(const Proto* tf, Instruction instr)
+	{
+		OpCode op = GET_OPCODE(instr);
+		const OpInfo &info = opInfos[op];
+
+		std::ostringstream str;
+		str << info.name;
+		if (usesString(op))
+		{
+			const TString* ts = tf->kstr[GETARG_U(instr)];
+			std::string quoted(ts->str, ts->len < QUOTED_LENGTH ? ts->len : QUOTED_LENGTH);
+			str << " \"" << quoted << (ts->len > QUOTED_LENGTH ? "...\"" : "\"");
+		}
+		else if (usesNumber(op))
+			str << ' ' << tf->knum[GETARG_U(instr)];
+		else if (info.format == OpInfo::U)
+			str << ' ' << GETARG_U(instr);
+		else if (info.format == OpInfo::S)
+			str << ' ' << GETARG_S(instr);
+		else if (info.format == OpInfo::AB)
+			str << ' ' << GETARG_A(instr) << ' ' << GETARG_B(instr);
+		return str.str();
+	}
+}
+
+Verifier::Verifier()
+	: m_loader(newloader())
+{}
+
+Verifier::~Verifier()
+{
+	freeloader(m_loader);
+}
+
+int Verifier::verify(const Proto* tf, const std::string &source, const char* fileName, std::string &errors)
+{
+	char message[MESSAGE_SIZE];
+	Proto* recompiled = compileproto(m_loader, source.data(), source.size(), fileName, message, MESSAGE_SIZE);
+
+	int mismatches;
+	if (recompiled == NULL)
+	{
+		std::string line(message);
+		for (char &c : line)
+		{
+			if (c == '\n')
+				c = ' ';
+		}
+		errors += "Error: verify: the source does not compile, " + line + '\n';
+		mismatches = 1;
+	}
+	else
+		mismatches = compareFunction(tf, recompiled, "main", errors);
+
+	resetloader(m_loader);
+	return mismatches;
+}
+
+int Verifier::compareFunction(const Proto* expected, const Proto* actual, const std::string &name, std::string &errors)
+{
+	std::ostringstream error;
+	if (expected->numparams != actual->numparams || expected->is_vararg != actual->is_vararg)
+	{
+		error << "takes " << actual->numparams << (actual->is_vararg ? " parameters and ..." : " parameters")
+			<< " instead of " << expected->numparams << (expected->is_vararg ? " and ..." : "");
+	}
+	else
+	{
+		int numCode = expected->ncode < actual->ncode ? expected->ncode : actual->ncode;
+		int pc = 0;
+		while (pc < numCode && sameInstruction(expected, expected->code[pc], actual, actual->code[pc]))
+			++pc;
+
+		if (pc < numCode)
+		{
+			error << "differs at instruction " << pc + 1 << ", " << describe(actual, actual->code[pc])
+				<< " instead of " << describe(expected, expected->code[pc]);
+		}
+		else if (expected->ncode != actual->ncode)
+			error << "has " << actual->ncode << " instructions instead of " << expected->ncode;
+		else if (expected->nkproto != actual->nkproto)
+			error << "defines " << actual->nkproto << " functions instead of " << expected->nkproto;
+	}
+
+	int mismatches = 0;
+	if (!error.str().empty())
+	{
+		errors += "Error: verify: function " + name + ' ' + error.str() + '\n';
+		++mismatches;
+	}
+
+	// nested functions are paired by their index, even below a function that differs
+	int numNested = expected->nkproto < actual->nkproto ? expected->nkproto : actual->nkproto;
+	for (int i = 0; i < numNested; ++i)
+		mismatches += compareFunction(expected->kproto[i], actual->kproto[i], name + '.' + std::to_string(i + 1), errors);
+
+	return mismatches;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+
+struct Proto;
+struct Loader;
+
+// compiles a decompiled source back in memory and compares its functions
+//  with the ones of the chunk it came from.
+// the code has to match instruction by instruction, with the constants
+//  an instruction uses compared by value, and so do the parameters and
+//  the nested functions. locals and line numbers are left out, the
+//  decompiler does not keep them
+class Verifier
+{
+public:
+	Verifier();
+	~Verifier();
+
+	// prevent copying, the loader state is owned
+	Verifier(Verifier const&) = delete;
+	void operator=(Verifier const&) = delete;
+
+	// adds a line to errors for every function that differs and
+	//  returns how many did, a source that does not compile counts as one.
+	// tf has to stay loaded until this returns
+	int verify(const Proto* tf, const std::string &source, const char* fileName, std::string &errors);
+
+private:
+	int compareFunction(const Proto* expected, const Proto* actual, const std::string &name, std::string &errors);
+
+	// loader of the recompiled sources, reset on every verify
+	Loader* m_loader;
+};
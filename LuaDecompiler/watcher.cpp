@@ -0,0 +1,300 @@
+#include "watcher.h"
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+#endif
+
+using namespace std::experimental;
+
+#ifdef _WIN32
+
+namespace
+{
+	const DWORD NOTIFY_FILTER = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+	// in DWORDs, ReadDirectoryChangesW wants them aligned
+	const size_t BUFFER_SIZE = 16 * 1024;
+}
+
+// a single read of the whole tree is kept pending, its event is signalled once it completes
+struct DirectoryWatcher::Platform
+{
+	HANDLE directory;
+	HANDLE event;
+	OVERLAPPED overlapped;
+	DWORD buffer[BUFFER_SIZE];
+	bool reading;
+};
+
+DirectoryWatcher::DirectoryWatcher(const std::string &root)
+	: m_root(root), m_platform(new Platform()), m_lost(false)
+{
+	m_platform->directory = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	m_platform->event = CreateEventA(NULL, TRUE, FALSE, NULL);
+	m_platform->reading = false;
+	m_lost = m_platform->directory == INVALID_HANDLE_VALUE || m_platform->event == NULL;
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	if (m_platform->reading)
+	{
+		DWORD bytes = 0;
+		CancelIo(m_platform->directory);
+		GetOverlappedResult(m_platform->directory, &m_platform->overlapped, &bytes, TRUE);
+	}
+	if (m_platform->directory != INVALID_HANDLE_VALUE)
+		CloseHandle(m_platform->directory);
+	if (m_platform->event != NULL)
+		CloseHandle(m_platform->event);
+}
+
+bool DirectoryWatcher::read(int timeoutMs)
+{
+	Platform &platform = *m_platform;
+	if (!platform.reading)
+	{
+		std::memset(&platform.overlapped, 0, sizeof(platform.overlapped));
+		platform.overlapped.hEvent = platform.event;
+		ResetEvent(platform.event);
+		if (!ReadDirectoryChangesW(platform.directory, platform.buffer, sizeof(platform.buffer), TRUE, NOTIFY_FILTER, NULL, &platform.overlapped, NULL))
+		{
+			m_lost = true;
+			return false;
+		}
+		platform.reading = true;
+	}
+
+	DWORD waited = WaitForSingleObject(platform.event, timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+	if (waited == WAIT_TIMEOUT)
+		return false;
+
+	platform.reading = false;
+	DWORD bytes = 0;
+	if (waited != WAIT_OBJECT_0 || !GetOverlappedResult(platform.directory, &platform.overlapped, &bytes, FALSE))
+	{
+		m_lost = true;
+		return false;
+	}
+
+	// more changed than the buffer holds, the whole tree is looked at again
+	if (bytes == 0)
+	{
+		add(m_root, false, true);
+		return true;
+	}
+
+	const char* p = reinterpret_cast<const char*>(platform.buffer);
+	for (;;)
+	{
+		const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+		std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+		std::string path = (filesystem::path(m_root) / filesystem::path(name)).string();
+		std::error_code error;
+
+		switch (info->Action)
+		{
+		case FILE_ACTION_REMOVED:
+		case FILE_ACTION_RENAMED_OLD_NAME:
+			add(path, true, false);
+			break;
+
+		case FILE_ACTION_ADDED:
+		case FILE_ACTION_RENAMED_NEW_NAME:
+			add(path, false, filesystem::is_directory(path, error));
+			break;
+
+		case FILE_ACTION_MODIFIED:
+			// directories are modified whenever their files are
+			if (!filesystem::is_directory(path, error))
+				add(path, false, false);
+			break;
+		}
+
+		if (info->NextEntryOffset == 0)
+			break;
+		p += info->NextEntryOffset;
+	}
+	return true;
+}
+
+#else
+
+namespace
+{
+	// files are taken once they are closed after writing or renamed into place,
+	//  not while they are still being written
+	const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR;
+	const size_t BUFFER_SIZE = 64 * 1024;
+}
+
+// inotify watches single directories, every directory of the tree gets its own
+struct DirectoryWatcher::Platform
+{
+	int fd;
+	std::unordered_map<int, std::string> directories;
+
+	bool watch(const std::string &path)
+	{
+		int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+		if (wd < 0)
+			return false;
+		directories[wd] = path;
+		return true;
+	}
+
+	bool watchTree(const std::string &path)
+	{
+		if (!watch(path))
+			return false;
+
+		std::error_code error;
+		filesystem::recursive_directory_iterator dir(path, error), end;
+		for (; !error && dir != end; dir.increment(error))
+		{
+			std::error_code typeError;
+			if (filesystem::is_directory(dir->path(), typeError))
+				watch(dir->path().string());
+		}
+		return true;
+	}
+
+	// a directory moved away keeps its watches, their paths would be wrong
+	void unwatchTree(const std::string &path)
+	{
+		std::string prefix = path + '/';
+		for (const auto &directory : directories)
+		{
+			if (directory.second == path || directory.second.compare(0, prefix.size(), prefix) == 0)
+				inotify_rm_watch(fd, directory.first);
+		}
+	}
+};
+
+DirectoryWatcher::DirectoryWatcher(const std::string &root)
+	: m_root(root), m_platform(new Platform()), m_lost(false)
+{
+	m_platform->fd = inotify_init1(IN_CLOEXEC);
+	m_lost = m_platform->fd < 0 || !m_platform->watchTree(root);
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	if (m_platform->fd >= 0)
+		close(m_platform->fd);
+}
+
+bool DirectoryWatcher::read(int timeoutMs)
+{
+	Platform &platform = *m_platform;
+
+	pollfd ready = { platform.fd, POLLIN, 0 };
+	int polled = poll(&ready, 1, timeoutMs);
+	if (polled == 0 || (polled < 0 && errno == EINTR))
+		return false;
+
+	alignas(inotify_event) char buffer[BUFFER_SIZE];
+	ssize_t length = polled > 0 ? ::read(platform.fd, buffer, sizeof(buffer)) : -1;
+	if (length <= 0)
+	{
+		m_lost = errno != EINTR && errno != EAGAIN;
+		return false;
+	}
+
+	const inotify_event* event;
+	for (const char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + event->len)
+	{
+		event = reinterpret_cast<const inotify_event*>(p);
+
+		// the queue overflowed, the whole tree is looked at again
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+			add(m_root, false, true);
+			continue;
+		}
+
+		auto directory = platform.directories.find(event->wd);
+		if (directory == platform.directories.end())
+			continue;
+		if (event->mask & IN_IGNORED)
+		{
+			platform.directories.erase(directory);
+			continue;
+		}
+		if (event->len == 0)
+			continue;
+
+		std::string path = (filesystem::path(directory->second) / event->name).string();
+		bool isDirectory = (event->mask & IN_ISDIR) != 0;
+
+		if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+		{
+			if (isDirectory && (event->mask & IN_MOVED_FROM))
+				platform.unwatchTree(path);
+			add(path, true, isDirectory);
+		}
+		else if (isDirectory)
+		{
+			// files may have been written before the watch was added, they are all looked at
+			platform.watchTree(path);
+			add(path, false, true);
+		}
+		else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			add(path, false, false);
+	}
+	return true;
+}
+
+#endif
+
+bool DirectoryWatcher::valid() const
+{
+	return !m_lost;
+}
+
+bool DirectoryWatcher::wait(std::vector<Change> &changes, int quietMs)
+{
+	changes.clear();
+
+	// some events, like a file created but not written yet, add nothing
+	while (m_pending.empty())
+	{
+		if (!read(-1) && m_lost)
+			return false;
+	}
+	while (read(quietMs))
+		;
+	if (m_lost)
+		return false;
+
+	// the files below a directory are looked at with it, the paths are sorted
+	std::string covered;
+	for (auto &pending : m_pending)
+	{
+		Change &change = pending.second;
+		if (!covered.empty() && change.path.compare(0, covered.size(), covered) == 0)
+			continue;
+		if (change.directory)
+			covered = change.path + static_cast<char>(filesystem::path::preferred_separator);
+		changes.push_back(std::move(change));
+	}
+	m_pending.clear();
+	return true;
+}
+
+void DirectoryWatcher::add(const std::string &path, bool removed, bool directory)
+{
+	Change &change = m_pending[path];
+	change.path = path;
+	change.removed = removed;
+	change.directory = directory;
+}
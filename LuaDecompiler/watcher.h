@@ -0,0 +1,53 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// reports the files changed below a directory, with inotify on linux
+//  and ReadDirectoryChangesW on windows.
+// the events of a burst, like an editor saving through a temporary file,
+//  are gathered until the directory has been quiet for a moment and then
+//  handed over together, with a single change per path
+class DirectoryWatcher
+{
+public:
+	struct Change
+	{
+		std::string path;
+		// the file or directory is gone, otherwise it was written or moved in
+		bool removed;
+		// everything below path has to be looked at, set for directories
+		//  moved in and for the root once events were lost
+		bool directory;
+	};
+
+	// watches root and every directory below it, including the ones created later
+	explicit DirectoryWatcher(const std::string &root);
+	~DirectoryWatcher();
+
+	// prevent copying, the handles are owned
+	DirectoryWatcher(DirectoryWatcher const&) = delete;
+	void operator=(DirectoryWatcher const&) = delete;
+
+	// false if root could not be watched
+	bool valid() const;
+
+	// blocks until something changed, then until nothing did for quietMs.
+	// the changes are sorted by path. false once the watch is lost
+	bool wait(std::vector<Change> &changes, int quietMs);
+
+private:
+	struct Platform;
+
+	// adds the events arriving within timeoutMs to m_pending, -1 waits for them.
+	// false if there were none or the watch is lost
+	bool read(int timeoutMs);
+	// a later change of the same path replaces the earlier one
+	void add(const std::string &path, bool removed, bool directory);
+
+	std::string m_root;
+	std::unique_ptr<Platform> m_platform;
+	std::map<std::string, Change> m_pending;
+	bool m_lost;
+};
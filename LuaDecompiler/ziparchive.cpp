@@ -0,0 +1,209 @@
+#include "ziparchive.h"
+#include <algorithm>
+#include <fstream>
+#include "hash.h"
+#include "inflate.h"
+
+namespace
+{
+	const uint32_t LOCAL_HEADER = 0x04034b50;
+	const uint32_t CENTRAL_HEADER = 0x02014b50;
+	const uint32_t END_OF_DIRECTORY = 0x06054b50;
+	const uint32_t ZIP64_END_OF_DIRECTORY = 0x06064b50;
+	const uint32_t ZIP64_LOCATOR = 0x07064b50;
+	const uint16_t ZIP64_EXTRA = 0x0001;
+
+	// fixed parts of the records, the variable ones follow them
+	const size_t LOCAL_SIZE = 30;
+	const size_t CENTRAL_SIZE = 46;
+	const size_t END_SIZE = 22;
+	const size_t ZIP64_END_SIZE = 56;
+	const size_t LOCATOR_SIZE = 20;
+	// the end record may be followed by a comment this long
+	const size_t MAX_COMMENT = 0xffff;
+
+	const uint16_t STORED = 0;
+	const uint16_t DEFLATED = 8;
+	const uint16_t ENCRYPTED = 1;
+
+	uint16_t read16(const unsigned char* p)
+	{
+		return static_cast<uint16_t>(p[0] | p[1] << 8);
+	}
+
+	uint32_t read32(const unsigned char* p)
+	{
+		return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+	}
+
+	uint64_t read64(const unsigned char* p)
+	{
+		return read32(p) | static_cast<uint64_t>(read32(p + 4)) << 32;
+	}
+}
+
+ZipArchive::ZipArchive()
+{
+	m_image.data = NULL;
+	m_image.size = 0;
+	m_image.handle = NULL;
+}
+
+ZipArchive::~ZipArchive()
+{
+	unmapfile(&m_image);
+}
+
+bool ZipArchive::isArchive(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	unsigned char magic[4];
+	if (!file.read(reinterpret_cast<char*>(magic), sizeof(magic)))
+		return false;
+
+	// an empty archive is only its end record
+	uint32_t signature = read32(magic);
+	return signature == LOCAL_HEADER || signature == END_OF_DIRECTORY;
+}
+
+bool ZipArchive::open(const std::string &path)
+{
+	unmapfile(&m_image);
+	m_entries.clear();
+	return mapfile(&m_image, path.c_str()) && readDirectory();
+}
+
+const std::vector<ZipArchive::Entry>& ZipArchive::entries() const
+{
+	return m_entries;
+}
+
+bool ZipArchive::read(const Entry &entry, std::string &contents) const
+{
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(m_image.data);
+	uint64_t size = m_image.size;
+
+	if ((entry.flags & ENCRYPTED) != 0 || (entry.method != STORED && entry.method != DEFLATED))
+		return false;
+	if (size < LOCAL_SIZE || entry.headerOffset > size - LOCAL_SIZE || read32(data + entry.headerOffset) != LOCAL_HEADER)
+		return false;
+
+	// the local header may have an extra field of its own, unlike the central one
+	const unsigned char* header = data + entry.headerOffset;
+	uint64_t dataOffset = entry.headerOffset + LOCAL_SIZE + read16(header + 26) + read16(header + 28);
+	if (dataOffset > size || entry.compressedSize > size - dataOffset)
+		return false;
+
+	const char* stored = m_image.data + dataOffset;
+	size_t compressedSize = static_cast<size_t>(entry.compressedSize);
+	size_t start = contents.size();
+	if (entry.method == STORED)
+	{
+		if (entry.compressedSize != entry.size)
+			return false;
+		contents.append(stored, compressedSize);
+	}
+	else
+	{
+		// an entry inflating past its size is given up right there
+		if (entry.size > SIZE_MAX || !inflateData(stored, compressedSize, static_cast<size_t>(entry.size), contents))
+			return false;
+	}
+
+	return contents.size() - start == entry.size && crc32(contents.data() + start, contents.size() - start) == entry.crc;
+}
+
+bool ZipArchive::readDirectory()
+{
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(m_image.data);
+	uint64_t size = m_image.size;
+	if (size < END_SIZE)
+		return false;
+
+	// searched from the back, past a comment
+	uint64_t end = size - END_SIZE;
+	uint64_t lowest = end > MAX_COMMENT ? end - MAX_COMMENT : 0;
+	while (read32(data + end) != END_OF_DIRECTORY)
+	{
+		if (end == lowest)
+			return false;
+		--end;
+	}
+
+	uint64_t numEntries = read16(data + end + 10);
+	uint64_t directorySize = read32(data + end + 12);
+	uint64_t directoryOffset = read32(data + end + 16);
+
+	// zip64 archives keep the real values in a record of their own, found through a locator
+	if (end >= LOCATOR_SIZE && read32(data + end - LOCATOR_SIZE) == ZIP64_LOCATOR)
+	{
+		uint64_t recordOffset = read64(data + end - LOCATOR_SIZE + 8);
+		if (size < ZIP64_END_SIZE || recordOffset > size - ZIP64_END_SIZE || read32(data + recordOffset) != ZIP64_END_OF_DIRECTORY)
+			return false;
+		numEntries = read64(data + recordOffset + 32);
+		directorySize = read64(data + recordOffset + 40);
+		directoryOffset = read64(data + recordOffset + 48);
+	}
+
+	if (directoryOffset > size || directorySize > size - directoryOffset)
+		return false;
+
+	const unsigned char* p = data + directoryOffset;
+	const unsigned char* directoryEnd = p + directorySize;
+	m_entries.reserve(static_cast<size_t>(std::min<uint64_t>(numEntries, directorySize / CENTRAL_SIZE)));
+
+	for (uint64_t i = 0; i < numEntries; ++i)
+	{
+		if (static_cast<size_t>(directoryEnd - p) < CENTRAL_SIZE || read32(p) != CENTRAL_HEADER)
+			return false;
+		size_t nameLength = read16(p + 28);
+		size_t extraLength = read16(p + 30);
+		size_t commentLength = read16(p + 32);
+		if (static_cast<size_t>(directoryEnd - p) - CENTRAL_SIZE < nameLength + extraLength + commentLength)
+			return false;
+
+		Entry entry;
+		entry.flags = read16(p + 8);
+		entry.method = read16(p + 10);
+		entry.crc = read32(p + 16);
+		entry.compressedSize = read32(p + 20);
+		entry.size = read32(p + 24);
+		entry.headerOffset = read32(p + 42);
+		entry.name.assign(reinterpret_cast<const char*>(p + CENTRAL_SIZE), nameLength);
+
+		// the values too large for their fields are all ones,
+		//  the zip64 extra field holds them in this order
+		const unsigned char* extra = p + CENTRAL_SIZE + nameLength;
+		const unsigned char* extraEnd = extra + extraLength;
+		while (extraEnd - extra >= 4)
+		{
+			uint16_t id = read16(extra);
+			size_t length = read16(extra + 2);
+			const unsigned char* field = extra + 4;
+			if (static_cast<size_t>(extraEnd - field) < length)
+				break;
+
+			if (id == ZIP64_EXTRA)
+			{
+				const unsigned char* fieldEnd = field + length;
+				uint64_t* values[] = { &entry.size, &entry.compressedSize, &entry.headerOffset };
+				for (uint64_t* value : values)
+				{
+					if (*value != 0xffffffff)
+						continue;
+					if (fieldEnd - field < 8)
+						return false;
+					*value = read64(field);
+					field += 8;
+				}
+			}
+			extra += 4 + length;
+		}
+
+		p += CENTRAL_SIZE + nameLength + extraLength + commentLength;
+
+		if (!entry.name.empty() && entry.name.back() != '/')
+			m_entries.push_back(std::move(entry));
+	}
+	return true;
+}
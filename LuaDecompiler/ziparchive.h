@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "luac\mapfile.h"
+
+// a zip archive (or a pak, which is the same format) mapped into memory.
+// the entries are listed from the central directory, zip64 included, and
+//  read without extracting them to disk. stored and deflated entries are
+//  supported, encrypted ones are not
+class ZipArchive
+{
+public:
+	struct Entry
+	{
+		// as stored, with '/' between the directories
+		std::string name;
+		uint16_t method;
+		uint16_t flags;
+		uint32_t crc;
+		uint64_t compressedSize;
+		uint64_t size;
+		uint64_t headerOffset;
+	};
+
+	ZipArchive();
+	~ZipArchive();
+
+	// prevent copying, the mapping is owned
+	ZipArchive(ZipArchive const&) = delete;
+	void operator=(ZipArchive const&) = delete;
+
+	// true if path starts like a zip archive, only its first bytes are read
+	static bool isArchive(const std::string &path);
+
+	// false if the file can not be mapped or has no valid central directory
+	bool open(const std::string &path);
+
+	// files only, the directories are left out
+	const std::vector<Entry>& entries() const;
+
+	// appends the contents of entry to contents and checks them against its crc.
+	// may be called from several threads at once
+	bool read(const Entry &entry, std::string &contents) const;
+
+private:
+	bool readDirectory();
+
+	MappedFile m_image;
+	std::vector<Entry> m_entries;
+};
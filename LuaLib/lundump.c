@@ -4,9 +4,16 @@
 ** See Copyright Notice in lua.h
 */
 
+// modified: vectors and strings may point into in-place (memory mapped) streams instead of being copied.
+// modified: swapped vectors are read in one go and byte swapped in bulk (simd on x86).
+// modified: luaU_indexchunk finds the functions of a chunk without loading them, luaU_undumpfunction loads one.
+// modified: counts are checked against what is left of in-place streams before anything is allocated for them.
+// modified: the operands of the code are checked the way luaG_symbexec runs it, damaged code fails to load.
+
 #include <stdio.h>
 #include <string.h>
 
+#include "lcode.h"
 #include "lfunc.h"
 #include "lmem.h"
 #include "lopcodes.h"
@@ -39,33 +46,168 @@ static void ezread (lua_State* L, ZIO* Z, void* b, int n)
  if (r!=0) unexpectedEOZ(L,Z);
 }
 
-static void LoadBlock (lua_State* L, void* b, size_t size, ZIO* Z, int swap)
+/*
+** on in-place streams, return a pointer to the next n bytes and skip them.
+** NULL means the caller has to copy (not in-place, misaligned or short)
+*/
+static const void* ezmap (ZIO* Z, size_t n, size_t align)
+{
+ const void* p=Z->p;
+ if (n==0 || !zinplace(Z) || Z->n<n || ((size_t)p)%align!=0) return NULL;
+ Z->p+=n;
+ Z->n-=n;
+ return p;
+}
+
+/*
+** byte swapping for chunks written with the other byte order.
+** vectors are read in one go and swapped in place: x86 uses ssse3/avx2
+** shuffles for 4 and 8 byte elements, everything else the scalar loop
+*/
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SWAP_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SWAP_TARGET(t)
+#else
+#define SWAP_TARGET(t)	__attribute__((target(t)))
+#endif
+#endif
+
+static void SwapScalar (unsigned char* b, size_t n, size_t size)
 {
- if (swap)
+ size_t i;
+ for (i=0; i+size<=n; i+=size)
  {
-  char *p=(char *) b+size-1;
-  int n=size;
-  while (n--) *p--=(char)ezgetc(L,Z);
+  unsigned char* p=b+i;
+  unsigned char* q=b+i+size-1;
+  while (p<q)
+  {
+   unsigned char t=*p;
+   *p++=*q;
+   *q--=t;
+  }
  }
- else
-  ezread(L,Z,b,size);
 }
 
-static void LoadVector (lua_State* L, void* b, int m, size_t size, ZIO* Z, int swap)
+#ifdef SWAP_SIMD
+
+#define SWAP_NONE	0
+#define SWAP_SSSE3	1
+#define SWAP_AVX2	2
+
+static int DetectSwapLevel (void)
 {
- if (swap)
+#ifdef _MSC_VER
+ int r[4];
+ int level=SWAP_NONE;
+ __cpuid(r,0);
+ if (r[0]<1) return level;
+ __cpuid(r,1);
+ if (r[2] & (1<<9)) level=SWAP_SSSE3;
+ /* avx2 also needs the os to save ymm registers (osxsave + xgetbv) */
+ if ((r[2] & (1<<27)) && (r[2] & (1<<28)) && (_xgetbv(0) & 6)==6)
  {
-  char *q=(char *) b;
-  while (m--)
+  __cpuid(r,0);
+  if (r[0]>=7)
   {
-   char *p=q+size-1;
-   int n=size;
-   while (n--) *p--=(char)ezgetc(L,Z);
-   q+=size;
+   __cpuidex(r,7,0);
+   if (r[1] & (1<<5)) level=SWAP_AVX2;
   }
  }
- else
-  ezread(L,Z,b,m*size);
+ return level;
+#else
+ if (__builtin_cpu_supports("avx2")) return SWAP_AVX2;
+ if (__builtin_cpu_supports("ssse3")) return SWAP_SSSE3;
+ return SWAP_NONE;
+#endif
+}
+
+/* cpuid serializes the cpu, it is asked once and not for every vector.
+   threads racing here store the same value */
+static int SwapLevel (void)
+{
+ static volatile int level=-1;
+ if (level<0) level=DetectSwapLevel();
+ return level;
+}
+
+/* shuffle reversing every element of a 16 byte lane */
+#define SWAP_MASK(size)	((size)==4 ? \
+	_mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12) : \
+	_mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8))
+
+SWAP_TARGET("ssse3")
+static size_t SwapSSSE3 (unsigned char* b, size_t n, size_t size)
+{
+ const __m128i mask=SWAP_MASK(size);
+ size_t i;
+ for (i=0; i+16<=n; i+=16)
+ {
+  __m128i v=_mm_loadu_si128((const __m128i*)(b+i));
+  _mm_storeu_si128((__m128i*)(b+i),_mm_shuffle_epi8(v,mask));
+ }
+ return i;
+}
+
+SWAP_TARGET("avx2")
+static size_t SwapAVX2 (unsigned char* b, size_t n, size_t size)
+{
+ const __m256i mask=_mm256_broadcastsi128_si256(SWAP_MASK(size));
+ size_t i;
+ for (i=0; i+32<=n; i+=32)
+ {
+  __m256i v=_mm256_loadu_si256((const __m256i*)(b+i));
+  _mm256_storeu_si256((__m256i*)(b+i),_mm256_shuffle_epi8(v,mask));
+ }
+ return i;
+}
+
+#endif
+
+static void SwapVector (void* b, int m, size_t size)
+{
+ unsigned char* p=(unsigned char*) b;
+ size_t n=m*size;
+#ifdef SWAP_SIMD
+ if ((size==4 || size==8) && n>=32)
+ {
+  size_t done=0;
+  switch (SwapLevel())
+  {
+   case SWAP_AVX2: done=SwapAVX2(p,n,size); break;
+   case SWAP_SSSE3: done=SwapSSSE3(p,n,size); break;
+  }
+  p+=done;				/* elements never straddle a lane */
+  n-=done;
+ }
+#endif
+ SwapScalar(p,n,size);
+}
+
+static void LoadBlock (lua_State* L, void* b, size_t size, ZIO* Z, int swap)
+{
+ ezread(L,Z,b,size);
+ if (swap) SwapScalar((unsigned char*) b,size,size);
+}
+
+static void LoadVector (lua_State* L, void* b, int m, size_t size, ZIO* Z, int swap)
+{
+ ezread(L,Z,b,m*size);
+ if (swap) SwapVector(b,m,size);
+}
+
+/* load a vector, or point into the stream when no copy is needed */
+static void* LoadArray (lua_State* L, int m, size_t size, ZIO* Z, int swap)
+{
+ void* b=swap ? NULL : (void*)ezmap(Z,m*size,size);
+ if (b==NULL)
+ {
+  b=luaM_malloc(L,m*size);
+  LoadVector(L,b,m,size,Z,swap);
+ }
+ return b;
 }
 
 static int LoadInt (lua_State* L, ZIO* Z, int swap)
@@ -82,6 +224,18 @@ static size_t LoadSize (lua_State* L, ZIO* Z, int swap)
  return x;
 }
 
+/*
+** a count of items taking at least size bytes each. an in-place stream
+** holds the rest of the chunk, a count it can not hold is an error right
+** away instead of an allocation that is then read past the end
+*/
+static int LoadCount (lua_State* L, ZIO* Z, int swap, size_t size)
+{
+ int n=LoadInt(L,Z,swap);
+ if (n<0 || (zinplace(Z) && (size_t)n>Z->n/size)) unexpectedEOZ(L,Z);
+ return n;
+}
+
 static Number LoadNumber (lua_State* L, ZIO* Z, int swap)
 {
  Number x;
@@ -96,25 +250,110 @@ static TString* LoadString (lua_State* L, ZIO* Z, int swap)
   return NULL;
  else
  {
-  char* s=luaO_openspace(L,size);
-  LoadBlock(L,s,size,Z,0);
+  const char* s=(const char*)ezmap(Z,size,1);
+  if (s==NULL && zinplace(Z)) unexpectedEOZ(L,Z);	/* ezmap only fails if it is short */
+  if (s==NULL)
+  {
+   char* b=luaO_openspace(L,size);
+   LoadBlock(L,b,size,Z,0);
+   s=b;
+  }
   return luaS_newlstr(L,s,size-1);	/* remove trailing '\0' */
  }
 }
 
+static void badcode (lua_State* L, ZIO* Z, int pc)
+{
+ luaO_verror(L,"bad code in `%.99s' at instruction %d",ZNAME(Z),pc+1);
+}
+
+/*
+** code of a chunk is trusted by whoever reads it. go through it once the
+** way luaG_symbexec does, with the stack height of every instruction,
+** and check that the constants, functions, locals and jump targets it
+** names exist and that it neither pops more than it pushed nor grows the
+** stack past maxstacksize
+*/
+static void TestCode (lua_State* L, const Proto* tf, ZIO* Z)
+{
+ const Instruction* code=tf->code;
+ int size=tf->ncode;
+ int top=tf->numparams+(tf->is_vararg!=0);
+ int pc;
+ for (pc=0; pc<size; pc++)
+ {
+  const Instruction i=code[pc];
+  OpCode op=GET_OPCODE(i);
+  int pop,push;
+  /* with a wider Instruction the bits above SIZE_INSTRUCTION would be cut off the operands */
+  if (op>=NUM_OPCODES || GETARG_U(i)<0 || CREATE_U(op,GETARG_U(i))!=i) badcode(L,Z,pc);
+  if (top<0 || top>tf->maxstacksize) badcode(L,Z,pc);
+  switch (op)
+  {
+   case OP_PUSHSTRING: case OP_GETGLOBAL: case OP_GETDOTTED:
+   case OP_PUSHSELF: case OP_SETGLOBAL:
+    if (GETARG_U(i)>=tf->nkstr || tf->kstr[GETARG_U(i)]==NULL) badcode(L,Z,pc);
+    break;
+   case OP_PUSHNUM: case OP_PUSHNEGNUM:
+    if (GETARG_U(i)>=tf->nknum) badcode(L,Z,pc);
+    break;
+   case OP_GETLOCAL: case OP_GETINDEXED: case OP_SETLOCAL:
+    if (GETARG_U(i)>=tf->maxstacksize) badcode(L,Z,pc);
+    break;
+   case OP_CLOSURE:
+    if (GETARG_A(i)>=tf->nkproto) badcode(L,Z,pc);
+    break;
+   case OP_JMPNE: case OP_JMPEQ: case OP_JMPLT: case OP_JMPLE: case OP_JMPGT:
+   case OP_JMPGE: case OP_JMPT: case OP_JMPF: case OP_JMPONT: case OP_JMPONF:
+   case OP_JMP: case OP_FORPREP: case OP_FORLOOP: case OP_LFORPREP: case OP_LFORLOOP:
+    if (pc+1+GETARG_S(i)<0 || pc+1+GETARG_S(i)>=size) badcode(L,Z,pc);
+    break;
+   default:
+    break;
+  }
+  switch (op)
+  {
+   case OP_RETURN:
+    if (top<GETARG_U(i)) badcode(L,Z,pc);
+    top=GETARG_U(i);
+    continue;
+   case OP_TAILCALL:
+    if (top<GETARG_A(i)) badcode(L,Z,pc);
+    top=GETARG_B(i);
+    continue;
+   case OP_CALL:
+    if (top<=GETARG_A(i)) badcode(L,Z,pc);
+    top=GETARG_A(i)+(GETARG_B(i)==MULT_RET ? 1 : GETARG_B(i));
+    continue;
+   case OP_PUSHNIL: pop=0; push=GETARG_U(i); break;
+   case OP_POP: pop=GETARG_U(i); push=0; break;
+   case OP_SETTABLE: case OP_SETLIST: pop=GETARG_B(i); push=0; break;
+   case OP_SETMAP: pop=2*GETARG_U(i); push=0; break;
+   case OP_CONCAT: pop=GETARG_U(i); push=1; break;
+   case OP_CLOSURE: pop=GETARG_B(i); push=1; break;
+   default:
+    pop=luaK_opproperties[op].pop;
+    push=luaK_opproperties[op].push;
+    break;
+  }
+  if (top<pop) badcode(L,Z,pc);
+  top+=push-pop;
+ }
+}
+
 static void LoadCode (lua_State* L, Proto* tf, ZIO* Z, int swap)
 {
- int size=LoadInt(L,Z,swap);
- tf->code=luaM_newvector(L,size,Instruction);
- LoadVector(L,tf->code,size,sizeof(*tf->code),Z,swap);
- if (tf->code[size-1]!=OP_END) luaO_verror(L,"bad code in `%.99s'",ZNAME(Z));
+ int size=LoadCount(L,Z,swap,sizeof(*tf->code));
+ tf->code=(Instruction*)LoadArray(L,size,sizeof(*tf->code),Z,swap);
+ if (size==0 || tf->code[size-1]!=OP_END) luaO_verror(L,"bad code in `%.99s'",ZNAME(Z));
  luaF_protook(L,tf,size);
+ TestCode(L,tf,Z);
 }
 
 static void LoadLocals (lua_State* L, Proto* tf, ZIO* Z, int swap)
 {
  int i,n;
- tf->nlocvars=n=LoadInt(L,Z,swap);
+ tf->nlocvars=n=LoadCount(L,Z,swap,sizeof(size_t)+2*sizeof(int));
  tf->locvars=luaM_newvector(L,n,LocVar);
  for (i=0; i<n; i++)
  {
@@ -127,9 +366,8 @@ static void LoadLocals (lua_State* L, Proto* tf, ZIO* Z, int swap)
 static void LoadLines (lua_State* L, Proto* tf, ZIO* Z, int swap)
 {
  int n;
- tf->nlineinfo=n=LoadInt(L,Z,swap);
- tf->lineinfo=luaM_newvector(L,n,int);
- LoadVector(L,tf->lineinfo,n,sizeof(*tf->lineinfo),Z,swap);
+ tf->nlineinfo=n=LoadCount(L,Z,swap,sizeof(*tf->lineinfo));
+ tf->lineinfo=(int*)LoadArray(L,n,sizeof(*tf->lineinfo),Z,swap);
 }
 
 static Proto* LoadFunction (lua_State* L, ZIO* Z, int swap);
@@ -137,14 +375,13 @@ static Proto* LoadFunction (lua_State* L, ZIO* Z, int swap);
 static void LoadConstants (lua_State* L, Proto* tf, ZIO* Z, int swap)
 {
  int i,n;
- tf->nkstr=n=LoadInt(L,Z,swap);
+ tf->nkstr=n=LoadCount(L,Z,swap,sizeof(size_t));
  tf->kstr=luaM_newvector(L,n,TString*);
  for (i=0; i<n; i++)
   tf->kstr[i]=LoadString(L,Z,swap);
- tf->nknum=n=LoadInt(L,Z,swap);
- tf->knum=luaM_newvector(L,n,Number);
- LoadVector(L,tf->knum,n,sizeof(*tf->knum),Z,swap);
- tf->nkproto=n=LoadInt(L,Z,swap);
+ tf->nknum=n=LoadCount(L,Z,swap,sizeof(*tf->knum));
+ tf->knum=(Number*)LoadArray(L,n,sizeof(*tf->knum),Z,swap);
+ tf->nkproto=n=LoadCount(L,Z,swap,1);
  tf->kproto=luaM_newvector(L,n,Proto*);
  for (i=0; i<n; i++)
   tf->kproto[i]=LoadFunction(L,Z,swap);
@@ -234,6 +471,118 @@ Proto* luaU_undump (lua_State* L, ZIO* Z)
  return tf;
 }
 
+/*
+** load the function at the start of Z and the ones nested in it,
+** Z has to end with it
+*/
+Proto* luaU_undumpfunction (lua_State* L, ZIO* Z, int swap)
+{
+ Proto* tf=LoadFunction(L,Z,swap);
+ if (zgetc(Z)!=EOZ)
+  luaO_verror(L,"`%.99s' has more than one function",ZNAME(Z));
+ return tf;
+}
+
+/*
+** skip-scan of the undump format: only the sizes are read, everything else
+** is stepped over. it needs no lua_State, a malformed chunk fails the scan
+** instead of raising an error
+*/
+typedef struct Scan
+{
+ const unsigned char* start;
+ const unsigned char* p;
+ const unsigned char* end;
+ int swap;
+ FuncSpan* spans;
+ int max;
+ int n;
+} Scan;
+
+static int ScanBlock (Scan* S, void* b, size_t size)
+{
+ if ((size_t)(S->end-S->p)<size) return 0;
+ memcpy(b,S->p,size);
+ if (S->swap) SwapScalar((unsigned char*) b,size,size);
+ S->p+=size;
+ return 1;
+}
+
+static int ScanCount (Scan* S, int* n)
+{
+ return ScanBlock(S,n,sizeof(*n)) && *n>=0;
+}
+
+static int ScanSkip (Scan* S, size_t size)
+{
+ if ((size_t)(S->end-S->p)<size) return 0;
+ S->p+=size;
+ return 1;
+}
+
+static int ScanVector (Scan* S, int n, size_t size)
+{
+ if ((size_t)(S->end-S->p)/size<(size_t)n) return 0;
+ return ScanSkip(S,n*size);
+}
+
+static int ScanString (Scan* S)
+{
+ size_t size;
+ return ScanBlock(S,&size,sizeof(size)) && ScanSkip(S,size);
+}
+
+/* same order as LoadFunction, a function is numbered before its nested ones */
+static int ScanFunction (Scan* S, int parent)
+{
+ int self=S->n++;
+ size_t offset=S->p-S->start;
+ int line,i,n;
+ if (!ScanString(S) || !ScanBlock(S,&line,sizeof(line))) return 0;
+ if (!ScanSkip(S,sizeof(int)+1+sizeof(int)))
+  return 0;				/* numparams, is_vararg, maxstacksize */
+ if (!ScanCount(S,&n)) return 0;
+ for (i=0; i<n; i++)			/* locals */
+  if (!ScanString(S) || !ScanSkip(S,2*sizeof(int))) return 0;
+ if (!ScanCount(S,&n) || !ScanVector(S,n,sizeof(int))) return 0;
+ if (!ScanCount(S,&n)) return 0;
+ for (i=0; i<n; i++)
+  if (!ScanString(S)) return 0;
+ if (!ScanCount(S,&n) || !ScanVector(S,n,sizeof(Number))) return 0;
+ if (!ScanCount(S,&n)) return 0;
+ for (i=0; i<n; i++)
+  if (!ScanFunction(S,self)) return 0;
+ if (!ScanCount(S,&n) || n==0 || !ScanVector(S,n,sizeof(Instruction))) return 0;
+ if (self<S->max)
+ {
+  S->spans[self].offset=offset;
+  S->spans[self].size=(S->p-S->start)-offset;
+  S->spans[self].parent=parent;
+  S->spans[self].lineDefined=line;
+ }
+ return 1;
+}
+
+/*
+** find the functions of a chunk whose main function starts at offset,
+** after the header. fills at most max spans and returns the number of
+** functions, -1 if the chunk is malformed
+*/
+int luaU_indexchunk (const char* data, size_t size, size_t offset, int swap, FuncSpan* spans, int max)
+{
+ Scan S;
+ if (offset>size) return -1;
+ S.start=(const unsigned char*)data;
+ S.p=S.start+offset;
+ S.end=S.start+size;
+ S.swap=swap;
+ S.spans=spans;
+ S.max=max;
+ S.n=0;
+ if (!ScanFunction(&S,-1) || S.p!=S.end) return -1;
+ return S.n;
+}
+
 /*
 ** find byte order
 */
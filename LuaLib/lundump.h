@@ -16,6 +16,21 @@ Proto* luaU_undump (lua_State* L, ZIO* Z);
 /* find byte order */
 int luaU_endianess (void);
 
+/* where a function is stored in a chunk, the ones nested in it are stored inside it */
+typedef struct FuncSpan
+{
+ size_t offset;
+ size_t size;
+ int parent;			/* index of the enclosing function, -1 for main */
+ int lineDefined;
+} FuncSpan;
+
+/* find the functions of a chunk without loading it */
+int luaU_indexchunk (const char* data, size_t size, size_t offset, int swap, FuncSpan* spans, int max);
+
+/* load one function and the ones nested in it */
+Proto* luaU_undumpfunction (lua_State* L, ZIO* Z, int swap);
+
 /* definitions for headers of binary files */
 #define	VERSION		0x40		/* last format change was in 4.0 */
 #define	VERSION0	0x40		/* last major  change was in 4.0 */
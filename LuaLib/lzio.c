@@ -4,6 +4,8 @@
 ** See Copyright Notice in lua.h
 */
 
+// modified: added in-place memory streams (zimopen), loaded data may keep pointing into them.
+
 
 
 #include <stdio.h>
@@ -33,6 +35,29 @@ ZIO* zmopen (ZIO* z, const char* b, size_t size, const char *name) {
   return z;
 }
 
+/* ------------------------------------------------- in-place memory --- */
+
+/*
+** same as a memory buffer, but the buffer is guaranteed to outlive
+** whatever is loaded from it, so loaded data may point straight into it
+*/
+static int zimfilbuf (ZIO* z) {
+  (void)z;  /* to avoid warnings */
+  return EOZ;
+}
+
+
+ZIO* zimopen (ZIO* z, const char* b, size_t size, const char *name) {
+  if (zmopen(z, b, size, name) == NULL) return NULL;
+  z->filbuf = zimfilbuf;
+  return z;
+}
+
+
+int zinplace (ZIO* z) {
+  return z->filbuf == zimfilbuf;
+}
+
 /* ------------------------------------------------------------ strings --- */
 
 ZIO* zsopen (ZIO* z, const char* s, const char *name) {
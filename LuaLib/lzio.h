@@ -16,6 +16,8 @@
 #define zFopen	luaZ_Fopen
 #define zsopen	luaZ_sopen
 #define zmopen	luaZ_mopen
+#define zimopen	luaZ_imopen
+#define zinplace	luaZ_inplace
 #define zread	luaZ_read
 
 #define EOZ	(-1)			/* end of stream */
@@ -25,6 +27,9 @@ typedef struct zio ZIO;
 ZIO* zFopen (ZIO* z, FILE* f, const char *name);	/* open FILEs */
 ZIO* zsopen (ZIO* z, const char* s, const char *name);	/* string */
 ZIO* zmopen (ZIO* z, const char* b, size_t size, const char *name); /* memory */
+ZIO* zimopen (ZIO* z, const char* b, size_t size, const char *name); /* memory that outlives the loaded data */
+
+int zinplace (ZIO* z);	/* may loaded data point into the stream buffer? */
 
 size_t zread (ZIO* z, void* b, size_t n);	/* read next n bytes */
 